@@ -1,15 +1,73 @@
 #include "tcpclient.h"
 #include "messagemodel.h"
+#include "wire_tables.hpp"
 #include <QAbstractSocket>
 #include <QJsonDocument>
 #include <QDateTime>
 #include <QDataStream>
 #include <QJsonArray>
 #include <QStringList>
+#include <QCborValue>
+#include <QCborMap>
 #include <QDebug>
+#ifdef CHAT_HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 static QString gCurrentUser; // Used for message deduplication (keep QML currentUser and C++ synchronized)
 
+// CBOR payloads carry "type" as a tag: position in this list + 1 (common/wire_tables.hpp)
+static const QStringList kTypeNames = [] {
+    QStringList names;
+    for (const char* name : wire::kTypeNames) names << QString::fromLatin1(name);
+    return names;
+}();
+
+// High bit of a frame's length prefix: the payload is compressed (see server/protocol.hpp)
+static const quint32 kCompressedFrameFlag = 0x80000000u;
+
+#ifdef CHAT_HAVE_ZLIB
+// Inflates the server's per-connection deflate stream: raw deflate with the
+// preset dictionary, one sync-flushed block per frame with its trailing
+// 00 00 FF FF left off the wire.
+struct TcpClient::Inflater {
+    z_stream zs{};
+    bool ok = false;
+
+    Inflater() {
+        if (inflateInit2(&zs, -15) != Z_OK) return;
+        ok = inflateSetDictionary(&zs, reinterpret_cast<const Bytef*>(wire::kDictionary), static_cast<uInt>(wire::kDictionarySize)) == Z_OK;
+    }
+    ~Inflater() { inflateEnd(&zs); }
+
+    // one compressed frame payload -> the original payload; empty once the stream is broken
+    QByteArray decompress(QByteArray block) {
+        if (!ok) return {};
+        block.append("\x00\x00\xff\xff", 4);
+        zs.next_in = reinterpret_cast<Bytef*>(block.data());
+        zs.avail_in = static_cast<uInt>(block.size());
+        QByteArray out;
+        char buffer[16 * 1024];
+        do {
+            zs.next_out = reinterpret_cast<Bytef*>(buffer);
+            zs.avail_out = sizeof(buffer);
+            int rc = inflate(&zs, Z_SYNC_FLUSH);
+            if (rc != Z_OK && rc != Z_BUF_ERROR) {
+                ok = false;
+                return {};
+            }
+            out.append(buffer, static_cast<qsizetype>(sizeof(buffer) - zs.avail_out));
+            if (rc == Z_BUF_ERROR) break; // no progress possible: all input consumed
+        } while (zs.avail_in > 0 || zs.avail_out == 0);
+        return out;
+    }
+};
+#else
+struct TcpClient::Inflater {
+    QByteArray decompress(const QByteArray&) { return {}; } // never negotiated without zlib
+};
+#endif
+
 TcpClient::TcpClient(QObject* parent) : QObject(parent) {
     connect(&socket_, &QTcpSocket::readyRead, this, &TcpClient::onReadyRead);
     connect(&socket_, &QTcpSocket::connected, this, &TcpClient::onConnected);
@@ -20,6 +78,8 @@ TcpClient::TcpClient(QObject* parent) : QObject(parent) {
     connect(&heartbeatTimer_, &QTimer::timeout, this, &TcpClient::sendHeartbeat);
 }
 
+TcpClient::~TcpClient() = default;
+
 void TcpClient::connectToHost(const QString& host, quint16 port) {
     if (socket_.state() == QAbstractSocket::ConnectedState) socket_.disconnectFromHost();
     socket_.connectToHost(host, port);
@@ -33,11 +93,25 @@ void TcpClient::disconnectFromHost() {
 
 void TcpClient::onConnected() {
     heartbeatTimer_.start();
+    // offer the compact encoding; until the server answers we keep sending JSON
+    useCbor_ = false;
+    QJsonObject hello;
+    hello["type"] = "hello";
+    hello["encodings"] = QJsonArray{ "cbor", "json" };
+    hello["features"] = QJsonArray{ "history_pages" };
+#ifdef CHAT_HAVE_ZLIB
+    hello["compression"] = QJsonArray{ "deflate" };
+#endif
+    inflater_.reset(); // a new connection starts a new compression stream
+    sendJson(hello);
     emit connected();
 }
 
 void TcpClient::onDisconnected() {
     heartbeatTimer_.stop();
+    onlineUsers_.clear();
+    presenceVersion_ = 0;
+    inflater_.reset();
     emit disconnected();
     gCurrentUser.clear();
 }
@@ -58,8 +132,7 @@ void TcpClient::sendJson(const QJsonObject& obj) {
         gCurrentUser.clear();
     }
 
-    QJsonDocument jsonDocument(obj);
-    QByteArray payload = jsonDocument.toJson(QJsonDocument::Compact);
+    QByteArray payload = encodePayload(obj);
     QByteArray frame;
     QDataStream dataStream(&frame, QIODevice::WriteOnly);
     dataStream.setByteOrder(QDataStream::BigEndian);
@@ -74,22 +147,62 @@ void TcpClient::onReadyRead() {
     while (receiveBuffer_.size() >= 4) {
         QDataStream dataStream(receiveBuffer_);
         dataStream.setByteOrder(QDataStream::BigEndian);
-        quint32 frameLength = 0;
-        dataStream >> frameLength;
+        quint32 frameHeader = 0;
+        dataStream >> frameHeader;
+        const bool compressed = (frameHeader & kCompressedFrameFlag) != 0;
+        const quint32 frameLength = frameHeader & ~kCompressedFrameFlag;
         if (receiveBuffer_.size() < 4 + static_cast<int>(frameLength)) break;
         QByteArray framePayload = receiveBuffer_.mid(4, frameLength);
         receiveBuffer_.remove(0, 4 + frameLength);
+        if (compressed) {
+            if (!inflater_) inflater_ = std::make_unique<Inflater>();
+            framePayload = inflater_->decompress(framePayload);
+            if (framePayload.isEmpty()) {
+                // the stream can't be resynchronised: drop the connection
+                qWarning() << "Failed to decompress frame, disconnecting";
+                receiveBuffer_.clear();
+                socket_.abort();
+                return;
+            }
+        }
         processFrame(framePayload);
     }
 }
 
-void TcpClient::processFrame(const QByteArray& payload) {
+QByteArray TcpClient::encodePayload(const QJsonObject& obj) const {
+    if (!useCbor_) return QJsonDocument(obj).toJson(QJsonDocument::Compact);
+    QCborMap map = QCborMap::fromJsonObject(obj);
+    int tag = kTypeNames.indexOf(obj.value("type").toString());
+    if (tag >= 0) map.insert(QStringLiteral("type"), tag + 1);
+    return map.toCborValue().toCbor();
+}
+
+QJsonObject TcpClient::decodePayload(const QByteArray& payload) const {
+    // a CBOR map starts with 0xA0..0xBF, which never begins JSON text
+    if (!payload.isEmpty() && (static_cast<quint8>(payload.at(0)) & 0xE0) == 0xA0) {
+        QCborValue value = QCborValue::fromCbor(payload);
+        if (!value.isMap()) return {};
+        QCborMap map = value.toMap();
+        QCborValue type = map.value(QStringLiteral("type"));
+        if (type.isInteger()) {
+            qint64 tag = type.toInteger();
+            map.insert(QStringLiteral("type"), tag >= 1 && tag <= kTypeNames.size() ? kTypeNames.at(tag - 1) : QString());
+        }
+        return map.toJsonObject();
+    }
     QJsonDocument jsonDocument = QJsonDocument::fromJson(payload);
-    if (!jsonDocument.isObject()) return;
-    QJsonObject obj = jsonDocument.object();
+    if (!jsonDocument.isObject()) return {};
+    return jsonDocument.object();
+}
+
+void TcpClient::processFrame(const QByteArray& payload) {
+    QJsonObject obj = decodePayload(payload);
+    if (obj.isEmpty()) return;
     QString type = obj.value("type").toString();
 
-    if (type == "message" || type == "private") {
+    if (type == "hello_result") {
+        useCbor_ = obj.value("encoding").toString() == "cbor";
+    } else if (type == "message" || type == "private") {
         QString from = obj.value("from").toString();
         QString text = obj.value("text").toString();
         qint64 ts = obj.value("ts").toVariant().toLongLong();
@@ -97,6 +210,16 @@ void TcpClient::processFrame(const QByteArray& payload) {
         // Only show one message: when receiving an echo from server, don'messageType add again if it's sent by self
         if (from != gCurrentUser && model) model->addMessage(from, text, dt);
         emit messageReceived(from, text, dt.toMSecsSinceEpoch());
+    } else if (type == "history_result") {
+        // one page of history, oldest first; shown the same way as live messages
+        for (const QJsonValue& v : obj.value("messages").toArray()) {
+            QJsonObject m = v.toObject();
+            QString from = m.value("from").toString();
+            QString text = m.value("text").toString();
+            QDateTime dt = QDateTime::fromMSecsSinceEpoch(m.value("ts").toVariant().toLongLong());
+            if (from != gCurrentUser && model) model->addMessage(from, text, dt);
+            emit messageReceived(from, text, dt.toMSecsSinceEpoch());
+        }
     } else if (type == "login_result" || type == "register_result") {
         bool ok = obj.value("ok").toBool();
         QString reason = obj.value("reason").toString();
@@ -113,12 +236,45 @@ void TcpClient::processFrame(const QByteArray& payload) {
             else emit registerFailed(reason);
             // 不再向model添加register_result消息
         }
+    } else if (type == "join_result" || type == "leave_result") {
+        if (obj.value("ok").toBool()) {
+            if (type == "join_result") emit roomJoined(obj.value("room").toString());
+            else emit roomLeft(obj.value("room").toString());
+        }
+    } else if (type == "room_list") {
+        QStringList rooms;
+        for (const QJsonValue& v : obj.value("rooms").toArray()) rooms << v.toObject().value("name").toString();
+        QStringList joined;
+        for (const QJsonValue& v : obj.value("joined").toArray()) joined << v.toString();
+        emit roomsUpdated(rooms, joined);
+    } else if (type == "frames_dropped") {
+        // the server shed messages while we were not reading; presence resyncs itself via the version gap
+        emit framesDropped(obj.value("count").toInt());
     } else if (type == "pong") {
         // Ignore
+    } else if (type == "user_joined" || type == "user_left") {
+        qint64 version = obj.value("version").toVariant().toLongLong();
+        if (version <= presenceVersion_) return; // already covered by a newer snapshot
+        if (version != presenceVersion_ + 1) {
+            // missed a delta: resync from a fresh snapshot
+            QJsonObject req;
+            req["type"] = "list_users";
+            sendJson(req);
+            return;
+        }
+        presenceVersion_ = version;
+        for (const QJsonValue& v : obj.value("usernames").toArray()) {
+            QString name = v.toString();
+            if (type == "user_left") onlineUsers_.removeAll(name);
+            else if (!onlineUsers_.contains(name)) onlineUsers_ << name;
+        }
+        emit onlineUsersUpdated(onlineUsers_);
     } else if (obj.contains("users") && obj.value("users").isArray()) {
         QJsonArray userArray = obj.value("users").toArray();
         QStringList usernamesList;
         for (const QJsonValue& v : userArray) usernamesList << v.toString();
+        onlineUsers_ = usernamesList;
+        presenceVersion_ = obj.value("version").toVariant().toLongLong();
         emit onlineUsersUpdated(usernamesList);
     }
 }
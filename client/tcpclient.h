@@ -4,6 +4,7 @@
 #include <QTimer>
 #include <QJsonObject>
 #include <QStringList>
+#include <memory>
 
 class MessageModel;
 
@@ -11,6 +12,7 @@ class TcpClient : public QObject {
     Q_OBJECT
 public:
     explicit TcpClient(QObject* parent = nullptr);
+    ~TcpClient() override;
     Q_INVOKABLE void connectToHost(const QString& host, quint16 port);
     Q_INVOKABLE void disconnectFromHost();
     Q_INVOKABLE void sendJson(const QJsonObject& obj);
@@ -29,6 +31,14 @@ signals:
 
     void onlineUsersUpdated(const QStringList& users);
 
+    // Room membership: replies to join/leave/list_rooms frames
+    void roomJoined(const QString& room);
+    void roomLeft(const QString& room);
+    void roomsUpdated(const QStringList& rooms, const QStringList& joined);
+
+    // The server dropped `count` frames because this client fell behind
+    void framesDropped(int count);
+
     // Emitted when a message frame is received (also model is updated)
     void messageReceived(const QString& from, const QString& text, qint64 ts);
 
@@ -42,8 +52,15 @@ private slots:
 
 private:
     void processFrame(const QByteArray& framePayload);
+    QByteArray encodePayload(const QJsonObject& obj) const;
+    QJsonObject decodePayload(const QByteArray& payload) const;
     QTcpSocket socket_;
     QByteArray receiveBuffer_;
     MessageModel* model = nullptr;
     QTimer heartbeatTimer_;
+    QStringList onlineUsers_;  // kept current by user_list snapshots and user_joined/user_left deltas
+    qint64 presenceVersion_ = 0;
+    bool useCbor_ = false; // set once the server accepts the CBOR encoding in hello_result
+    struct Inflater;
+    std::unique_ptr<Inflater> inflater_; // created by the first compressed frame of a connection
 };
@@ -0,0 +1,42 @@
+// wire_tables.hpp
+#pragma once
+#include <cstddef>
+
+// Protocol tables the server and the Qt client must agree on byte for byte.
+// Both targets include this header, so there is a single copy to change.
+namespace wire {
+
+// Message type tags used in CBOR payloads. Append only: the position is the
+// wire tag (index + 1).
+inline constexpr const char* kTypeNames[] = {
+    "register", "login", "logout", "message", "private", "history", "heartbeat", "list_users",
+    "register_result", "login_result", "pong", "user_list", "error", "hello", "hello_result",
+    "join", "leave", "list_rooms", "join_result", "leave_result", "room_list",
+    "user_joined", "user_left", "frames_dropped", "stats", "stats_result", "history_result",
+    "search", "search_result",
+};
+inline constexpr std::size_t kTypeCount = sizeof(kTypeNames) / sizeof(kTypeNames[0]);
+
+// Preset dictionary of the per-connection deflate streams: frames the server
+// sends most, keys sorted the way nlohmann::json writes them. deflate prefers
+// the end of the dictionary (shorter distances), so the commonest frames come
+// last. Changing it breaks compression with clients built against the old one.
+inline constexpr char kDictionary[] =
+    // CBOR map keys: text-string header byte + name
+    "\x62" "ok" "\x66" "reason" "\x65" "error" "\x65" "count" "\x65" "rooms" "\x66" "joined"
+    "\x65" "users" "\x69" "usernames" "\x67" "version" "\x68" "encoding"
+    "\x64" "from" "\x62" "to" "\x64" "text" "\x62" "ts" "\x64" "room" "\x64" "type"
+    // JSON frames
+    "{\"error\":\"not_logged_in\",\"type\":\"error\"}"
+    "{\"ok\":true,\"room\":\"\",\"type\":\"join_result\"}"
+    "{\"ok\":true,\"type\":\"login_result\"}"
+    "{\"type\":\"pong\"}"
+    "{\"type\":\"user_list\",\"users\":[\"\"],\"version\":1}"
+    "{\"type\":\"user_left\",\"usernames\":[\"\"],\"version\":1}"
+    "{\"type\":\"user_joined\",\"usernames\":[\"\"],\"version\":1}"
+    "{\"from\":\"\",\"text\":\"\",\"to\":\"\",\"ts\":17,\"type\":\"private\"}"
+    "{\"from\":\"\",\"room\":\"lobby\",\"text\":\"\",\"to\":\"\",\"ts\":17,\"type\":\"message\"}"
+    "{\"from\":\"\",\"room\":\"lobby\",\"text\":\"\",\"ts\":17,\"type\":\"message\"}";
+inline constexpr std::size_t kDictionarySize = sizeof(kDictionary) - 1;
+
+} // namespace wire
@@ -0,0 +1,70 @@
+// admin_server.cpp
+#include "admin_server.hpp"
+#include "logger.hpp"
+#include <future>
+#include <memory>
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+
+namespace {
+
+constexpr std::size_t kMaxRequestBytes = 8 * 1024;
+
+struct AdminConnection {
+    explicit AdminConnection(tcp::socket s) : socket(std::move(s)), request(kMaxRequestBytes) {}
+    tcp::socket socket;
+    asio::streambuf request;
+    std::string response;
+};
+
+std::string http_response(const char* status, const char* content_type, const std::string& body) {
+    return std::string("HTTP/1.0 ") + status + "\r\nContent-Type: " + content_type +
+        "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+}
+
+} // namespace
+
+AdminServer::AdminServer(asio::io_context& ioc, unsigned short port, std::function<std::string()> render)
+    : acceptor_(ioc, tcp::endpoint(asio::ip::address_v4::loopback(), port)), render_(std::move(render)) {}
+
+void AdminServer::start() {
+    LOG_INFO("Admin endpoint listening", { {"port", acceptor_.local_endpoint().port()} });
+    accept();
+}
+
+void AdminServer::stop_accepting() {
+    std::promise<void> closed;
+    asio::post(acceptor_.get_executor(), [this, &closed]() {
+        boost::system::error_code ignored;
+        acceptor_.close(ignored);
+        closed.set_value();
+    });
+    closed.get_future().wait();
+}
+
+void AdminServer::accept() {
+    acceptor_.async_accept([this](std::error_code ec, tcp::socket socket) {
+        if (ec) {
+            LOG_WARN("Admin accept error", { {"what", ec.message()} });
+            return;
+        }
+        auto conn = std::make_shared<AdminConnection>(std::move(socket));
+        asio::async_read_until(conn->socket, conn->request, "\r\n\r\n", [this, conn](std::error_code read_ec, std::size_t) {
+            if (read_ec) return;
+            std::istream in(&conn->request);
+            std::string method, target;
+            in >> method >> target;
+            if (method == "GET" && (target == "/metrics" || target == "/")) {
+                conn->response = http_response("200 OK", "text/plain; version=0.0.4", render_());
+            } else {
+                conn->response = http_response("404 Not Found", "text/plain", "not found\n");
+            }
+            asio::async_write(conn->socket, asio::buffer(conn->response), [conn](std::error_code, std::size_t) {
+                boost::system::error_code ignored;
+                conn->socket.shutdown(tcp::socket::shutdown_both, ignored);
+            });
+        });
+        accept();
+    });
+}
@@ -0,0 +1,22 @@
+// admin_server.hpp
+#pragma once
+#include <boost/asio.hpp>
+#include <functional>
+#include <string>
+
+// Minimal HTTP endpoint for operators. GET /metrics answers with the
+// Prometheus text exposition produced by `render`; anything else is a 404.
+// Listens on loopback only and serves one request per connection.
+class AdminServer {
+public:
+    AdminServer(boost::asio::io_context& ioc, unsigned short port, std::function<std::string()> render);
+    void start();
+    // close the listening socket; blocks until done, so not from an io thread
+    void stop_accepting();
+
+private:
+    void accept();
+
+    boost::asio::ip::tcp::acceptor acceptor_;
+    std::function<std::string()> render_;
+};
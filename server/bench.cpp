@@ -0,0 +1,328 @@
+// bench.cpp
+//
+// chat_server_bench: microbenchmarks for the server's hot paths (Google Benchmark).
+//
+// Sessions here are real Session objects over loopback socket pairs driven by
+// polling one io_context on the benchmark thread, so dispatch and fan-out run
+// the production code, write syscalls included. Logging is set to warn except
+// in the Logger benchmarks, so they don't measure log formatting.
+//
+// For numbers that compare across commits use a Release build, pin the
+// process (taskset) and run with --benchmark_repetitions=5.
+#include <benchmark/benchmark.h>
+#include <boost/asio.hpp>
+#include <nlohmann/json.hpp>
+#include <array>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+#include "protocol.hpp"
+#include "wire_codec.hpp"
+#include "message_store.hpp"
+#include "logger.hpp"
+#include "server.hpp"
+#include "session.hpp"
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+using json = nlohmann::json;
+
+namespace {
+
+std::string bench_log_path() {
+    return (std::filesystem::temp_directory_path() / "chat_server_bench" / "bench.log").string();
+}
+
+ServerConfig bench_config() {
+    ServerConfig config;
+    config.port = 0;              // the Server's own acceptor is never used
+    config.idle_heartbeats = 0;   // no idle timer
+    config.pbkdf2_iterations = 1000;
+    config.auth_threads = 1;
+    for (auto& limit : config.session_rate) limit.per_second = 0; // measure dispatch, not rejections
+    for (auto& limit : config.user_rate) limit.per_second = 0;
+    return config;
+}
+
+// A Server on one io_context plus server-side Sessions whose peers discard
+// everything they receive. Nothing runs in the background: poll() runs the
+// write completions and the peers' reads on the calling thread.
+class Harness {
+public:
+    Harness() : work_(asio::make_work_guard(ioc_)),
+                server_(std::make_unique<Server>(std::vector<asio::io_context*>{ &ioc_ }, bench_config())),
+                acceptor_(ioc_, tcp::endpoint(asio::ip::address_v4::loopback(), 0)) {}
+
+    ~Harness() {
+        sessions_.clear();
+        server_.reset();
+        peers_.clear();
+    }
+
+    Server& server() { return *server_; }
+
+    std::shared_ptr<Session> connect() {
+        auto peer = std::make_unique<Peer>(ioc_);
+        peer->socket.connect(acceptor_.local_endpoint());
+        auto sess = std::make_shared<Session>(acceptor_.accept(), *server_, 0);
+        drain(*peer);
+        peers_.push_back(std::move(peer));
+        sessions_.push_back(sess);
+        return sess;
+    }
+
+    // logs the session in through the real login handler (the password check runs on the auth pool)
+    void login(Session& sess, const std::string& user) {
+        server_->user_store().register_user(user, "bench");
+        feed(sess, { {"type", "login"}, {"username", user}, {"password", "bench"} });
+        while (sess.username().empty()) ioc_.run_one();
+        poll();
+    }
+
+    static void feed(Session& sess, const json& j) {
+        const std::string payload = j.dump();
+        sess.handle_frame(reinterpret_cast<const uint8_t*>(payload.data()), payload.size());
+    }
+
+    void poll() { ioc_.poll(); }
+
+private:
+    struct Peer {
+        explicit Peer(asio::io_context& ioc) : socket(ioc) {}
+        tcp::socket socket;
+        std::array<char, 64 * 1024> buffer;
+    };
+
+    void drain(Peer& peer) {
+        peer.socket.async_read_some(asio::buffer(peer.buffer), [this, &peer](const boost::system::error_code& ec, std::size_t) {
+            if (!ec) drain(peer);
+        });
+    }
+
+    asio::io_context ioc_{ 1 };
+    asio::executor_work_guard<asio::io_context::executor_type> work_;
+    std::unique_ptr<Server> server_;
+    tcp::acceptor acceptor_;
+    std::vector<std::unique_ptr<Peer>> peers_;
+    std::vector<std::shared_ptr<Session>> sessions_;
+};
+
+ChatMsg sample_message(std::size_t i) {
+    ChatMsg m;
+    m.from = "user" + std::to_string(i % 100);
+    if (i % 5 == 0) m.to = "user" + std::to_string((i * 7 + 3) % 100); // a fifth are private
+    else m.room = "room" + std::to_string(i % 10);
+    m.text = "benchmark message number " + std::to_string(i);
+    m.ts = 1700000000000ull + i;
+    return m;
+}
+
+std::vector<ChatMsg> sample_messages() {
+    std::vector<ChatMsg> msgs;
+    for (std::size_t i = 0; i < 1024; ++i) msgs.push_back(sample_message(i));
+    return msgs;
+}
+
+} // namespace
+
+// ---- framing ----
+
+static void BM_MakeFrame(benchmark::State& state) {
+    const std::string payload(static_cast<std::size_t>(state.range(0)), 'x');
+    for (auto _ : state) {
+        auto frame = make_frame(payload);
+        benchmark::DoNotOptimize(frame.data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_MakeFrame)->Arg(64)->Arg(1024)->Arg(16 * 1024);
+
+static void BM_MakeSharedFrame(benchmark::State& state) {
+    const std::string payload(static_cast<std::size_t>(state.range(0)), 'x');
+    for (auto _ : state) {
+        auto frame = make_shared_frame(payload);
+        benchmark::DoNotOptimize(frame.get());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_MakeSharedFrame)->Arg(64)->Arg(1024)->Arg(16 * 1024);
+
+static void BM_ParseLength(benchmark::State& state) {
+    // a receive buffer of back-to-back frames, walked the way the read loop walks it
+    std::vector<uint8_t> buffer;
+    for (std::size_t i = 0; i < 256; ++i) {
+        auto frame = make_frame(std::string(32 + i % 64, 'x'));
+        buffer.insert(buffer.end(), frame.begin(), frame.end());
+    }
+    std::size_t pos = 0;
+    for (auto _ : state) {
+        uint32_t len = parse_length(buffer.data() + pos);
+        benchmark::DoNotOptimize(len);
+        pos += 4 + len;
+        if (pos >= buffer.size()) pos = 0;
+    }
+}
+BENCHMARK(BM_ParseLength);
+
+// ---- decode + dispatch ----
+
+static void BM_DecodePayload(benchmark::State& state) {
+    const auto encoding = static_cast<WireEncoding>(state.range(0));
+    const json j = { {"type", "message"}, {"room", "lobby"}, {"text", std::string(80, 'x')} };
+    SharedFrame frame = encode_frame(j, encoding);
+    for (auto _ : state) {
+        json decoded = decode_payload(frame->data() + 4, frame->size() - 4);
+        benchmark::DoNotOptimize(decoded);
+    }
+    state.SetLabel(wire_encoding_name(encoding));
+}
+BENCHMARK(BM_DecodePayload)->Arg(static_cast<int>(WireEncoding::Json))->Arg(static_cast<int>(WireEncoding::Cbor));
+
+// one inbound frame through Session::handle_frame: decode, process_message and
+// whatever it queues (the reply, or the fan-out to a one-member room)
+static void BM_Dispatch(benchmark::State& state) {
+    Harness h;
+    auto sess = h.connect();
+    h.login(*sess, "alice");
+    json j;
+    switch (state.range(0)) {
+        case 0: j = { {"type", "heartbeat"} }; state.SetLabel("heartbeat"); break;
+        case 1: j = { {"type", "message"}, {"text", std::string(80, 'x')} }; state.SetLabel("message"); break;
+        default: j = { {"type", "private"}, {"to", "alice"}, {"text", std::string(80, 'x')} }; state.SetLabel("private"); break;
+    }
+    const std::string payload = j.dump();
+    std::size_t n = 0;
+    for (auto _ : state) {
+        sess->handle_frame(reinterpret_cast<const uint8_t*>(payload.data()), payload.size());
+        if (++n % 16 == 0) h.poll();
+    }
+    h.poll();
+}
+BENCHMARK(BM_Dispatch)->Arg(0)->Arg(1)->Arg(2);
+
+// ---- message store ----
+
+// every add evicts the oldest message (the trim path)
+static void BM_MessageStoreAddFull(benchmark::State& state) {
+    MessageStore store(static_cast<std::size_t>(state.range(0)));
+    const auto msgs = sample_messages();
+    for (std::size_t i = 0; i < store.capacity(); ++i) store.add_message(msgs[i % msgs.size()]);
+    std::size_t i = 0;
+    for (auto _ : state) benchmark::DoNotOptimize(store.add_message(msgs[i++ % msgs.size()]));
+}
+BENCHMARK(BM_MessageStoreAddFull)->Arg(1000)->Arg(10000)->Arg(100000);
+
+// adds while the ring is still growing, no eviction
+static void BM_MessageStoreAddGrowing(benchmark::State& state) {
+    MessageStore store(1u << 20);
+    const auto msgs = sample_messages();
+    std::size_t i = 0;
+    for (auto _ : state) benchmark::DoNotOptimize(store.add_message(msgs[i++ % msgs.size()]));
+}
+BENCHMARK(BM_MessageStoreAddGrowing)->Iterations(500000);
+
+// newest 50 messages for one user (its private threads + two rooms) at different fill levels
+static void BM_GetMessagesForUser(benchmark::State& state) {
+    const auto fill = static_cast<std::size_t>(state.range(0));
+    MessageStore store(fill);
+    for (std::size_t i = 0; i < fill; ++i) store.add_message(sample_message(i));
+    const std::vector<std::string> rooms = { "room3", "room7" };
+    for (auto _ : state) {
+        auto msgs = store.get_messages_for_user("user7", 50, rooms);
+        benchmark::DoNotOptimize(msgs.data());
+    }
+}
+BENCHMARK(BM_GetMessagesForUser)->Arg(100)->Arg(1000)->Arg(10000)->Arg(100000);
+
+// add_message with the search index kept up to date, at capacity (index insert + evict)
+static void BM_MessageStoreAddIndexed(benchmark::State& state) {
+    MessageStore store(100000, true);
+    const auto msgs = sample_messages();
+    for (std::size_t i = 0; i < store.capacity(); ++i) store.add_message(msgs[i % msgs.size()]);
+    std::size_t i = 0;
+    for (auto _ : state) benchmark::DoNotOptimize(store.add_message(msgs[i++ % msgs.size()]));
+}
+BENCHMARK(BM_MessageStoreAddIndexed);
+
+// one search page over a full indexed store: a rare term pair, a common term, a prefix,
+// and a term whose matches the user mostly cannot see
+static void BM_Search(benchmark::State& state) {
+    const auto fill = static_cast<std::size_t>(state.range(0));
+    MessageStore store(fill, true);
+    for (std::size_t i = 0; i < fill; ++i) store.add_message(sample_message(i));
+    SearchQuery q;
+    q.user = "user7";
+    q.rooms = { "room3", "room7" };
+    switch (state.range(1)) {
+        case 0: q.text = "number 4217"; state.SetLabel("rare"); break;
+        case 1: q.text = "benchmark"; state.SetLabel("common"); break;
+        case 2: q.text = "4217*"; state.SetLabel("prefix"); break;
+        default: q.text = "benchmark"; q.rooms.clear(); state.SetLabel("private only"); break;
+    }
+    for (auto _ : state) {
+        auto page = store.search(q);
+        benchmark::DoNotOptimize(page.messages.data());
+    }
+}
+BENCHMARK(BM_Search)->ArgsProduct({ { 10000, 300000 }, { 0, 1, 2, 3 } })->Unit(benchmark::kMicrosecond);
+
+// ---- logger ----
+
+// one record per iteration from 1..N threads; range(0) = 1 for the async writer
+static void BM_LoggerLog(benchmark::State& state) {
+    const bool async = state.range(0) != 0;
+    if (state.thread_index() == 0) {
+        Logger::instance().init(bench_log_path(), LogLevel::Info);
+        if (async) Logger::instance().enable_async();
+    }
+    const json extra = { {"username", "alice"}, {"room", "lobby"}, {"len", 80} };
+    for (auto _ : state) Logger::instance().log(LogLevel::Info, "Room message", extra);
+    if (state.thread_index() == 0) {
+        Logger::instance().shutdown();
+        Logger::instance().init(bench_log_path(), LogLevel::Warn);
+    }
+    state.SetLabel(async ? "async" : "sync");
+}
+BENCHMARK(BM_LoggerLog)->Arg(0)->Arg(1)->ThreadRange(1, 8)->UseRealTime();
+
+// ---- fan-out ----
+
+// Server::broadcast to N logged-in sessions, including flushing their writes
+static void BM_Broadcast(benchmark::State& state) {
+    Harness h;
+    const auto members = static_cast<std::size_t>(state.range(0));
+    for (std::size_t i = 0; i < members; ++i) h.server().on_login(h.connect(), "user" + std::to_string(i));
+    h.poll();
+    const json j = { {"type", "message"}, {"from", "user0"}, {"room", "lobby"}, {"text", std::string(80, 'x')}, {"ts", 1700000000000ull} };
+    for (auto _ : state) {
+        h.server().broadcast(j);
+        h.poll();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Broadcast)->Arg(1)->Arg(16)->Arg(128)->Arg(512);
+
+// the room path group messages take: Server::broadcast_to_room to N members
+static void BM_BroadcastToRoom(benchmark::State& state) {
+    Harness h;
+    const auto members = static_cast<std::size_t>(state.range(0));
+    for (std::size_t i = 0; i < members; ++i) h.server().join_room("bench", h.connect());
+    const json j = { {"type", "message"}, {"from", "user0"}, {"room", "bench"}, {"text", std::string(80, 'x')}, {"ts", 1700000000000ull} };
+    for (auto _ : state) {
+        h.server().broadcast_to_room("bench", j);
+        h.poll();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_BroadcastToRoom)->Arg(1)->Arg(16)->Arg(128)->Arg(512);
+
+int main(int argc, char** argv) {
+    Logger::instance().init(bench_log_path(), LogLevel::Warn);
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    Logger::instance().shutdown();
+    return 0;
+}
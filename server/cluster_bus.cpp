@@ -0,0 +1,337 @@
+// cluster_bus.cpp
+#include "cluster_bus.hpp"
+#include "protocol.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <future>
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+using json = nlohmann::json;
+
+namespace {
+
+constexpr std::size_t kWriteBatchFrames = 256; // most frames gathered into one write
+constexpr int kRedialMinMs = 200;
+constexpr int kRedialMaxMs = 5000;
+
+// "host:port"; ":port" means loopback
+bool split_address(const std::string& address, std::string& host, std::string& port) {
+    auto colon = address.rfind(':');
+    if (colon == std::string::npos || colon + 1 == address.size()) return false;
+    host = colon == 0 ? "127.0.0.1" : address.substr(0, colon);
+    port = address.substr(colon + 1);
+    return true;
+}
+
+// compares in time independent of where the strings differ
+bool same_secret(const std::string& presented, const std::string& expected) {
+    if (presented.size() != expected.size()) return false;
+    unsigned char diff = 0;
+    for (std::size_t i = 0; i < expected.size(); ++i) diff |= static_cast<unsigned char>(presented[i] ^ expected[i]);
+    return diff == 0;
+}
+
+SharedFrame encode(const json& message) {
+    return make_shared_frame(message.dump());
+}
+
+// one length-prefixed JSON object; handler(error_code, json). The caller keeps
+// socket, header and body alive until the handler runs.
+template <typename Handler>
+void async_read_frame(tcp::socket& socket, std::array<uint8_t, 4>& header, std::vector<uint8_t>& body,
+                      std::size_t max_frame, Handler handler) {
+    asio::async_read(socket, asio::buffer(header), [&socket, &header, &body, max_frame, handler](boost::system::error_code ec, std::size_t) mutable {
+        if (ec) return handler(ec, json());
+        uint32_t len = parse_length(header.data());
+        if (len > max_frame) return handler(make_error_code(asio::error::message_size), json());
+        body.resize(len);
+        asio::async_read(socket, asio::buffer(body), [&body, handler](boost::system::error_code body_ec, std::size_t) mutable {
+            if (body_ec) return handler(body_ec, json());
+            json j = json::parse(body.begin(), body.end(), nullptr, false);
+            if (j.is_discarded() || !j.is_object()) return handler(make_error_code(asio::error::invalid_argument), json());
+            handler(body_ec, std::move(j));
+        });
+    });
+}
+
+} // namespace
+
+struct ClusterBus::Outbound {
+    Outbound(const asio::strand<asio::io_context::executor_type>& strand, std::string peer_address)
+        : address(std::move(peer_address)), socket(strand), resolver(strand), retry_timer(strand) {}
+
+    std::string address, host, port;
+    tcp::socket socket;
+    tcp::resolver resolver;
+    asio::steady_timer retry_timer;
+    std::string node;       // the peer's id, from its node_hello reply
+    bool up = false;        // hello exchanged: published frames are queued
+    bool writing = false;
+    bool is_self = false;   // the address turned out to be this node; never redialed
+    int redial_ms = kRedialMinMs;
+    std::deque<SharedFrame> queue;
+    std::size_t queued_bytes = 0; // queued plus in flight
+    std::array<uint8_t, 4> header;
+    std::vector<uint8_t> body;
+    uint64_t generation = 0; // bumped when the link goes down, so completions of the old socket are ignored
+};
+
+struct ClusterBus::Inbound {
+    explicit Inbound(tcp::socket s) : socket(std::move(s)) {}
+    tcp::socket socket;
+    std::string node; // empty until the dialer's node_hello
+    std::array<uint8_t, 4> header;
+    std::vector<uint8_t> body;
+    SharedFrame reply;
+};
+
+ClusterBus::ClusterBus(asio::io_context& ioc, const ServerConfig& config, Callbacks callbacks)
+    : node_id_(config.node_id.empty() ? asio::ip::host_name() + ":" + std::to_string(config.port) : config.node_id),
+      secret_(config.cluster_secret), queue_limit_(config.cluster_queue_bytes), max_frame_size_(config.max_frame_size),
+      callbacks_(std::move(callbacks)), strand_(asio::make_strand(ioc)),
+      acceptor_(strand_, tcp::endpoint(asio::ip::make_address(config.cluster_bind), config.cluster_port)) {
+    if (secret_.empty() && !acceptor_.local_endpoint().address().is_loopback()) {
+        LOG_WARN("Cluster port is reachable from other hosts but CHAT_CLUSTER_SECRET is not set", { {"bind", config.cluster_bind} });
+    }
+    for (const auto& address : config.cluster_peers) {
+        auto link = std::make_shared<Outbound>(strand_, address);
+        if (!split_address(address, link->host, link->port)) {
+            LOG_WARN("Ignoring malformed cluster peer", { {"peer", address} });
+            continue;
+        }
+        outbound_.push_back(std::move(link));
+    }
+}
+
+ClusterBus::~ClusterBus() = default;
+
+void ClusterBus::start() {
+    LOG_INFO("Cluster bus listening", { {"node", node_id_}, {"address", acceptor_.local_endpoint().address().to_string()},
+        {"port", acceptor_.local_endpoint().port()},
+        {"peers", static_cast<uint64_t>(outbound_.size())} });
+    asio::dispatch(strand_, [this]() {
+        accept();
+        for (auto& link : outbound_) dial(link);
+    });
+}
+
+void ClusterBus::publish(const json& message) {
+    SharedFrame frame = encode(message);
+    asio::post(strand_, [this, frame]() {
+        for (auto& link : outbound_) {
+            if (!link->up) continue;
+            enqueue(*link, frame);
+            flush(link);
+        }
+    });
+}
+
+void ClusterBus::send_to(const std::string& node, const json& message) {
+    SharedFrame frame = encode(message);
+    asio::post(strand_, [this, node, frame]() {
+        for (auto& link : outbound_) {
+            if (!link->up || link->node != node) continue;
+            enqueue(*link, frame);
+            flush(link);
+            return;
+        }
+        Metrics::instance().inc(Counter::ClusterFramesDropped);
+        LOG_DEBUG("No cluster link to node", { {"node", node} });
+    });
+}
+
+// ---- outbound links ----
+
+void ClusterBus::dial(const std::shared_ptr<Outbound>& link) {
+    const uint64_t gen = link->generation;
+    link->resolver.async_resolve(link->host, link->port, [this, link, gen](boost::system::error_code ec, tcp::resolver::results_type results) {
+        if (gen != link->generation) return;
+        if (ec) return link_down(link, ec.message());
+        asio::async_connect(link->socket, results, [this, link, gen](boost::system::error_code connect_ec, const tcp::endpoint&) {
+            if (gen != link->generation) return;
+            if (connect_ec) return link_down(link, connect_ec.message());
+            boost::system::error_code ignored;
+            link->socket.set_option(tcp::no_delay(true), ignored);
+            link->socket.set_option(asio::socket_base::keep_alive(true), ignored);
+            enqueue(*link, encode({ {"type", "node_hello"}, {"node", node_id_}, {"secret", secret_} }));
+            flush(link);
+            read_hello_reply(link);
+        });
+    });
+}
+
+void ClusterBus::read_hello_reply(const std::shared_ptr<Outbound>& link) {
+    const uint64_t gen = link->generation;
+    async_read_frame(link->socket, link->header, link->body, max_frame_size_, [this, link, gen](boost::system::error_code ec, json j) {
+        if (gen != link->generation) return;
+        if (ec) return link_down(link, ec.message());
+        if (j.value("type", "") != "node_hello") return link_down(link, "expected node_hello");
+        if (!same_secret(j.value("secret", ""), secret_)) {
+            Metrics::instance().inc(Counter::ClusterLinksRejected);
+            LOG_WARN("Cluster peer presented the wrong secret", { {"peer", link->address} });
+            return link_down(link, "wrong secret");
+        }
+        link->node = j.value("node", "");
+        if (link->node == node_id_) {
+            link->is_self = true;
+            LOG_INFO("Cluster peer is this node, not dialing it", { {"peer", link->address} });
+            return link_down(link, "self");
+        }
+        link->up = true;
+        link->redial_ms = kRedialMinMs;
+        connected_nodes_.fetch_add(1, std::memory_order_relaxed);
+        LOG_INFO("Cluster link up", { {"peer", link->address}, {"node", link->node} });
+        enqueue(*link, encode(callbacks_.snapshot()));
+        flush(link);
+        watch_outbound(link);
+    });
+}
+
+// the peer never writes after its hello; a read completing is the link closing
+void ClusterBus::watch_outbound(const std::shared_ptr<Outbound>& link) {
+    const uint64_t gen = link->generation;
+    async_read_frame(link->socket, link->header, link->body, max_frame_size_, [this, link, gen](boost::system::error_code ec, json) {
+        if (gen != link->generation) return;
+        if (ec) return link_down(link, ec.message());
+        watch_outbound(link);
+    });
+}
+
+void ClusterBus::link_down(const std::shared_ptr<Outbound>& link, const std::string& why) {
+    ++link->generation;
+    boost::system::error_code ignored;
+    link->socket.close(ignored);
+    if (link->up) {
+        connected_nodes_.fetch_sub(1, std::memory_order_relaxed);
+        LOG_WARN("Cluster link down", { {"peer", link->address}, {"node", link->node}, {"why", why},
+            {"unsent", static_cast<uint64_t>(link->queue.size())} });
+    } else if (!link->is_self) {
+        LOG_DEBUG("Cluster dial failed", { {"peer", link->address}, {"why", why} });
+    }
+    Metrics::instance().inc(Counter::ClusterFramesDropped, link->queue.size());
+    link->up = false;
+    link->writing = false;
+    link->queue.clear();
+    link->queued_bytes = 0;
+    if (!link->is_self) redial(link);
+}
+
+void ClusterBus::redial(const std::shared_ptr<Outbound>& link) {
+    link->retry_timer.expires_after(std::chrono::milliseconds(link->redial_ms));
+    link->redial_ms = std::min(link->redial_ms * 2, kRedialMaxMs);
+    const uint64_t gen = link->generation;
+    link->retry_timer.async_wait([this, link, gen](const boost::system::error_code& ec) {
+        if (ec || gen != link->generation) return;
+        dial(link);
+    });
+}
+
+void ClusterBus::enqueue(Outbound& link, const SharedFrame& frame) {
+    if (link.queued_bytes + frame->size() > queue_limit_) {
+        Metrics::instance().inc(Counter::ClusterFramesDropped);
+        return;
+    }
+    link.queued_bytes += frame->size();
+    link.queue.push_back(frame);
+}
+
+// one gather write of everything queued (up to kWriteBatchFrames); frames
+// published meanwhile wait for the next one
+void ClusterBus::flush(const std::shared_ptr<Outbound>& link) {
+    if (link->writing || link->queue.empty()) return;
+    auto batch = std::make_shared<std::vector<SharedFrame>>();
+    std::vector<asio::const_buffer> buffers;
+    std::size_t batch_bytes = 0;
+    while (!link->queue.empty() && batch->size() < kWriteBatchFrames) {
+        batch->push_back(std::move(link->queue.front()));
+        link->queue.pop_front();
+        buffers.push_back(asio::buffer(*batch->back()));
+        batch_bytes += batch->back()->size();
+    }
+    link->writing = true;
+    const uint64_t gen = link->generation;
+    asio::async_write(link->socket, buffers, [this, link, gen, batch, batch_bytes](boost::system::error_code ec, std::size_t) {
+        if (gen != link->generation) return;
+        link->writing = false;
+        link->queued_bytes -= batch_bytes;
+        if (ec) return link_down(link, ec.message());
+        Metrics::instance().inc(Counter::ClusterFramesSent, batch->size());
+        flush(link);
+    });
+}
+
+// ---- inbound links ----
+
+void ClusterBus::stop_accepting() {
+    std::promise<void> closed;
+    asio::post(strand_, [this, &closed]() {
+        boost::system::error_code ignored;
+        acceptor_.close(ignored);
+        closed.set_value();
+    });
+    closed.get_future().wait();
+}
+
+void ClusterBus::accept() {
+    acceptor_.async_accept(strand_, [this](boost::system::error_code ec, tcp::socket socket) {
+        if (ec) {
+            LOG_WARN("Cluster accept error", { {"what", ec.message()} });
+            if (ec == asio::error::operation_aborted) return;
+        } else {
+            boost::system::error_code ignored;
+            socket.set_option(tcp::no_delay(true), ignored);
+            socket.set_option(asio::socket_base::keep_alive(true), ignored);
+            read_inbound(std::make_shared<Inbound>(std::move(socket)));
+        }
+        accept();
+    });
+}
+
+void ClusterBus::read_inbound(const std::shared_ptr<Inbound>& link) {
+    async_read_frame(link->socket, link->header, link->body, max_frame_size_, [this, link](boost::system::error_code ec, json j) {
+        if (ec) return inbound_closed(link);
+        if (link->node.empty()) {
+            // the dialer introduces itself first; answer with our id
+            std::string node = j.value("type", "") == "node_hello" ? j.value("node", "") : "";
+            if (node.empty()) {
+                LOG_WARN("Cluster link without node_hello");
+                return inbound_closed(link);
+            }
+            if (!same_secret(j.value("secret", ""), secret_)) {
+                boost::system::error_code ignored;
+                Metrics::instance().inc(Counter::ClusterLinksRejected);
+                LOG_WARN("Cluster link with the wrong secret", { {"node", node}, {"remote", link->socket.remote_endpoint(ignored).address().to_string()} });
+                return inbound_closed(link);
+            }
+            link->node = node;
+            link->reply = encode({ {"type", "node_hello"}, {"node", node_id_}, {"secret", secret_} });
+            asio::async_write(link->socket, asio::buffer(*link->reply), [link](boost::system::error_code, std::size_t) {});
+            if (node != node_id_ && inbound_links_[node]++ == 0) LOG_INFO("Cluster node connected", { {"node", node} });
+        } else {
+            Metrics::instance().inc(Counter::ClusterFramesReceived);
+            try {
+                callbacks_.on_message(link->node, j);
+            } catch (const std::exception& ex) {
+                LOG_ERROR("Cluster message handling failed", { {"node", link->node}, {"what", ex.what()} });
+            }
+        }
+        read_inbound(link);
+    });
+}
+
+void ClusterBus::inbound_closed(const std::shared_ptr<Inbound>& link) {
+    boost::system::error_code ignored;
+    link->socket.close(ignored);
+    if (link->node.empty() || link->node == node_id_) return;
+    auto it = inbound_links_.find(link->node);
+    // a redialed link may already be up; only the last one going away means the node left
+    if (it != inbound_links_.end() && --it->second == 0) {
+        inbound_links_.erase(it);
+        LOG_WARN("Cluster node disconnected", { {"node", link->node} });
+        callbacks_.on_node_down(link->node);
+    }
+}
@@ -0,0 +1,73 @@
+// cluster_bus.hpp
+#pragma once
+#include <boost/asio.hpp>
+#include <atomic>
+#include <nlohmann/json.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "server_config.hpp"
+
+// TCP links between the nodes of a cluster.
+//
+// Every node dials each address in cluster_peers and only writes on the
+// links it dialed; the links it accepts are only read. A dialed link starts
+// with a node_hello exchange in which both sides present cluster_secret (a
+// link with another secret, or a peer that turns out to be this node, is
+// dropped), then carries the snapshot callback's frame followed by whatever
+// is published. Frames use the client framing (u32 length + JSON). Messages
+// queue per link and each write sends everything queued since the last one,
+// so a busy link forwards in batches. Messages for a node whose link is down
+// are dropped; the link redials with backoff and resends the snapshot.
+//
+// All link state lives on one strand; publish and send_to may be called from
+// any thread. Callbacks run on that strand.
+class ClusterBus {
+public:
+    struct Callbacks {
+        std::function<nlohmann::json()> snapshot;   // first frame on every new outbound link
+        std::function<void(const std::string& node, const nlohmann::json& message)> on_message;
+        std::function<void(const std::string& node)> on_node_down; // the last inbound link from node closed
+    };
+
+    ClusterBus(boost::asio::io_context& ioc, const ServerConfig& config, Callbacks callbacks);
+    ~ClusterBus();
+
+    void start();
+    // close the listening socket (links stay up); blocks until done, so not from an io thread
+    void stop_accepting();
+    // to every connected node
+    void publish(const nlohmann::json& message);
+    void send_to(const std::string& node, const nlohmann::json& message);
+
+    const std::string& node_id() const { return node_id_; }
+    std::size_t connected_nodes() const { return connected_nodes_.load(std::memory_order_relaxed); }
+
+private:
+    struct Outbound;
+    struct Inbound;
+
+    void accept();
+    void dial(const std::shared_ptr<Outbound>& link);
+    void redial(const std::shared_ptr<Outbound>& link);
+    void read_hello_reply(const std::shared_ptr<Outbound>& link);
+    void watch_outbound(const std::shared_ptr<Outbound>& link);
+    void link_down(const std::shared_ptr<Outbound>& link, const std::string& why);
+    void enqueue(Outbound& link, const std::shared_ptr<const std::vector<uint8_t>>& frame);
+    void flush(const std::shared_ptr<Outbound>& link);
+    void read_inbound(const std::shared_ptr<Inbound>& link);
+    void inbound_closed(const std::shared_ptr<Inbound>& link);
+
+    const std::string node_id_;
+    const std::string secret_;
+    const std::size_t queue_limit_;
+    const std::size_t max_frame_size_;
+    Callbacks callbacks_;
+    boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    std::vector<std::shared_ptr<Outbound>> outbound_;
+    std::unordered_map<std::string, int> inbound_links_; // node -> open inbound links
+    std::atomic<std::size_t> connected_nodes_{0};        // outbound links past the hello
+};
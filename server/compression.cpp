@@ -0,0 +1,76 @@
+// compression.cpp
+#include "compression.hpp"
+#include "wire_tables.hpp"
+#ifdef CHAT_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+const std::string& compression_dictionary() {
+    static const std::string dictionary(wire::kDictionary, wire::kDictionarySize);
+    return dictionary;
+}
+
+#ifdef CHAT_HAVE_ZLIB
+
+bool compression_supported() { return true; }
+
+struct FrameDeflater::Stream {
+    z_stream zs{};
+    bool ok = false;
+    std::vector<uint8_t> out; // scratch, reused across frames
+};
+
+FrameDeflater::FrameDeflater(int level, int window_bits) : stream_(std::make_unique<Stream>()) {
+    z_stream& zs = stream_->zs;
+    if (deflateInit2(&zs, level, Z_DEFLATED, -window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) return;
+    const std::string& dict = compression_dictionary();
+    stream_->ok = deflateSetDictionary(&zs, reinterpret_cast<const Bytef*>(dict.data()), static_cast<uInt>(dict.size())) == Z_OK;
+}
+
+FrameDeflater::~FrameDeflater() {
+    deflateEnd(&stream_->zs);
+}
+
+SharedFrame FrameDeflater::compress(const std::vector<uint8_t>& frame) {
+    Stream& s = *stream_;
+    if (!s.ok || frame.size() < 4) return nullptr;
+    z_stream& zs = s.zs;
+    zs.next_in = const_cast<Bytef*>(frame.data() + 4);
+    zs.avail_in = static_cast<uInt>(frame.size() - 4);
+    s.out.resize(4 + deflateBound(&zs, zs.avail_in) + 16);
+    std::size_t produced = 4;
+    do {
+        if (produced == s.out.size()) s.out.resize(s.out.size() * 2);
+        zs.next_out = s.out.data() + produced;
+        zs.avail_out = static_cast<uInt>(s.out.size() - produced);
+        if (deflate(&zs, Z_SYNC_FLUSH) == Z_STREAM_ERROR) {
+            s.ok = false; // the stream is out of step with the peer from here on
+            return nullptr;
+        }
+        produced = s.out.size() - zs.avail_out;
+    } while (zs.avail_out == 0);
+
+    // a sync flush always ends in an empty stored block, 00 00 FF FF; the receiver appends it back.
+    // An empty payload right after a flush produces no output at all: send an empty block.
+    if (produced > 4) produced -= 4;
+    const uint32_t len = static_cast<uint32_t>(produced - 4) | kCompressedFrameFlag;
+    s.out[0] = static_cast<uint8_t>(len >> 24);
+    s.out[1] = static_cast<uint8_t>(len >> 16);
+    s.out[2] = static_cast<uint8_t>(len >> 8);
+    s.out[3] = static_cast<uint8_t>(len);
+    std::vector<uint8_t> out = take_frame_buffer(produced);
+    out.assign(s.out.begin(), s.out.begin() + static_cast<std::ptrdiff_t>(produced));
+    return share_frame(std::move(out));
+}
+
+#else
+
+bool compression_supported() { return false; }
+
+struct FrameDeflater::Stream {};
+
+FrameDeflater::FrameDeflater(int, int) {}
+FrameDeflater::~FrameDeflater() = default;
+SharedFrame FrameDeflater::compress(const std::vector<uint8_t>&) { return nullptr; }
+
+#endif
@@ -0,0 +1,39 @@
+// compression.hpp
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "protocol.hpp"
+
+// Preset dictionary both ends load into their deflate streams: the keys, type
+// names and frame skeletons of this protocol, so even the first frames of a
+// connection compress well. It lives in common/wire_tables.hpp, which the Qt
+// client includes too; changing it is a protocol change.
+const std::string& compression_dictionary();
+
+// false when the server was built without zlib; "hello" then never offers compression
+bool compression_supported();
+
+// One connection's server->client deflate stream (raw deflate, preset
+// dictionary). Each frame is compressed as a continuation of the stream and
+// ended with a sync flush, so it decodes on arrival yet can refer back to
+// everything sent before it. The 00 00 FF FF sync marker is left off the wire
+// and restored by the receiver.
+//
+// Not thread-safe: a session only uses it from its write path.
+class FrameDeflater {
+public:
+    FrameDeflater(int level, int window_bits);
+    ~FrameDeflater();
+    FrameDeflater(const FrameDeflater&) = delete;
+    FrameDeflater& operator=(const FrameDeflater&) = delete;
+
+    // frame: length prefix + payload. Returns the compressed frame (flagged
+    // length prefix + deflate block), or null if the stream is unusable.
+    SharedFrame compress(const std::vector<uint8_t>& frame);
+
+private:
+    struct Stream;
+    std::unique_ptr<Stream> stream_;
+};
@@ -0,0 +1,252 @@
+// handoff.cpp
+#include "handoff.hpp"
+#include "logger.hpp"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using json = nlohmann::json;
+
+#ifdef __linux__
+
+namespace {
+
+constexpr std::size_t kChunkBytes = 64 * 1024;   // buffered session bytes per packet
+constexpr std::size_t kMaxPacketFds = 253;       // SCM_MAX_FD
+constexpr int kReceiveTimeoutSec = 30;           // the old process is stuck if it takes longer
+
+bool make_address(const std::string& path, sockaddr_un& addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+    std::memcpy(addr.sun_path, path.data(), path.size());
+    return true;
+}
+
+bool send_packet(int fd, const void* data, std::size_t len, const int* fds = nullptr, std::size_t fd_count = 0) {
+    iovec iov{ const_cast<void*>(data), len };
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    std::vector<char> control;
+    if (fd_count > 0) {
+        control.resize(CMSG_SPACE(sizeof(int) * fd_count));
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+        std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+    }
+    ssize_t n;
+    do { n = ::sendmsg(fd, &msg, MSG_NOSIGNAL); } while (n < 0 && errno == EINTR);
+    return n == static_cast<ssize_t>(len);
+}
+
+bool send_json(int fd, const json& j, const int* fds = nullptr, std::size_t fd_count = 0) {
+    const std::string text = j.dump();
+    return send_packet(fd, text.data(), text.size(), fds, fd_count);
+}
+
+// one packet into buf, its descriptors appended to fds; false on EOF or error
+bool recv_packet(int fd, std::vector<uint8_t>& buf, std::vector<int>& fds) {
+    buf.resize(kChunkBytes + 4096);
+    iovec iov{ buf.data(), buf.size() };
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * kMaxPacketFds));
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    ssize_t n;
+    do { n = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC); } while (n < 0 && errno == EINTR);
+    if (n <= 0) return false;
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        const std::size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const std::size_t first = fds.size();
+        fds.resize(first + count);
+        std::memcpy(fds.data() + first, CMSG_DATA(cmsg), sizeof(int) * count);
+    }
+    buf.resize(static_cast<std::size_t>(n));
+    return !(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC));
+}
+
+bool send_bytes(int fd, const std::vector<uint8_t>& bytes) {
+    for (std::size_t off = 0; off < bytes.size(); off += kChunkBytes) {
+        if (!send_packet(fd, bytes.data() + off, std::min(kChunkBytes, bytes.size() - off))) return false;
+    }
+    return true;
+}
+
+bool recv_bytes(int fd, std::size_t len, std::vector<uint8_t>& out, std::vector<uint8_t>& buf, std::vector<int>& stray_fds) {
+    out.clear();
+    out.reserve(len);
+    while (out.size() < len) {
+        if (!recv_packet(fd, buf, stray_fds)) return false;
+        out.insert(out.end(), buf.begin(), buf.end());
+    }
+    return out.size() == len;
+}
+
+} // namespace
+
+bool request_handoff(const std::string& path, HandoffState& state) {
+    sockaddr_un addr;
+    if (!make_address(path, addr)) return false;
+    int fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        // no socket file, or a stale one nobody listens on: a cold start
+        ::close(fd);
+        return false;
+    }
+    timeval timeout{ kReceiveTimeoutSec, 0 };
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    LOG_INFO("Requesting handoff", { {"path", path} });
+    if (!send_json(fd, { {"type", "handoff"} })) {
+        ::close(fd);
+        return false;
+    }
+
+    std::vector<uint8_t> buf;
+    bool complete = false;
+    for (;;) {
+        std::vector<int> fds;
+        if (!recv_packet(fd, buf, fds)) {
+            for (int f : fds) ::close(f);
+            break;
+        }
+        json header = json::parse(buf.begin(), buf.end(), nullptr, false);
+        const std::string type = header.is_object() ? header.value("type", "") : "";
+        if (type == "listeners") {
+            state.listeners.insert(state.listeners.end(), fds.begin(), fds.end());
+            state.presence_version = header.value("presence_version", uint64_t{0});
+        } else if (type == "session" && fds.size() == 1) {
+            HandoffSession s;
+            s.fd = fds.front();
+            s.username = header.value("username", "");
+            parse_wire_encoding(header.value("encoding", "json"), s.encoding);
+            s.paged_history = header.value("paged_history", false);
+            s.rooms = header.value("rooms", std::vector<std::string>{});
+            std::vector<int> stray;
+            const bool ok = recv_bytes(fd, header.value("unread", std::size_t{0}), s.unread, buf, stray) &&
+                            recv_bytes(fd, header.value("unsent", std::size_t{0}), s.unsent, buf, stray);
+            for (int f : stray) ::close(f);
+            if (!ok) {
+                // the stream is cut short mid-session: its bytes are incomplete
+                ::close(s.fd);
+                break;
+            }
+            state.sessions.push_back(std::move(s));
+        } else if (type == "done") {
+            complete = true;
+            break;
+        } else {
+            for (int f : fds) ::close(f);
+        }
+    }
+    ::close(fd);
+    if (!complete) LOG_WARN("Handoff cut short", { {"sessions", static_cast<uint64_t>(state.sessions.size())} });
+    LOG_INFO("Handoff received", { {"listeners", static_cast<uint64_t>(state.listeners.size())},
+        {"sessions", static_cast<uint64_t>(state.sessions.size())}, {"complete", complete} });
+    return complete || !state.listeners.empty() || !state.sessions.empty();
+}
+
+HandoffServer::HandoffServer(std::string path, Callbacks callbacks)
+    : path_(std::move(path)), callbacks_(std::move(callbacks)) {
+    sockaddr_un addr;
+    if (!make_address(path_, addr)) throw std::runtime_error("bad handoff path: " + path_);
+    listen_fd_ = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) throw std::runtime_error("handoff socket: " + std::string(std::strerror(errno)));
+    // a previous process either handed off to us or is gone; its socket file is stale either way
+    ::unlink(path_.c_str());
+    if (::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(listen_fd_, 1) != 0) {
+        const std::string why = std::strerror(errno);
+        ::close(listen_fd_);
+        throw std::runtime_error("handoff bind " + path_ + ": " + why);
+    }
+}
+
+HandoffServer::~HandoffServer() {
+    stopping_ = true;
+    ::shutdown(listen_fd_, SHUT_RDWR); // wakes the blocked accept()
+    if (thread_.joinable()) thread_.join();
+    ::close(listen_fd_);
+    if (!handed_off_) ::unlink(path_.c_str());
+}
+
+void HandoffServer::start() {
+    LOG_INFO("Handoff socket listening", { {"path", path_} });
+    thread_ = std::thread([this]() { run(); });
+}
+
+void HandoffServer::run() {
+    while (!stopping_) {
+        int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (!stopping_) LOG_ERROR("Handoff accept failed", { {"what", std::strerror(errno)} });
+            return;
+        }
+        const bool served = serve(fd);
+        ::close(fd);
+        if (served) {
+            handed_off_ = true;
+            callbacks_.done();
+            return;
+        }
+    }
+}
+
+// false when the peer did not ask for a handoff (nothing was collected)
+bool HandoffServer::serve(int fd) {
+    std::vector<uint8_t> buf;
+    std::vector<int> fds;
+    if (!recv_packet(fd, buf, fds)) return false;
+    for (int f : fds) ::close(f);
+    json request = json::parse(buf.begin(), buf.end(), nullptr, false);
+    if (!request.is_object() || request.value("type", "") != "handoff") return false;
+
+    LOG_INFO("Handoff requested");
+    HandoffState state = callbacks_.collect();
+    bool ok = send_json(fd, { {"type", "listeners"}, {"presence_version", state.presence_version} },
+                        state.listeners.data(), std::min(state.listeners.size(), kMaxPacketFds));
+    std::size_t sent = 0;
+    for (const auto& s : state.sessions) {
+        if (!ok) break;
+        json header = { {"type", "session"}, {"username", s.username}, {"encoding", wire_encoding_name(s.encoding)},
+                        {"paged_history", s.paged_history}, {"rooms", s.rooms},
+                        {"unread", s.unread.size()}, {"unsent", s.unsent.size()} };
+        ok = send_json(fd, header, &s.fd, 1) && send_bytes(fd, s.unread) && send_bytes(fd, s.unsent);
+        if (ok) ++sent;
+    }
+    if (ok) ok = send_json(fd, { {"type", "done"} });
+    if (ok) LOG_INFO("Handoff sent", { {"listeners", static_cast<uint64_t>(state.listeners.size())}, {"sessions", static_cast<uint64_t>(sent)} });
+    else LOG_ERROR("Handoff interrupted", { {"what", std::strerror(errno)}, {"sessions_sent", static_cast<uint64_t>(sent)} });
+    // this process has quiesced either way; what was not sent is closed when it exits
+    return true;
+}
+
+#else // hot restart needs SCM_RIGHTS
+
+bool request_handoff(const std::string&, HandoffState&) { return false; }
+
+HandoffServer::HandoffServer(std::string path, Callbacks callbacks) : path_(std::move(path)), callbacks_(std::move(callbacks)) {
+    throw std::runtime_error("hot restart is only supported on Linux");
+}
+HandoffServer::~HandoffServer() = default;
+void HandoffServer::start() {}
+void HandoffServer::run() {}
+bool HandoffServer::serve(int) { return false; }
+
+#endif
@@ -0,0 +1,64 @@
+// handoff.hpp
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "wire_codec.hpp"
+
+// A client connection passed to the next process: the socket plus what the
+// session needs to carry on as if nothing happened.
+struct HandoffSession {
+    int fd = -1;
+    std::string username; // empty when not logged in
+    WireEncoding encoding = WireEncoding::Json;
+    bool paged_history = false;
+    std::vector<std::string> rooms;
+    std::vector<uint8_t> unread; // received bytes not parsed yet (a partial frame)
+    std::vector<uint8_t> unsent; // frames queued for the client, already encoded, never compressed
+};
+
+struct HandoffState {
+    std::vector<int> listeners; // client port acceptors, in Server order
+    std::vector<HandoffSession> sessions;
+    uint64_t presence_version = 0;
+};
+
+// Zero-downtime restart (Linux only). A server started with a handoff path
+// listens there on a Unix seqpacket socket. A new process started with the
+// same path connects to it before binding anything (request_handoff) and is
+// sent the listening sockets and every live client socket with SCM_RIGHTS,
+// one packet per socket, followed by the session's buffered bytes in
+// chunks. The old process stops reading and writing before it collects the
+// state, so no frame is split between the two, and exits once it is sent.
+//
+// New process side: false when nothing listens on path, so the caller
+// starts cold. A handoff cut short still returns what arrived.
+bool request_handoff(const std::string& path, HandoffState& state);
+
+// Old process side: serves one handoff on its own thread.
+class HandoffServer {
+public:
+    struct Callbacks {
+        std::function<HandoffState()> collect; // quiesce and export; runs on the handoff thread
+        std::function<void()> done;            // everything has been sent
+    };
+
+    // binds path (replacing a stale socket file); throws when it cannot
+    HandoffServer(std::string path, Callbacks callbacks);
+    ~HandoffServer();
+    void start();
+
+private:
+    void run();
+    bool serve(int fd);
+
+    const std::string path_;
+    Callbacks callbacks_;
+    int listen_fd_ = -1;
+    std::atomic<bool> stopping_{false};
+    bool handed_off_ = false; // the next process owns path_ now
+    std::thread thread_;
+};
@@ -0,0 +1,609 @@
+// loadgen.cpp
+//
+// chat_loadgen: headless load generator for chat_server.
+//
+// Logs in many simulated users over the regular length-prefixed JSON protocol,
+// drives an open-loop mix of group / private / history traffic at a target
+// rate and prints one JSON report: send-to-receive latency percentiles,
+// throughput and errors. Every sent message carries "lg:<sender>:<seq>:<ns>:"
+// in its text so receivers can time it against the same steady clock.
+#include "protocol.hpp"
+#include "metrics.hpp"
+#include <boost/asio.hpp>
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+using json = nlohmann::json;
+using steady = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+    std::string host = "127.0.0.1";
+    unsigned short port = 9000;
+    std::size_t users = 500;
+    std::size_t threads = 0;            // 0 = min(4, hardware threads)
+    double rate = 100;                  // messages per second, all users together
+    double duration_s = 10;
+    double drain_s = 2;                 // keep receiving this long after the last send
+    std::size_t connect_rate = 500;     // new connections per second
+    double login_timeout_s = 60;
+    unsigned mix_group = 80, mix_private = 15, mix_history = 5;
+    std::size_t rooms = 0;              // 0 = everybody talks in the default room
+    std::size_t msg_bytes = 64;
+    std::size_t history_n = 20;
+    std::size_t heartbeat_ms = 5000;
+    std::string user_prefix = "lg";
+    std::string password = "loadgen";
+    double max_p99_ms = 0;              // exit 2 when group/private p99 exceeds this; 0 = off
+};
+
+constexpr std::size_t kMaxClientBacklog = 1024; // skip sends to a client whose own writes are stuck
+
+struct LatencyHistogram {
+    std::vector<uint64_t> buckets = std::vector<uint64_t>(Metrics::kHistogramBuckets);
+    uint64_t count = 0, sum = 0, max = 0;
+
+    void record(uint64_t nanos) {
+        ++buckets[Metrics::bucket_for(nanos)];
+        ++count;
+        sum += nanos;
+        max = std::max(max, nanos);
+    }
+    void merge(const LatencyHistogram& o) {
+        for (std::size_t b = 0; b < buckets.size(); ++b) buckets[b] += o.buckets[b];
+        count += o.count;
+        sum += o.sum;
+        max = std::max(max, o.max);
+    }
+    double quantile_ms(double q) const {
+        if (count == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count - 1)) + 1, seen = 0;
+        for (std::size_t b = 0; b < buckets.size(); ++b) {
+            seen += buckets[b];
+            if (seen >= rank) return std::min(Metrics::bucket_upper(b), max) / 1e6;
+        }
+        return max / 1e6;
+    }
+    json to_json() const {
+        return {
+            {"count", count},
+            {"mean", count ? static_cast<double>(sum) / count / 1e6 : 0.0},
+            {"p50", quantile_ms(0.5)},
+            {"p90", quantile_ms(0.9)},
+            {"p99", quantile_ms(0.99)},
+            {"p999", quantile_ms(0.999)},
+            {"max", max / 1e6},
+        };
+    }
+};
+
+// everything one worker thread records; merged by main once the threads are done
+struct Stats {
+    LatencyHistogram group, priv, history_rtt, login;
+    uint64_t sent_group = 0, sent_private = 0, sent_history = 0;
+    uint64_t recv_group = 0, recv_private = 0, recv_history = 0;
+    uint64_t send_skipped = 0, frames_dropped = 0;
+    uint64_t connect_errors = 0, login_failures = 0, disconnects = 0, busy_retries = 0;
+    std::map<std::string, uint64_t> error_frames;
+
+    void merge(const Stats& o) {
+        group.merge(o.group); priv.merge(o.priv); history_rtt.merge(o.history_rtt); login.merge(o.login);
+        sent_group += o.sent_group; sent_private += o.sent_private; sent_history += o.sent_history;
+        recv_group += o.recv_group; recv_private += o.recv_private; recv_history += o.recv_history;
+        send_skipped += o.send_skipped; frames_dropped += o.frames_dropped;
+        connect_errors += o.connect_errors; login_failures += o.login_failures;
+        disconnects += o.disconnects; busy_retries += o.busy_retries;
+        for (auto& e : o.error_frames) error_frames[e.first] += e.second;
+    }
+};
+
+// run phases, shared by all workers
+enum class Phase { Login, Measure, Drain, Done };
+std::atomic<Phase> g_phase{ Phase::Login };
+std::atomic<std::size_t> g_settled{ 0 }; // users that logged in or gave up
+std::atomic<std::size_t> g_ready{ 0 };
+
+uint64_t now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(steady::now().time_since_epoch()).count());
+}
+
+class Worker;
+
+// One simulated user. Lives entirely on its worker's io_context thread.
+class Client : public std::enable_shared_from_this<Client> {
+public:
+    Client(Worker& worker, asio::io_context& ioc, std::size_t index)
+        : worker_(worker), socket_(ioc), retry_timer_(ioc), index_(index) {}
+
+    void start();
+    bool ready() const { return state_ == State::Ready; }
+    std::size_t index() const { return index_; }
+    std::size_t backlog() const { return write_queue_.size(); }
+    uint64_t last_send_ns() const { return last_send_ns_; }
+
+    void send_group(uint64_t seq);
+    void send_private(std::size_t to, uint64_t seq);
+    void send_history();
+    void send_heartbeat();
+
+private:
+    enum class State { Connecting, Registering, LoggingIn, Joining, Ready, Failed, Closed };
+
+    void send(const json& j);
+    void write_next();
+    void read_header();
+    void read_body(uint32_t len);
+    void handle(const json& j);
+    bool scan_marked(const std::vector<uint8_t>& payload);
+    void on_message(const std::string& text, bool is_private, bool is_replay);
+    void login();
+    void became_ready();
+    void fail(bool counted_as_disconnect);
+    std::string marker(uint64_t seq) const;
+
+    Worker& worker_;
+    tcp::socket socket_;
+    asio::steady_timer retry_timer_;
+    std::size_t index_;
+    State state_ = State::Connecting;
+    uint64_t started_ns_ = 0;
+    uint64_t last_send_ns_ = 0;
+    uint8_t header_[4];
+    std::vector<uint8_t> body_;
+    std::deque<std::string> write_queue_;
+    // pongs answer heartbeats in order; a history request is followed by a
+    // heartbeat so its pong marks the end of the replay
+    std::deque<std::pair<bool, uint64_t>> pending_pongs_;
+    // live privates from one sender arrive in sequence order, history replays don't
+    std::unordered_map<std::size_t, uint64_t> private_seen_;
+};
+
+class Worker {
+public:
+    Worker(const Options& opts, std::size_t id, std::size_t worker_count)
+        : opts_(opts), worker_count_(worker_count), tick_(ioc_), rng_(static_cast<unsigned>(id * 7919 + 1)) {}
+
+    const Options& opts() const { return opts_; }
+    Stats& stats() { return stats_; }
+    std::mt19937& rng() { return rng_; }
+    std::string username(std::size_t index) const { return opts_.user_prefix + std::to_string(index); }
+    std::string room(std::size_t index) const {
+        return opts_.rooms ? opts_.user_prefix + "-room-" + std::to_string(index % opts_.rooms) : std::string();
+    }
+
+    void add_user(std::size_t index) { clients_.push_back(std::make_shared<Client>(*this, ioc_, index)); }
+    void run() {
+        schedule_tick();
+        ioc_.run();
+    }
+    void stop() { asio::post(ioc_, [this] { ioc_.stop(); }); }
+
+private:
+    void schedule_tick() {
+        tick_.expires_after(std::chrono::milliseconds(5));
+        tick_.async_wait([this](const boost::system::error_code& ec) {
+            if (ec) return;
+            on_tick();
+            schedule_tick();
+        });
+    }
+
+    void on_tick() {
+        const uint64_t now = now_ns();
+        const double dt = last_tick_ns_ ? (now - last_tick_ns_) / 1e9 : 0;
+        last_tick_ns_ = now;
+
+        // ramp up connections at this worker's share of connect_rate
+        if (started_ < clients_.size()) {
+            connect_budget_ += dt * static_cast<double>(opts_.connect_rate) / static_cast<double>(worker_count_);
+            if (started_ == 0) connect_budget_ = std::max(connect_budget_, 1.0);
+            while (connect_budget_ >= 1 && started_ < clients_.size()) {
+                clients_[started_++]->start();
+                connect_budget_ -= 1;
+            }
+        }
+
+        if (now - last_heartbeat_scan_ns_ >= opts_.heartbeat_ms * 1000000ull / 2) {
+            last_heartbeat_scan_ns_ = now;
+            for (auto& c : clients_)
+                if (c->ready() && now - c->last_send_ns() >= opts_.heartbeat_ms * 1000000ull) c->send_heartbeat();
+        }
+
+        if (g_phase.load() != Phase::Measure) return;
+        send_budget_ += dt * opts_.rate / static_cast<double>(worker_count_);
+        const unsigned total_mix = opts_.mix_group + opts_.mix_private + opts_.mix_history;
+        std::uniform_int_distribution<unsigned> pick_kind(0, total_mix - 1);
+        std::uniform_int_distribution<std::size_t> pick_user(0, opts_.users - 1);
+        for (std::size_t tries = 0; send_budget_ >= 1 && tries < clients_.size(); ++tries) {
+            Client& c = *clients_[next_sender_++ % clients_.size()];
+            if (!c.ready()) continue;
+            send_budget_ -= 1;
+            if (c.backlog() >= kMaxClientBacklog) { ++stats_.send_skipped; continue; }
+            unsigned kind = pick_kind(rng_);
+            if (kind < opts_.mix_group) c.send_group(++seq_);
+            else if (kind < opts_.mix_group + opts_.mix_private) c.send_private(pick_user(rng_), ++seq_);
+            else c.send_history();
+        }
+        // nobody ready to send: don't let the budget pile up into a burst
+        if (send_budget_ > opts_.rate) send_budget_ = opts_.rate;
+    }
+
+    const Options& opts_;
+    std::size_t worker_count_;
+    asio::io_context ioc_{ 1 };
+    asio::steady_timer tick_;
+    std::mt19937 rng_;
+    std::vector<std::shared_ptr<Client>> clients_;
+    std::size_t started_ = 0;
+    std::size_t next_sender_ = 0;
+    uint64_t seq_ = 0;
+    uint64_t last_tick_ns_ = 0;
+    uint64_t last_heartbeat_scan_ns_ = 0;
+    double connect_budget_ = 0;
+    double send_budget_ = 0;
+    Stats stats_;
+};
+
+void Client::start() {
+    started_ns_ = now_ns();
+    tcp::resolver resolver(socket_.get_executor());
+    boost::system::error_code ec;
+    auto endpoints = resolver.resolve(worker_.opts().host, std::to_string(worker_.opts().port), ec);
+    if (ec) {
+        ++worker_.stats().connect_errors;
+        fail(false);
+        return;
+    }
+    asio::async_connect(socket_, endpoints, [self = shared_from_this()](const boost::system::error_code& cec, const tcp::endpoint&) {
+        if (cec) {
+            ++self->worker_.stats().connect_errors;
+            self->fail(false);
+            return;
+        }
+        self->socket_.set_option(tcp::no_delay(true));
+        self->state_ = State::Registering;
+        self->read_header();
+        self->send({ {"type", "register"}, {"username", self->worker_.username(self->index_)}, {"password", self->worker_.opts().password} });
+    });
+}
+
+void Client::login() {
+    state_ = State::LoggingIn;
+    send({ {"type", "login"}, {"username", worker_.username(index_)}, {"password", worker_.opts().password} });
+}
+
+void Client::became_ready() {
+    state_ = State::Ready;
+    worker_.stats().login.record(now_ns() - started_ns_);
+    ++g_ready;
+    ++g_settled;
+}
+
+void Client::fail(bool counted_as_disconnect) {
+    if (state_ == State::Failed || state_ == State::Closed) return;
+    const bool was_ready = state_ == State::Ready;
+    state_ = was_ready ? State::Closed : State::Failed;
+    if (counted_as_disconnect && g_phase.load() != Phase::Done) ++worker_.stats().disconnects;
+    if (was_ready) --g_ready;
+    else ++g_settled;
+    boost::system::error_code ignored;
+    socket_.close(ignored);
+    retry_timer_.cancel();
+}
+
+std::string Client::marker(uint64_t seq) const {
+    std::string text = "lg:" + std::to_string(index_) + ":" + std::to_string(seq) + ":" + std::to_string(now_ns()) + ":";
+    if (text.size() < worker_.opts().msg_bytes) text.append(worker_.opts().msg_bytes - text.size(), 'x');
+    return text;
+}
+
+void Client::send_group(uint64_t seq) {
+    json j = { {"type", "message"}, {"text", marker(seq)} };
+    if (worker_.opts().rooms) j["room"] = worker_.room(index_);
+    send(j);
+    ++worker_.stats().sent_group;
+}
+
+void Client::send_private(std::size_t to, uint64_t seq) {
+    send({ {"type", "private"}, {"to", worker_.username(to)}, {"text", marker(seq)} });
+    ++worker_.stats().sent_private;
+}
+
+void Client::send_history() {
+    send({ {"type", "history"}, {"n", worker_.opts().history_n} });
+    send({ {"type", "heartbeat"} });
+    pending_pongs_.emplace_back(true, now_ns());
+    ++worker_.stats().sent_history;
+}
+
+void Client::send_heartbeat() {
+    send({ {"type", "heartbeat"} });
+    pending_pongs_.emplace_back(false, 0);
+}
+
+void Client::send(const json& j) {
+    const auto frame = make_frame(j.dump());
+    write_queue_.emplace_back(frame.begin(), frame.end());
+    last_send_ns_ = now_ns();
+    if (write_queue_.size() == 1) write_next();
+}
+
+void Client::write_next() {
+    asio::async_write(socket_, asio::buffer(write_queue_.front()), [self = shared_from_this()](const boost::system::error_code& ec, std::size_t) {
+        if (ec) {
+            self->fail(true);
+            return;
+        }
+        self->write_queue_.pop_front();
+        if (!self->write_queue_.empty()) self->write_next();
+    });
+}
+
+void Client::read_header() {
+    asio::async_read(socket_, asio::buffer(header_), [self = shared_from_this()](const boost::system::error_code& ec, std::size_t) {
+        if (ec) {
+            self->fail(true);
+            return;
+        }
+        self->read_body(parse_length(self->header_));
+    });
+}
+
+void Client::read_body(uint32_t len) {
+    body_.resize(len);
+    asio::async_read(socket_, asio::buffer(body_), [self = shared_from_this()](const boost::system::error_code& ec, std::size_t) {
+        if (ec) {
+            self->fail(true);
+            return;
+        }
+        if (!self->scan_marked(self->body_)) {
+            json j = json::parse(self->body_.begin(), self->body_.end(), nullptr, false);
+            if (j.is_object()) self->handle(j);
+        }
+        if (self->state_ != State::Failed && self->state_ != State::Closed) self->read_header();
+    });
+}
+
+void Client::handle(const json& j) {
+    const std::string type = j.value("type", "");
+    Stats& st = worker_.stats();
+    if (type == "message" || type == "private") {
+        on_message(j.value("text", ""), type == "private", type == "message" && j.contains("to"));
+    } else if (type == "pong") {
+        if (pending_pongs_.empty()) return;
+        auto p = pending_pongs_.front();
+        pending_pongs_.pop_front();
+        if (p.first && g_phase.load() != Phase::Login) st.history_rtt.record(now_ns() - p.second);
+    } else if (type == "register_result") {
+        if (j.value("reason", "") == "busy") {
+            ++st.busy_retries;
+            retry_timer_.expires_after(std::chrono::milliseconds(50 + worker_.rng()() % 200));
+            retry_timer_.async_wait([self = shared_from_this()](const boost::system::error_code& ec) {
+                if (!ec) self->send({ {"type", "register"}, {"username", self->worker_.username(self->index_)}, {"password", self->worker_.opts().password} });
+            });
+            return;
+        }
+        login(); // a failed register usually means the account already exists
+    } else if (type == "login_result") {
+        if (j.value("ok", false)) {
+            if (worker_.opts().rooms) {
+                state_ = State::Joining;
+                send({ {"type", "join"}, {"room", worker_.room(index_)} });
+            } else {
+                became_ready();
+            }
+        } else if (j.value("reason", "") == "busy") {
+            ++st.busy_retries;
+            retry_timer_.expires_after(std::chrono::milliseconds(50 + worker_.rng()() % 200));
+            retry_timer_.async_wait([self = shared_from_this()](const boost::system::error_code& ec) {
+                if (!ec) self->login();
+            });
+        } else {
+            ++st.login_failures;
+            fail(false);
+        }
+    } else if (type == "join_result") {
+        if (state_ != State::Joining) return;
+        if (j.value("ok", false)) {
+            became_ready();
+        } else {
+            ++st.login_failures;
+            fail(false);
+        }
+    } else if (type == "frames_dropped") {
+        st.frames_dropped += j.value("count", 0ull);
+    } else if (type == "error") {
+        ++st.error_frames[j.value("error", "unknown")];
+    }
+}
+
+// Fast path for the bulk of the traffic: pick loadgen-marked message/private
+// frames out of the raw payload without building a json tree, so the generator
+// spends its CPU on sending rather than parsing. Anything else gets parsed.
+bool Client::scan_marked(const std::vector<uint8_t>& payload) {
+    static const std::string kText = "\"text\":\"lg:";
+    const std::string body(payload.begin(), payload.end());
+    const std::size_t text_pos = body.find(kText);
+    if (text_pos == std::string::npos) return false;
+    bool is_private;
+    if (body.find("\"type\":\"message\"") != std::string::npos) is_private = false;
+    else if (body.find("\"type\":\"private\"") != std::string::npos) is_private = true;
+    else return false;
+    // history replays carry "to" on group messages too
+    const bool is_replay = !is_private && body.find("\"to\":") != std::string::npos;
+    on_message(body.substr(text_pos + kText.size() - 3), is_private, is_replay);
+    return true;
+}
+
+void Client::on_message(const std::string& text, bool is_private, bool is_replay) {
+    Stats& st = worker_.stats();
+    if (is_replay) {
+        ++st.recv_history;
+        return;
+    }
+    if (text.compare(0, 3, "lg:") != 0) return;
+    char* end = nullptr;
+    const std::size_t sender = std::strtoull(text.c_str() + 3, &end, 10);
+    const uint64_t seq = std::strtoull(end + 1, &end, 10);
+    const uint64_t sent_ns = std::strtoull(end + 1, &end, 10);
+    if (is_private) {
+        if (sender == index_) return; // the sender's own copy
+        uint64_t& seen = private_seen_[sender];
+        if (seq <= seen) {
+            ++st.recv_history;
+            return;
+        }
+        seen = seq;
+    }
+    const Phase phase = g_phase.load();
+    if (phase != Phase::Measure && phase != Phase::Drain) return;
+    const uint64_t latency = now_ns() - sent_ns;
+    if (is_private) {
+        ++st.recv_private;
+        st.priv.record(latency);
+    } else {
+        ++st.recv_group;
+        st.group.record(latency);
+    }
+}
+
+bool parse_mix(const std::string& s, Options& o) {
+    unsigned g = 0, p = 0, h = 0;
+    if (std::sscanf(s.c_str(), "%u:%u:%u", &g, &p, &h) != 3 || g + p + h == 0) return false;
+    o.mix_group = g;
+    o.mix_private = p;
+    o.mix_history = h;
+    return true;
+}
+
+void usage() {
+    std::cerr <<
+        "usage: chat_loadgen [--host H] [--port P] [--users N] [--threads T] [--rate MSG_PER_S]\n"
+        "                    [--duration S] [--drain S] [--connect-rate CONN_PER_S] [--login-timeout S]\n"
+        "                    [--mix GROUP:PRIVATE:HISTORY] [--rooms K] [--msg-bytes B] [--history-n N]\n"
+        "                    [--heartbeat-ms MS] [--user-prefix P] [--password PW] [--max-p99-ms MS]\n";
+}
+
+bool parse_args(int argc, char** argv, Options& o) {
+    for (int i = 1; i < argc; ++i) {
+        std::string key = argv[i];
+        if (key == "--help" || key == "-h") return false;
+        if (i + 1 >= argc) return false;
+        std::string v = argv[++i];
+        try {
+            if (key == "--host") o.host = v;
+            else if (key == "--port") o.port = static_cast<unsigned short>(std::stoul(v));
+            else if (key == "--users") o.users = std::stoul(v);
+            else if (key == "--threads") o.threads = std::stoul(v);
+            else if (key == "--rate") o.rate = std::stod(v);
+            else if (key == "--duration") o.duration_s = std::stod(v);
+            else if (key == "--drain") o.drain_s = std::stod(v);
+            else if (key == "--connect-rate") o.connect_rate = std::max<std::size_t>(std::stoul(v), 1);
+            else if (key == "--login-timeout") o.login_timeout_s = std::stod(v);
+            else if (key == "--mix") { if (!parse_mix(v, o)) return false; }
+            else if (key == "--rooms") o.rooms = std::stoul(v);
+            else if (key == "--msg-bytes") o.msg_bytes = std::stoul(v);
+            else if (key == "--history-n") o.history_n = std::stoul(v);
+            else if (key == "--heartbeat-ms") o.heartbeat_ms = std::max<std::size_t>(std::stoul(v), 100);
+            else if (key == "--user-prefix") o.user_prefix = v;
+            else if (key == "--password") o.password = v;
+            else if (key == "--max-p99-ms") o.max_p99_ms = std::stod(v);
+            else return false;
+        } catch (...) {
+            return false;
+        }
+    }
+    return o.users > 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opts;
+    if (!parse_args(argc, argv, opts)) {
+        usage();
+        return 1;
+    }
+    if (opts.threads == 0) opts.threads = std::min<std::size_t>(4, std::max(1u, std::thread::hardware_concurrency()));
+    opts.threads = std::min(opts.threads, opts.users);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (std::size_t i = 0; i < opts.threads; ++i) workers.push_back(std::make_unique<Worker>(opts, i, opts.threads));
+    for (std::size_t u = 0; u < opts.users; ++u) workers[u % opts.threads]->add_user(u);
+
+    std::vector<std::thread> threads;
+    for (auto& w : workers) threads.emplace_back([&w] { w->run(); });
+
+    // login phase: wait until every user logged in or gave up
+    const auto login_start = steady::now();
+    while (g_settled.load() < opts.users &&
+           steady::now() - login_start < std::chrono::duration<double>(opts.login_timeout_s))
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    const double login_s = std::chrono::duration<double>(steady::now() - login_start).count();
+    const std::size_t logged_in = g_ready.load();
+
+    const auto measure_start = steady::now();
+    if (logged_in > 0) {
+        g_phase = Phase::Measure;
+        std::this_thread::sleep_for(std::chrono::duration<double>(opts.duration_s));
+    }
+    const double measured_s = std::chrono::duration<double>(steady::now() - measure_start).count();
+    g_phase = Phase::Drain;
+    if (logged_in > 0) std::this_thread::sleep_for(std::chrono::duration<double>(opts.drain_s));
+    g_phase = Phase::Done;
+
+    for (auto& w : workers) w->stop();
+    for (auto& t : threads) t.join();
+
+    Stats total;
+    for (auto& w : workers) total.merge(w->stats());
+
+    const uint64_t sent = total.sent_group + total.sent_private + total.sent_history;
+    const uint64_t delivered = total.recv_group + total.recv_private;
+    json report = {
+        {"config", {
+            {"host", opts.host}, {"port", opts.port}, {"users", opts.users}, {"threads", opts.threads},
+            {"rate", opts.rate}, {"duration_s", opts.duration_s}, {"rooms", opts.rooms}, {"msg_bytes", opts.msg_bytes},
+            {"mix", { {"group", opts.mix_group}, {"private", opts.mix_private}, {"history", opts.mix_history} }},
+        }},
+        {"connections", {
+            {"target", opts.users}, {"logged_in", logged_in}, {"login_phase_s", login_s},
+            {"connect_errors", total.connect_errors}, {"login_failures", total.login_failures},
+            {"busy_retries", total.busy_retries}, {"disconnects", total.disconnects},
+        }},
+        {"sent", { {"group", total.sent_group}, {"private", total.sent_private}, {"history", total.sent_history}, {"skipped_backlog", total.send_skipped} }},
+        {"received", { {"group", total.recv_group}, {"private", total.recv_private}, {"history_frames", total.recv_history} }},
+        {"throughput", {
+            {"measured_s", measured_s},
+            {"sent_per_s", measured_s > 0 ? sent / measured_s : 0.0},
+            {"delivered_per_s", measured_s > 0 ? delivered / measured_s : 0.0},
+        }},
+        {"latency_ms", {
+            {"group", total.group.to_json()}, {"private", total.priv.to_json()},
+            {"history_rtt", total.history_rtt.to_json()}, {"login", total.login.to_json()},
+        }},
+        {"errors", { {"frames_dropped", total.frames_dropped}, {"error_frames", total.error_frames} }},
+    };
+    std::cout << report.dump(2) << std::endl;
+
+    if (logged_in == 0) return 1;
+    if (opts.max_p99_ms > 0 &&
+        (total.group.quantile_ms(0.99) > opts.max_p99_ms || total.priv.quantile_ms(0.99) > opts.max_p99_ms))
+        return 2;
+    return 0;
+}
@@ -5,6 +5,7 @@
 #include <sstream>
 #include <cstdlib>
 #include <cctype>
+#include <cstdio>
 
 namespace fs = std::filesystem;
 
@@ -15,14 +16,17 @@ Logger& Logger::instance() {
 
 Logger::Logger()
     : log_file_path_("logs/server.log"),
+      service_name_("chat_server"),
       log_level_(LogLevel::Info),
       max_log_file_size_(10ull * 1024 * 1024),
+      current_file_size_(0),
       log_rotate_count_(5),
       is_initialized_(false) {
     // leave stream closed until init or first write
 }
 
 Logger::~Logger() {
+    shutdown();
     std::lock_guard<std::mutex> lock(file_mutex_);
     if (log_file_stream_.is_open()) log_file_stream_.close();
 }
@@ -33,6 +37,9 @@ void Logger::init(const std::string& log_file_path, LogLevel log_level, std::uin
     log_level_ = log_level;
     max_log_file_size_ = max_size_bytes;
     log_rotate_count_ = rotate_count;
+    // resolved once here instead of per record
+    const char* svc = std::getenv("SERVICE_NAME");
+    service_name_ = svc ? svc : "chat_server";
 
     fs::path dir = fs::path(log_file_path_).parent_path();
     if (!dir.empty() && !fs::exists(dir)) {
@@ -42,10 +49,84 @@ void Logger::init(const std::string& log_file_path, LogLevel log_level, std::uin
     }
 
     if (log_file_stream_.is_open()) log_file_stream_.close();
-    log_file_stream_.open(log_file_path_, std::ios::app);
+    open_locked();
+    is_initialized_ = true;
+}
+
+void Logger::init_from_env_locked() {
+    // auto init from env if not explicitly inited
+    const char* env_file = std::getenv("LOG_FILE");
+    if (env_file) log_file_path_ = env_file;
+    const char* env_level = std::getenv("LOG_LEVEL");
+    if (env_level) {
+        std::string level_string(env_level);
+        for (auto &c: level_string) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        if (level_string == "debug") log_level_ = LogLevel::Debug;
+        else if (level_string == "info") log_level_ = LogLevel::Info;
+        else if (level_string == "warn") log_level_ = LogLevel::Warn;
+        else if (level_string == "error") log_level_ = LogLevel::Err;
+    }
+    const char* env_max = std::getenv("LOG_MAX_SIZE");
+    if (env_max) {
+        try { max_log_file_size_ = static_cast<std::uint64_t>(std::stoull(env_max)); } catch(...) {}
+    }
+    const char* env_rot = std::getenv("LOG_ROTATE_COUNT");
+    if (env_rot) {
+        try { log_rotate_count_ = std::stoi(env_rot); } catch(...) {}
+    }
+    const char* svc = std::getenv("SERVICE_NAME");
+    service_name_ = svc ? svc : "chat_server";
+
+    fs::path dir = fs::path(log_file_path_).parent_path();
+    std::error_code ec;
+    if (!dir.empty() && !fs::exists(dir, ec)) fs::create_directories(dir, ec);
+    open_locked();
     is_initialized_ = true;
 }
 
+void Logger::open_locked() {
+    log_file_stream_.open(log_file_path_, std::ios::app);
+    // one stat when the file is opened; afterwards we count our own writes
+    std::error_code ec;
+    auto sz = fs::file_size(log_file_path_, ec);
+    current_file_size_ = ec ? 0 : static_cast<std::uint64_t>(sz);
+}
+
+void Logger::enable_async(std::size_t queue_capacity, LogOverflowPolicy policy) {
+    if (async_running_) return;
+    record_queue_ = std::make_unique<BoundedMpscQueue<std::string>>(queue_capacity);
+    overflow_policy_ = policy;
+    stop_writer_ = false;
+    writer_stopped_ = false;
+    writer_thread_ = std::thread([this]() { writer_loop(); });
+    async_running_ = true;
+}
+
+void Logger::shutdown() {
+    if (!async_running_.exchange(false)) return;
+    {
+        std::lock_guard<std::mutex> lk(wake_mutex_);
+        stop_writer_ = true;
+    }
+    wake_cv_.notify_one();
+    space_cv_.notify_all();
+    if (writer_thread_.joinable()) writer_thread_.join();
+
+    // The writer is gone. From here whoever holds file_mutex_ acts as the
+    // consumer: this thread for what is queued now, and a producer that
+    // pushed after the writer's last look for its own record (see enqueue).
+    writer_stopped_.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::lock_guard<std::mutex> lock(file_mutex_);
+    drain_locked();
+}
+
+void Logger::drain_locked() {
+    std::string record;
+    while (record_queue_->try_pop(record)) write_locked(record + "\n");
+    if (log_file_stream_.is_open()) log_file_stream_.flush();
+}
+
 std::string Logger::level_to_string(LogLevel log_level) const {
     switch (log_level) {
         case LogLevel::Debug: return "debug";
@@ -74,21 +155,19 @@ std::string Logger::timestamp_iso() const {
     return time_stream.str();
 }
 
-void Logger::rotate_if_needed_locked() {
+void Logger::rotate_if_needed_locked(std::size_t incoming_bytes) {
     if (!log_file_stream_.is_open()) {
-        log_file_stream_.open(log_file_path_, std::ios::app);
+        open_locked();
         if (!log_file_stream_.is_open()) return;
     }
 
-    std::error_code ec;
-    auto sz = fs::file_size(log_file_path_, ec);
-    if (ec) return;
-    if (sz < max_log_file_size_) return;
+    if (current_file_size_ + incoming_bytes <= max_log_file_size_ || current_file_size_ == 0) return;
 
     // close current
     log_file_stream_.close();
 
     // rotate: move file -> file.1, file.1 -> file.2, ... keep log_rotate_count_
+    std::error_code ec;
     for (int i = log_rotate_count_ - 1; i >= 0; --i) {
         fs::path src = (i == 0) ? fs::path(log_file_path_) : fs::path(log_file_path_ + "." + std::to_string(i));
         fs::path dst = fs::path(log_file_path_ + "." + std::to_string(i + 1));
@@ -100,57 +179,129 @@ void Logger::rotate_if_needed_locked() {
     }
 
     // reopen new file
-    log_file_stream_.open(log_file_path_, std::ios::app);
+    open_locked();
+}
+
+void Logger::write_locked(const std::string& data) {
+    rotate_if_needed_locked(data.size());
+    if (log_file_stream_.is_open()) {
+        log_file_stream_ << data;
+        current_file_size_ += data.size();
+    } else {
+        std::fputs(data.c_str(), stderr);
+    }
 }
 
 void Logger::log(LogLevel log_level, const std::string& log_message, const nlohmann::json& extra) {
     // quick log_level check (no full lock)
-    if (static_cast<int>(log_level) < static_cast<int>(log_level_)) return;
+    if (static_cast<int>(log_level) < static_cast<int>(log_level_.load(std::memory_order_relaxed))) return;
 
-    std::lock_guard<std::mutex> lock(file_mutex_);
     if (!is_initialized_) {
-        // auto init from env if not explicitly inited
-        const char* env_file = std::getenv("LOG_FILE");
-        std::string file = env_file ? env_file : log_file_path_;
-        const char* env_level = std::getenv("LOG_LEVEL");
-        LogLevel lvl_env = log_level_;
-        if (env_level) {
-            std::string level_string(env_level);
-            for (auto &c: level_string) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
-            if (level_string == "debug") lvl_env = LogLevel::Debug;
-            else if (level_string == "info") lvl_env = LogLevel::Info;
-            else if (level_string == "warn") lvl_env = LogLevel::Warn;
-            else if (level_string == "error") lvl_env = LogLevel::Err;
-        }
-        const char* env_max = std::getenv("LOG_MAX_SIZE");
-        std::uint64_t maxsz = max_log_file_size_;
-        if (env_max) {
-            try { maxsz = static_cast<std::uint64_t>(std::stoull(env_max)); } catch(...) {}
-        }
-        const char* env_rot = std::getenv("LOG_ROTATE_COUNT");
-        int rc = log_rotate_count_;
-        if (env_rot) {
-            try { rc = std::stoi(env_rot); } catch(...) {}
-        }
-        init(file, lvl_env, maxsz, rc);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        if (!is_initialized_) init_from_env_locked();
+        if (static_cast<int>(log_level) < static_cast<int>(log_level_.load())) return;
     }
 
-    rotate_if_needed_locked();
-
+    // format outside any lock
     nlohmann::json log_entry;
     log_entry["timestamp"] = timestamp_iso();
     log_entry["log_level"] = level_to_string(log_level);
-    const char* svc = std::getenv("SERVICE_NAME");
-    log_entry["service"] = svc ? svc : "chat_server";
+    log_entry["service"] = service_name_;
     log_entry["thread_id"] = std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
     log_entry["log_message"] = log_message;
     if (!extra.is_null()) log_entry["extra"] = extra;
+    std::string record = log_entry.dump();
 
-    if (log_file_stream_.is_open()) {
-        log_file_stream_ << log_entry.dump() << "\n";
-        log_file_stream_.flush();
-    } else {
-        std::fprintf(stderr, "%level_string\n", log_entry.dump().c_str());
+    if (async_running_.load(std::memory_order_acquire)) {
+        enqueue(std::move(record));
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(file_mutex_);
+    record += '\n';
+    write_locked(record);
+    if (log_file_stream_.is_open()) log_file_stream_.flush();
+}
+
+void Logger::enqueue(std::string&& record) {
+    while (!record_queue_->try_push(std::move(record))) {
+        if (overflow_policy_ == LogOverflowPolicy::Drop) {
+            dropped_records_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (!async_running_.load(std::memory_order_acquire)) {
+            // shutting down: fall back to a direct write
+            std::lock_guard<std::mutex> lock(file_mutex_);
+            write_locked(record + "\n");
+            return;
+        }
+        // wait for the writer to free a slot; the timeout covers a notify
+        // that raced with this thread starting to wait
+        std::unique_lock<std::mutex> lk(wake_mutex_);
+        waiting_producers_.fetch_add(1);
+        wake_cv_.notify_one();
+        space_cv_.wait_for(lk, std::chrono::milliseconds(10), [this]() {
+            return record_queue_->can_push() || !async_running_.load();
+        });
+        waiting_producers_.fetch_sub(1);
+    }
+    // Pairs with the fence in shutdown(): either shutdown's drain sees this
+    // record or this thread sees the writer gone and writes it itself.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writer_stopped_.load()) {
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        drain_locked();
+        return;
+    }
+    if (writer_idle_.load()) {
+        std::lock_guard<std::mutex> lk(wake_mutex_);
+        wake_cv_.notify_one();
+    }
+}
+
+void Logger::writer_loop() {
+    constexpr std::size_t kMaxBatchRecords = 1024;
+    std::string record;
+    std::string batch;
+    std::uint64_t reported_drops = 0;
+
+    for (;;) {
+        batch.clear();
+        std::size_t n = 0;
+        while (n < kMaxBatchRecords && record_queue_->try_pop(record)) {
+            batch += record;
+            batch += '\n';
+            ++n;
+        }
+
+        std::uint64_t drops = dropped_records_.load(std::memory_order_relaxed);
+        if (drops != reported_drops) {
+            nlohmann::json note = { {"timestamp", timestamp_iso()}, {"log_level", "warn"}, {"service", service_name_},
+                                    {"log_message", "Log records dropped"}, {"extra", { {"dropped_total", drops} }} };
+            batch += note.dump();
+            batch += '\n';
+            reported_drops = drops;
+        }
+
+        if (!batch.empty()) {
+            // one lock, one write and one flush per batch
+            std::lock_guard<std::mutex> lock(file_mutex_);
+            write_locked(batch);
+            if (log_file_stream_.is_open()) log_file_stream_.flush();
+        }
+        if (n > 0 && waiting_producers_.load() > 0) {
+            std::lock_guard<std::mutex> lk(wake_mutex_);
+            space_cv_.notify_all();
+        }
+        if (n == kMaxBatchRecords) continue;
+
+        std::unique_lock<std::mutex> lk(wake_mutex_);
+        if (stop_writer_) break;
+        writer_idle_ = true;
+        wake_cv_.wait_for(lk, std::chrono::milliseconds(100), [this]() {
+            return stop_writer_.load() || record_queue_->can_pop();
+        });
+        writer_idle_ = false;
     }
 }
 
@@ -5,10 +5,23 @@
 #include <fstream>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
 #include <nlohmann/json.hpp>
+#include "mpsc_queue.hpp"
 
 enum class LogLevel { Debug = 0, Info = 1, Warn = 2, Err = 3 };
 
+// Statements below this level are compiled out entirely (0 = debug ... 3 = error).
+// Set from CMake with -DCHAT_LOG_COMPILE_LEVEL=<n>.
+#ifndef CHAT_LOG_COMPILE_LEVEL
+#define CHAT_LOG_COMPILE_LEVEL 0
+#endif
+
+// What a producer does when the async queue is full
+enum class LogOverflowPolicy { Block, Drop };
+
 class Logger {
 public:
     static Logger& instance();
@@ -19,6 +32,18 @@ public:
               std::uint64_t max_size_bytes = 10ull * 1024 * 1024, // 10MB
               int rotate_count = 5);
 
+    // Switch to asynchronous mode: records are formatted by the caller, pushed
+    // to a bounded queue and written in batches by one background thread.
+    void enable_async(std::size_t queue_capacity = 8192, LogOverflowPolicy policy = LogOverflowPolicy::Block);
+    // Stop the writer thread after draining the queue; later records are written synchronously.
+    void shutdown();
+    std::uint64_t dropped_count() const { return dropped_records_.load(std::memory_order_relaxed); }
+
+    // cheap runtime check used by the LOG_* macros before any argument is built
+    bool enabled(LogLevel log_level) const {
+        return static_cast<int>(log_level) >= static_cast<int>(log_level_.load(std::memory_order_relaxed));
+    }
+
     void log(LogLevel log_level, const std::string& log_message, const nlohmann::json& extra = nlohmann::json());
 
     void debug(const std::string& log_message, const nlohmann::json& extra = nlohmann::json());
@@ -34,13 +59,48 @@ private:
 
     std::string level_to_string(LogLevel log_level) const;
     std::string timestamp_iso() const;
-    void rotate_if_needed_locked();
+    void init_from_env_locked();
+    void open_locked();
+    void rotate_if_needed_locked(std::size_t incoming_bytes);
+    void write_locked(const std::string& data);
+    void enqueue(std::string&& record);
+    void drain_locked();
+    void writer_loop();
 
     std::mutex file_mutex_;
     std::ofstream log_file_stream_;
     std::string log_file_path_;
-    LogLevel log_level_;
+    std::string service_name_;
+    std::atomic<LogLevel> log_level_;
     std::uint64_t max_log_file_size_;
+    std::uint64_t current_file_size_; // tracked from our own writes, no stat per record
     int log_rotate_count_;
-    bool is_initialized_;
+    std::atomic<bool> is_initialized_;
+
+    // async mode
+    std::unique_ptr<BoundedMpscQueue<std::string>> record_queue_;
+    LogOverflowPolicy overflow_policy_ = LogOverflowPolicy::Block;
+    std::atomic<bool> async_running_{false};
+    std::atomic<bool> stop_writer_{false};
+    std::atomic<bool> writer_idle_{false};
+    std::atomic<bool> writer_stopped_{false}; // set once the writer thread has exited
+    std::atomic<int> waiting_producers_{0};   // Block policy: producers waiting for room
+    std::atomic<std::uint64_t> dropped_records_{0};
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;  // wakes the writer
+    std::condition_variable space_cv_; // wakes producers blocked on a full queue
+    std::thread writer_thread_;
 };
+
+// Logging macros: the level is checked before the message and the extra
+// fields are evaluated, so a filtered statement costs one branch.
+#define CHAT_LOG_AT(level, ...) \
+    do { \
+        if (static_cast<int>(level) >= CHAT_LOG_COMPILE_LEVEL && Logger::instance().enabled(level)) \
+            Logger::instance().log(level, __VA_ARGS__); \
+    } while (0)
+
+#define LOG_DEBUG(...) CHAT_LOG_AT(LogLevel::Debug, __VA_ARGS__)
+#define LOG_INFO(...)  CHAT_LOG_AT(LogLevel::Info, __VA_ARGS__)
+#define LOG_WARN(...)  CHAT_LOG_AT(LogLevel::Warn, __VA_ARGS__)
+#define LOG_ERROR(...) CHAT_LOG_AT(LogLevel::Err, __VA_ARGS__)
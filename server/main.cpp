@@ -2,12 +2,110 @@
 #include <boost/asio.hpp>
 #include "server.hpp"
 #include "logger.hpp"
+#include "handoff.hpp"
 #include <thread>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// read an unsigned integer tunable from the environment, keeping the default on absence/parse error
+static std::size_t env_size(const char* name, std::size_t default_value) {
+    const char* value = std::getenv(name);
+    if (!value) return default_value;
+    try { return static_cast<std::size_t>(std::stoull(value)); } catch(...) { return default_value; }
+}
+
+// read a RateLimit as "per_second[:burst]"; the burst defaults to twice the rate
+static void env_rate(const char* name, RateLimit& limit) {
+    const char* value = std::getenv(name);
+    if (!value) return;
+    try {
+        std::string s = value;
+        std::size_t colon = s.find(':');
+        limit.per_second = std::stod(s.substr(0, colon));
+        limit.burst = colon == std::string::npos ? limit.per_second * 2 : std::stod(s.substr(colon + 1));
+        limit.burst = std::max(limit.burst, 1.0);
+    } catch(...) {}
+}
+
+// pin the calling thread to one CPU (Linux only; elsewhere the scheduler decides)
+static void pin_current_thread(std::size_t cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(static_cast<int>(cpu % CPU_SETSIZE), &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) LOG_WARN("Failed to pin io thread", { {"cpu", static_cast<uint64_t>(cpu)} });
+#else
+    (void)cpu;
+#endif
+}
 
 int main(int argc, char** argv) {
     try {
-        unsigned short port = 9000;
-        if (argc > 1) port = static_cast<unsigned short>(std::stoi(argv[1]));
+        ServerConfig config;
+        if (argc > 1) config.port = static_cast<unsigned short>(std::stoi(argv[1]));
+        config.admin_port = static_cast<unsigned short>(env_size("CHAT_ADMIN_PORT", config.admin_port));
+        config.io_threads = env_size("CHAT_IO_THREADS", config.io_threads);
+        config.io_per_core = env_size("CHAT_IO_PER_CORE", 0) != 0;
+        config.write_batch_max_frames = env_size("CHAT_WRITE_BATCH_FRAMES", config.write_batch_max_frames);
+        config.write_batch_max_bytes = env_size("CHAT_WRITE_BATCH_BYTES", config.write_batch_max_bytes);
+        config.send_queue_max_frames = env_size("CHAT_SEND_QUEUE_FRAMES", config.send_queue_max_frames);
+        config.send_queue_max_bytes = env_size("CHAT_SEND_QUEUE_BYTES", config.send_queue_max_bytes);
+        if (const char* policy = std::getenv("CHAT_SLOW_CONSUMER_POLICY")) {
+            std::string p = policy;
+            if (p == "coalesce") config.slow_consumer_policy = SlowConsumerPolicy::Coalesce;
+            else if (p == "disconnect") config.slow_consumer_policy = SlowConsumerPolicy::Disconnect;
+            else config.slow_consumer_policy = SlowConsumerPolicy::DropOldest;
+        }
+        config.max_frame_size = env_size("CHAT_MAX_FRAME_SIZE", config.max_frame_size);
+        config.history_capacity = env_size("CHAT_HISTORY_CAPACITY", config.history_capacity);
+        config.enable_search = env_size("CHAT_SEARCH", 1) != 0;
+        config.history_page_max = std::max<std::size_t>(env_size("CHAT_HISTORY_PAGE_MAX", config.history_page_max), 1);
+        if (const char* data_dir = std::getenv("CHAT_DATA_DIR")) config.data_dir = data_dir;
+        config.log_segment_bytes = env_size("CHAT_SEGMENT_BYTES", config.log_segment_bytes);
+        config.log_max_segments = env_size("CHAT_MAX_SEGMENTS", config.log_max_segments);
+        config.log_fsync_interval_ms = static_cast<std::uint32_t>(env_size("CHAT_FSYNC_INTERVAL_MS", config.log_fsync_interval_ms));
+        config.history_disk_scan_limit = env_size("CHAT_HISTORY_DISK_SCAN", config.history_disk_scan_limit);
+        config.pbkdf2_iterations = static_cast<std::uint32_t>(env_size("CHAT_PBKDF2_ITERATIONS", config.pbkdf2_iterations));
+        config.auth_threads = env_size("CHAT_AUTH_THREADS", config.auth_threads);
+        config.auth_queue_limit = env_size("CHAT_AUTH_QUEUE", config.auth_queue_limit);
+        config.heartbeat_interval_ms = env_size("CHAT_HEARTBEAT_INTERVAL_MS", config.heartbeat_interval_ms);
+        config.idle_heartbeats = env_size("CHAT_IDLE_HEARTBEATS", config.idle_heartbeats);
+        config.idle_wheel_tick_ms = std::max<std::size_t>(env_size("CHAT_IDLE_TICK_MS", config.idle_wheel_tick_ms), 1);
+        config.presence_batch_ms = env_size("CHAT_PRESENCE_BATCH_MS", config.presence_batch_ms);
+        if (const char* default_room = std::getenv("CHAT_DEFAULT_ROOM")) config.default_room = default_room;
+        config.max_rooms_per_user = env_size("CHAT_MAX_ROOMS_PER_USER", config.max_rooms_per_user);
+        config.enable_binary_protocol = env_size("CHAT_BINARY_PROTOCOL", 1) != 0;
+        config.enable_compression = env_size("CHAT_COMPRESSION", 1) != 0;
+        config.compress_level = static_cast<int>(std::min<std::size_t>(env_size("CHAT_COMPRESS_LEVEL", config.compress_level), 9));
+        config.compress_window_bits = static_cast<int>(std::min<std::size_t>(std::max<std::size_t>(env_size("CHAT_COMPRESS_WINDOW_BITS", config.compress_window_bits), 9), 15));
+        config.compress_min_bytes = env_size("CHAT_COMPRESS_MIN_BYTES", config.compress_min_bytes);
+        const char* const rate_names[] = { "MESSAGE", "PRIVATE", "HISTORY", "LIST" };
+        for (std::size_t i = 0; i < kRateClassCount; ++i) {
+            env_rate(("CHAT_RATE_" + std::string(rate_names[i])).c_str(), config.session_rate[i]);
+            env_rate(("CHAT_USER_RATE_" + std::string(rate_names[i])).c_str(), config.user_rate[i]);
+        }
+        config.rate_strikes = std::max<double>(static_cast<double>(env_size("CHAT_RATE_STRIKES", static_cast<std::size_t>(config.rate_strikes))), 1.0);
+        config.cluster_port = static_cast<unsigned short>(env_size("CHAT_CLUSTER_PORT", config.cluster_port));
+        if (const char* bind = std::getenv("CHAT_CLUSTER_BIND")) config.cluster_bind = bind;
+        if (const char* secret = std::getenv("CHAT_CLUSTER_SECRET")) config.cluster_secret = secret;
+        if (const char* node_id = std::getenv("CHAT_NODE_ID")) config.node_id = node_id;
+        if (const char* peers = std::getenv("CHAT_CLUSTER_PEERS")) {
+            std::string list = peers;
+            for (std::size_t pos = 0; pos <= list.size();) {
+                std::size_t comma = std::min(list.find(',', pos), list.size());
+                if (comma > pos) config.cluster_peers.push_back(list.substr(pos, comma - pos));
+                pos = comma + 1;
+            }
+        }
+        config.cluster_queue_bytes = env_size("CHAT_CLUSTER_QUEUE_BYTES", config.cluster_queue_bytes);
+        if (const char* handoff_path = std::getenv("CHAT_HANDOFF_PATH")) config.handoff_path = handoff_path;
+        config.handoff_timeout_ms = env_size("CHAT_HANDOFF_TIMEOUT_MS", config.handoff_timeout_ms);
+        config.recv_buffer_initial = std::max<std::size_t>(env_size("CHAT_RECV_BUFFER", config.recv_buffer_initial), 64);
 
         // initialize logger from env or default
         const char* env_logfile = std::getenv("LOG_FILE");
@@ -29,52 +127,81 @@ int main(int argc, char** argv) {
         if (env_rot) { try { rotate_count = std::stoi(env_rot); } catch(...) {} }
 
         Logger::instance().init(log_file_path, log_level, maxsz, rotate_count);
-        Logger::instance().info("Logger initialized");
+        if (env_size("LOG_ASYNC", 1) != 0) {
+            const char* env_overflow = std::getenv("LOG_OVERFLOW");
+            LogOverflowPolicy overflow = (env_overflow && std::string(env_overflow) == "drop") ? LogOverflowPolicy::Drop : LogOverflowPolicy::Block;
+            Logger::instance().enable_async(env_size("LOG_QUEUE_SIZE", 8192), overflow);
+        }
+        LOG_INFO("Logger initialized");
 
-        boost::asio::io_context ioc;
-        Logger::instance().info("io_context created");
+        // run io_context(s) on thread_count reactor threads
+        const std::size_t hardware_threads = std::thread::hardware_concurrency();
+        const std::size_t cores = hardware_threads ? hardware_threads : 1;
+        const std::size_t thread_count = config.io_threads ? config.io_threads : (hardware_threads ? hardware_threads : 2);
+        LOG_INFO("Threads to run: ", { {"count", thread_count}, {"per_core", config.io_per_core} });
+
+        // shared mode: one io_context for all threads; per-core mode: one single-threaded io_context per thread
+        std::vector<std::unique_ptr<boost::asio::io_context>> contexts;
+        if (config.io_per_core) {
+            for (std::size_t i = 0; i < thread_count; ++i) contexts.push_back(std::make_unique<boost::asio::io_context>(1));
+        } else {
+            contexts.push_back(std::make_unique<boost::asio::io_context>(static_cast<int>(thread_count)));
+        }
+        LOG_INFO("io_context created", { {"count", static_cast<uint64_t>(contexts.size())} });
 
         // Use a work_guard to prevent server from auto-terminating when no clients are connected
-        boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_guard(ioc.get_executor());
-        Logger::instance().info("work_guard created");
+        std::vector<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> work_guards;
+        std::vector<boost::asio::io_context*> shards;
+        for (auto& ctx : contexts) {
+            work_guards.push_back(boost::asio::make_work_guard(*ctx));
+            shards.push_back(ctx.get());
+        }
+        LOG_INFO("work_guard created");
 
         {
-            Logger::instance().info("Creating server object");
-            Server server(ioc, port);
-            Logger::instance().info("Server object constructed");
+            // a process already serving on the handoff path passes us its sockets instead of us binding
+            HandoffState inherited;
+            if (!config.handoff_path.empty() && request_handoff(config.handoff_path, inherited)) {
+                LOG_INFO("Taking over from the previous process", { {"sessions", static_cast<uint64_t>(inherited.sessions.size())} });
+            }
 
-            server.run_accept();
-            Logger::instance().info("Server run_accept called");
+            LOG_INFO("Creating server object");
+            Server server(shards, config, std::move(inherited));
+            LOG_INFO("Server object constructed");
 
-            // run io_context on multiple thread_count (reactor thread_count)
-            size_t thread_count = std::thread::hardware_concurrency();
-            if (thread_count == 0) thread_count = 2;
-            Logger::instance().info("Threads to run: ", { {"count", thread_count} });
+            server.run_accept();
+            LOG_INFO("Server run_accept called");
 
             std::vector<std::thread> io_threads;
             for (size_t thread_index = 0; thread_index < thread_count; ++thread_index) {
-                io_threads.emplace_back([&ioc, thread_index](){
+                boost::asio::io_context& ioc = *shards[config.io_per_core ? thread_index : 0];
+                const bool pin = config.io_per_core;
+                io_threads.emplace_back([&ioc, thread_index, pin, cores](){
                     try {
-                        Logger::instance().info("Thread started", {{"id", thread_index}});
+                        if (pin) pin_current_thread(thread_index % cores);
+                        LOG_INFO("Thread started", {{"id", thread_index}});
                         ioc.run();
-                        Logger::instance().info("Thread exit normally", {{"id", thread_index}});
+                        LOG_INFO("Thread exit normally", {{"id", thread_index}});
                     } catch (const std::exception& ex) {
-                        Logger::instance().error("Thread exception", {{"id", thread_index}, {"what", ex.what()}});
+                        LOG_ERROR("Thread exception", {{"id", thread_index}, {"what", ex.what()}});
                     }
                 });
             }
-            Logger::instance().info("Server listening", { {"port", port}, {"thread_count", static_cast<uint64_t>(thread_count)} });
+            LOG_INFO("Server listening", { {"port", config.port}, {"thread_count", static_cast<uint64_t>(thread_count)} });
 
             for (auto& thread_obj : io_threads) thread_obj.join();
-            Logger::instance().info("All thread_count joined. Main ready to exit.");
+            LOG_INFO("All thread_count joined. Main ready to exit.");
         }
 
-        Logger::instance().info("Main function end, process about to exit.");
+        LOG_INFO("Main function end, process about to exit.");
+        Logger::instance().shutdown();
 
     } catch (const std::exception& ex) {
-        Logger::instance().error("Main thread exception caught", {{"what", ex.what()}});
+        LOG_ERROR("Main thread exception caught", {{"what", ex.what()}});
+        Logger::instance().shutdown();
     } catch (...) {
-        Logger::instance().error("Main thread unknown exception caught");
+        LOG_ERROR("Main thread unknown exception caught");
+        Logger::instance().shutdown();
     }
 
     return 0;
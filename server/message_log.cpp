@@ -0,0 +1,480 @@
+// message_log.cpp
+#include "message_log.hpp"
+#include "logger.hpp"
+#include <boost/crc.hpp>
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <cstdio>
+
+namespace fs = std::filesystem;
+namespace bip = boost::interprocess;
+
+namespace {
+
+// segment magic is "CHATSEG" + format version digit
+const char kSegmentMagic[7] = { 'C','H','A','T','S','E','G' };
+const char kIndexMagic[8] = { 'C','H','A','T','I','D','X','1' };
+constexpr int kFormatVersion = 2;
+constexpr uint64_t kSegmentHeaderSize = 16; // magic + base id
+
+// len, crc, id, ts, from_len, to_len, [room_len, reserved,] text_len
+uint64_t record_header_size(int version) { return version >= 2 ? 36 : 32; }
+
+int segment_version(const char* base, uint64_t size) {
+    if (size < kSegmentHeaderSize || std::memcmp(base, kSegmentMagic, 7) != 0) return 0;
+    return base[7] - '0';
+}
+
+void put_u16(char* p, uint16_t v) { for (int i = 0; i < 2; ++i) p[i] = static_cast<char>(v >> (8 * i)); }
+void put_u32(char* p, uint32_t v) { for (int i = 0; i < 4; ++i) p[i] = static_cast<char>(v >> (8 * i)); }
+void put_u64(char* p, uint64_t v) { for (int i = 0; i < 8; ++i) p[i] = static_cast<char>(v >> (8 * i)); }
+uint16_t get_u16(const char* p) { uint16_t v = 0; for (int i = 1; i >= 0; --i) v = static_cast<uint16_t>((v << 8) | static_cast<uint8_t>(p[i])); return v; }
+uint32_t get_u32(const char* p) { uint32_t v = 0; for (int i = 3; i >= 0; --i) v = (v << 8) | static_cast<uint8_t>(p[i]); return v; }
+uint64_t get_u64(const char* p) { uint64_t v = 0; for (int i = 7; i >= 0; --i) v = (v << 8) | static_cast<uint8_t>(p[i]); return v; }
+
+uint32_t crc_of(const char* p, std::size_t n) {
+    boost::crc_32_type crc;
+    crc.process_bytes(p, n);
+    return crc.checksum();
+}
+
+// Parse one record at `offset`. Returns false at the end of valid data
+// (zero length, truncated or failed checksum).
+bool parse_record(int version, const char* base, uint64_t limit, uint64_t offset, ChatMsg* out, uint64_t& next, uint64_t& id, uint64_t& ts) {
+    const uint64_t header = record_header_size(version);
+    if (offset + header > limit) return false;
+    const char* p = base + offset;
+    uint32_t len = get_u32(p);
+    if (len < header - 4 || offset + 4 + len > limit) return false;
+    uint16_t from_len = get_u16(p + 24);
+    uint16_t to_len = get_u16(p + 26);
+    uint16_t room_len = version >= 2 ? get_u16(p + 28) : 0;
+    uint32_t text_len = get_u32(p + header - 4);
+    if (header + from_len + to_len + room_len + text_len != 4ull + len) return false;
+    if (get_u32(p + 4) != crc_of(p + 8, len - 4)) return false;
+    id = get_u64(p + 8);
+    ts = get_u64(p + 16);
+    if (out) {
+        const char* s = p + header;
+        out->from.assign(s, from_len);
+        out->to.assign(s + from_len, to_len);
+        out->room.assign(s + from_len + to_len, room_len);
+        out->text.assign(s + from_len + to_len + room_len, text_len);
+        out->ts = ts;
+        out->id = id;
+    }
+    next = offset + 4 + len;
+    return true;
+}
+
+} // namespace
+
+MessageLog::Segment::~Segment() {
+    if (!retired) return;
+    region = bip::mapped_region();
+    file = bip::file_mapping();
+    std::error_code ec;
+    fs::remove(path, ec);
+    fs::remove(path + ".idx", ec);
+}
+
+MessageLog::MessageLog(MessageLogOptions options) : options_(std::move(options)) {
+    options_.index_interval = std::max<uint32_t>(options_.index_interval, 1);
+    options_.max_segments = std::max<std::size_t>(options_.max_segments, 1);
+}
+
+MessageLog::~MessageLog() {
+    {
+        std::lock_guard<std::mutex> lk(commit_mutex_);
+        stop_commit_ = true;
+    }
+    commit_cv_.notify_one();
+    if (commit_thread_.joinable()) commit_thread_.join();
+    try {
+        sync();
+        seal_pending();
+    } catch (...) {}
+}
+
+std::string MessageLog::segment_path(uint64_t base_id) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%020llu.seg", static_cast<unsigned long long>(base_id));
+    return (fs::path(options_.dir) / name).string();
+}
+
+void MessageLog::open() {
+    fs::create_directories(options_.dir);
+
+    std::vector<std::pair<uint64_t, std::string>> found;
+    for (const auto& entry : fs::directory_iterator(options_.dir)) {
+        if (entry.path().extension() != ".seg") continue;
+        try {
+            found.emplace_back(std::stoull(entry.path().stem().string()), entry.path().string());
+        } catch (...) {}
+    }
+    std::sort(found.begin(), found.end());
+
+    std::lock_guard<std::mutex> lk(log_mutex_);
+    segments_.clear();
+    for (std::size_t i = 0; i < found.size(); ++i) {
+        const bool newest = i + 1 == found.size();
+        // the newest segment is still active unless it was sealed (has an index file)
+        if (newest && !fs::exists(found[i].second + ".idx")) segments_.push_back(recover_active(found[i].second, found[i].first));
+        else segments_.push_back(map_sealed(found[i].second, found[i].first));
+    }
+    // never append new-format records to an old-format segment
+    if (!segments_.empty() && segments_.back()->writable && segments_.back()->version != kFormatVersion) {
+        segments_.back() = seal(*segments_.back());
+    }
+    if (segments_.empty() || !segments_.back()->writable) {
+        uint64_t next_id = segments_.empty() ? 1 : segments_.back()->last_id + 1;
+        segments_.push_back(create_active_locked(next_id));
+    }
+    synced_offset_ = segments_.back()->used;
+    enforce_retention_locked();
+
+    LOG_INFO("Message log opened", { {"dir", options_.dir}, {"segments", static_cast<uint64_t>(segments_.size())},
+        {"last_id", segments_.back()->last_id ? segments_.back()->last_id : segments_.back()->base_id - 1} });
+
+    stop_commit_ = false;
+    commit_thread_ = std::thread([this]() { commit_loop(); });
+}
+
+MessageLog::SegmentPtr MessageLog::map_sealed(const std::string& path, uint64_t base_id) {
+    auto seg = std::make_shared<Segment>();
+    seg->path = path;
+    seg->base_id = base_id;
+    seg->file = bip::file_mapping(path.c_str(), bip::read_only);
+    seg->region = bip::mapped_region(seg->file, bip::read_only);
+    seg->version = segment_version(seg->data(), seg->region.get_size());
+    if (!load_index_file(*seg)) {
+        // missing or stale index: rebuild it once from the data
+        scan_segment(*seg, seg->region.get_size());
+        write_index_file(*seg);
+    }
+    return seg;
+}
+
+MessageLog::SegmentPtr MessageLog::create_active_locked(uint64_t base_id) {
+    auto seg = std::make_shared<Segment>();
+    seg->path = segment_path(base_id);
+    seg->base_id = base_id;
+    seg->writable = true;
+    {
+        std::ofstream create(seg->path, std::ios::binary | std::ios::trunc);
+    }
+    fs::resize_file(seg->path, options_.segment_bytes);
+    seg->file = bip::file_mapping(seg->path.c_str(), bip::read_write);
+    seg->region = bip::mapped_region(seg->file, bip::read_write);
+    char* p = static_cast<char*>(seg->region.get_address());
+    std::memcpy(p, kSegmentMagic, 7);
+    p[7] = static_cast<char>('0' + kFormatVersion);
+    put_u64(p + 8, base_id);
+    seg->version = kFormatVersion;
+    seg->used = kSegmentHeaderSize;
+    seg->region.flush(0, kSegmentHeaderSize, false);
+    return seg;
+}
+
+MessageLog::SegmentPtr MessageLog::recover_active(const std::string& path, uint64_t base_id) {
+    auto seg = std::make_shared<Segment>();
+    seg->path = path;
+    seg->base_id = base_id;
+    seg->writable = true;
+    if (fs::file_size(path) < options_.segment_bytes) fs::resize_file(path, options_.segment_bytes);
+    seg->file = bip::file_mapping(path.c_str(), bip::read_write);
+    seg->region = bip::mapped_region(seg->file, bip::read_write);
+    seg->version = segment_version(seg->data(), seg->region.get_size());
+    scan_segment(*seg, seg->region.get_size());
+    // clear any torn tail so it can never be mistaken for a record later
+    char* p = static_cast<char*>(seg->region.get_address());
+    std::memset(p + seg->used, 0, seg->region.get_size() - seg->used);
+    seg->region.flush(0, 0, false);
+    LOG_INFO("Message log active segment recovered", { {"path", path}, {"records", seg->records}, {"bytes", seg->used} });
+    return seg;
+}
+
+// Walk the records of a segment, rebuilding its sparse index and last id.
+void MessageLog::scan_segment(Segment& seg, uint64_t limit) {
+    const char* base = seg.data();
+    seg.index.clear();
+    seg.records = 0;
+    seg.last_id = 0;
+    seg.used = kSegmentHeaderSize;
+    if (seg.version == 0) return;
+
+    // ids only ever increase; a gap is a message that was never written, not the end of the data
+    uint64_t offset = kSegmentHeaderSize, next = 0, id = 0, ts = 0;
+    uint64_t prev = seg.base_id - 1;
+    while (parse_record(seg.version, base, limit, offset, nullptr, next, id, ts) && id > prev) {
+        if (seg.records % options_.index_interval == 0) seg.index.push_back({ id, ts, offset });
+        seg.last_id = id;
+        ++seg.records;
+        prev = id;
+        offset = next;
+    }
+    seg.used = offset;
+}
+
+void MessageLog::write_index_file(const Segment& seg) {
+    std::string tmp = seg.path + ".idx.tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        std::vector<char> buf(8 + 8 * 4 + seg.index.size() * 24);
+        char* p = buf.data();
+        std::memcpy(p, kIndexMagic, 8);
+        put_u64(p + 8, seg.used);
+        put_u64(p + 16, seg.records);
+        put_u64(p + 24, seg.last_id);
+        put_u64(p + 32, seg.index.size());
+        p += 40;
+        for (const auto& e : seg.index) {
+            put_u64(p, e.id);
+            put_u64(p + 8, e.ts);
+            put_u64(p + 16, e.offset);
+            p += 24;
+        }
+        out.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+    }
+    std::error_code ec;
+    fs::rename(tmp, seg.path + ".idx", ec);
+}
+
+bool MessageLog::load_index_file(Segment& seg) {
+    std::ifstream in(seg.path + ".idx", std::ios::binary);
+    if (!in) return false;
+    char head[40];
+    if (!in.read(head, sizeof(head)) || std::memcmp(head, kIndexMagic, 8) != 0) return false;
+    uint64_t used = get_u64(head + 8);
+    if (used > seg.region.get_size()) return false; // segment does not match its index
+    uint64_t count = get_u64(head + 32);
+    std::vector<char> body(count * 24);
+    if (!in.read(body.data(), static_cast<std::streamsize>(body.size()))) return false;
+    seg.used = used;
+    seg.records = get_u64(head + 16);
+    seg.last_id = get_u64(head + 24);
+    seg.index.resize(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        const char* p = body.data() + i * 24;
+        seg.index[i] = { get_u64(p), get_u64(p + 8), get_u64(p + 16) };
+    }
+    return true;
+}
+
+bool MessageLog::fits(const ChatMsg& msg) const {
+    const uint64_t rec_size = record_header_size(kFormatVersion) + msg.from.size() + msg.to.size() + msg.room.size() + msg.text.size();
+    return kSegmentHeaderSize + rec_size <= options_.segment_bytes &&
+           msg.from.size() <= 0xFFFF && msg.to.size() <= 0xFFFF && msg.room.size() <= 0xFFFF;
+}
+
+void MessageLog::append(const ChatMsg& msg) {
+    const uint64_t header = record_header_size(kFormatVersion);
+    const uint64_t rec_size = header + msg.from.size() + msg.to.size() + msg.room.size() + msg.text.size();
+    if (!fits(msg)) {
+        LOG_ERROR("Message too large for log segment, not persisted", { {"id", msg.id}, {"bytes", rec_size} });
+        return;
+    }
+
+    std::lock_guard<std::mutex> lk(log_mutex_);
+    Segment* seg = segments_.back().get();
+    if (seg->used + rec_size > options_.segment_bytes) {
+        // the full segment is sealed by the commit thread; appends go on at once
+        to_seal_.push_back(segments_.back());
+        segments_.push_back(create_active_locked(msg.id));
+        synced_offset_ = segments_.back()->used;
+        enforce_retention_locked();
+        seg = segments_.back().get();
+    }
+
+    char* p = static_cast<char*>(seg->region.get_address()) + seg->used;
+    put_u32(p, static_cast<uint32_t>(rec_size - 4));
+    put_u64(p + 8, msg.id);
+    put_u64(p + 16, msg.ts);
+    put_u16(p + 24, static_cast<uint16_t>(msg.from.size()));
+    put_u16(p + 26, static_cast<uint16_t>(msg.to.size()));
+    put_u16(p + 28, static_cast<uint16_t>(msg.room.size()));
+    put_u16(p + 30, 0);
+    put_u32(p + 32, static_cast<uint32_t>(msg.text.size()));
+    char* s = p + header;
+    std::memcpy(s, msg.from.data(), msg.from.size());
+    s += msg.from.size();
+    std::memcpy(s, msg.to.data(), msg.to.size());
+    s += msg.to.size();
+    std::memcpy(s, msg.room.data(), msg.room.size());
+    s += msg.room.size();
+    std::memcpy(s, msg.text.data(), msg.text.size());
+    put_u32(p + 4, crc_of(p + 8, rec_size - 8));
+
+    if (seg->records % options_.index_interval == 0) seg->index.push_back({ msg.id, msg.ts, seg->used });
+    ++seg->records;
+    seg->last_id = msg.id;
+    seg->used += rec_size;
+}
+
+// Flush, shrink a full segment to its used size, write its index and map it
+// read-only. Nothing appends to it any more, so this needs no lock; readers
+// holding the old mapping keep it alive.
+MessageLog::SegmentPtr MessageLog::seal(Segment& active) {
+    active.region.flush(0, 0, false);
+
+    auto sealed = std::make_shared<Segment>();
+    sealed->path = active.path;
+    sealed->base_id = active.base_id;
+    sealed->version = active.version;
+    sealed->last_id = active.last_id;
+    sealed->used = active.used;
+    sealed->records = active.records;
+    sealed->index = active.index;
+    // platforms that cannot shrink a mapped file keep the preallocated size; the index records the real end
+    std::error_code ec;
+    fs::resize_file(active.path, active.used, ec);
+    sealed->file = bip::file_mapping(sealed->path.c_str(), bip::read_only);
+    sealed->region = bip::mapped_region(sealed->file, bip::read_only);
+    write_index_file(*sealed);
+    LOG_INFO("Message log segment sealed", { {"path", sealed->path}, {"records", sealed->records}, {"bytes", sealed->used} });
+    return sealed;
+}
+
+// Seal the segments append() rolled over from and swap them into the list.
+void MessageLog::seal_pending() {
+    std::vector<SegmentPtr> pending;
+    {
+        std::lock_guard<std::mutex> lk(log_mutex_);
+        pending.swap(to_seal_);
+    }
+    for (const auto& full : pending) {
+        SegmentPtr sealed = seal(*full);
+        std::lock_guard<std::mutex> lk(log_mutex_);
+        auto it = std::find(segments_.begin(), segments_.end(), full);
+        if (it != segments_.end()) *it = std::move(sealed);
+        else sealed->retired = full->retired; // dropped by retention meanwhile
+    }
+}
+
+void MessageLog::enforce_retention_locked() {
+    while (segments_.size() > options_.max_segments) {
+        segments_.front()->retired = true;
+        LOG_INFO("Message log segment retired", { {"path", segments_.front()->path} });
+        segments_.erase(segments_.begin());
+    }
+}
+
+void MessageLog::sync() {
+    SegmentPtr active;
+    uint64_t from, to;
+    {
+        std::lock_guard<std::mutex> lk(log_mutex_);
+        if (segments_.empty()) return;
+        active = segments_.back();
+        if (!active->writable) return;
+        from = std::min(synced_offset_, active->used);
+        to = active->used;
+        synced_offset_ = to;
+    }
+    if (to > from) active->region.flush(static_cast<std::size_t>(from), static_cast<std::size_t>(to - from), false);
+}
+
+void MessageLog::commit_loop() {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lk(commit_mutex_);
+            commit_cv_.wait_for(lk, std::chrono::milliseconds(options_.fsync_interval_ms), [this]() { return stop_commit_.load(); });
+            if (stop_commit_) return;
+        }
+        try {
+            sync();
+            seal_pending();
+        } catch (const std::exception& ex) {
+            LOG_ERROR("Message log sync failed", { {"what", ex.what()} });
+        }
+    }
+}
+
+uint64_t MessageLog::last_id() {
+    std::lock_guard<std::mutex> lk(log_mutex_);
+    if (segments_.empty()) return 0;
+    return segments_.back()->last_id ? segments_.back()->last_id : segments_.back()->base_id - 1;
+}
+
+std::vector<ChatMsg> MessageLog::read_tail(std::size_t count) {
+    std::vector<ChatMsg> out;
+    visit_backward(UINT64_MAX, count, [&out](const ChatMsg& m) { out.push_back(m); return true; });
+    std::reverse(out.begin(), out.end());
+    return out;
+}
+
+void MessageLog::visit_backward(uint64_t before_id, std::size_t max_records, const std::function<bool(const ChatMsg&)>& visitor) {
+    // snapshot the segment list; the shared_ptrs keep the mappings valid without the lock
+    std::vector<SegmentPtr> segs;
+    std::vector<uint64_t> used;
+    {
+        std::lock_guard<std::mutex> lk(log_mutex_);
+        segs = segments_;
+        for (const auto& s : segs) used.push_back(s->used);
+    }
+
+    std::size_t examined = 0;
+    std::vector<ChatMsg> chunk;
+    for (std::size_t si = segs.size(); si-- > 0;) {
+        const Segment& seg = *segs[si];
+        if (seg.base_id >= before_id || seg.index.empty()) continue;
+        // index entries are copied under the lock for the active segment
+        std::vector<IndexEntry> index;
+        {
+            std::lock_guard<std::mutex> lk(log_mutex_);
+            index = seg.index;
+        }
+        for (std::size_t ci = index.size(); ci-- > 0;) {
+            if (index[ci].id >= before_id) continue;
+            uint64_t end = ci + 1 < index.size() ? index[ci + 1].offset : used[si];
+            // records are variable length, so each chunk is parsed forwards and visited in reverse
+            chunk.clear();
+            uint64_t offset = index[ci].offset, next = 0, id = 0, ts = 0;
+            ChatMsg m;
+            while (offset < end && parse_record(seg.version, seg.data(), end, offset, &m, next, id, ts)) {
+                if (seg.version < 2 && m.to.empty()) m.room = options_.legacy_room;
+                if (id < before_id) chunk.push_back(m);
+                offset = next;
+            }
+            for (auto it = chunk.rbegin(); it != chunk.rend(); ++it) {
+                if (examined++ >= max_records || !visitor(*it)) return;
+            }
+        }
+    }
+}
+
+void MessageLog::visit_forward(uint64_t after_id, std::size_t max_records, const std::function<bool(const ChatMsg&)>& visitor) {
+    std::vector<SegmentPtr> segs;
+    std::vector<uint64_t> used;
+    {
+        std::lock_guard<std::mutex> lk(log_mutex_);
+        segs = segments_;
+        for (const auto& s : segs) used.push_back(s->used);
+    }
+
+    std::size_t examined = 0;
+    for (std::size_t si = 0; si < segs.size(); ++si) {
+        const Segment& seg = *segs[si];
+        // every record of this segment is at or before the cursor
+        if (si + 1 < segs.size() && segs[si + 1]->base_id <= after_id + 1) continue;
+        std::vector<IndexEntry> index;
+        {
+            std::lock_guard<std::mutex> lk(log_mutex_);
+            index = seg.index;
+        }
+        if (index.empty()) continue;
+        // last sparse entry at or before the first wanted id, then scan forward from it
+        auto it = std::upper_bound(index.begin(), index.end(), after_id + 1, [](uint64_t id, const IndexEntry& e) { return id < e.id; });
+        uint64_t offset = it == index.begin() ? index.front().offset : std::prev(it)->offset, next = 0, id = 0, ts = 0;
+        ChatMsg m;
+        while (offset < used[si] && parse_record(seg.version, seg.data(), used[si], offset, &m, next, id, ts)) {
+            offset = next;
+            if (id <= after_id) continue;
+            if (seg.version < 2 && m.to.empty()) m.room = options_.legacy_room;
+            if (examined++ >= max_records || !visitor(m)) return;
+        }
+    }
+}
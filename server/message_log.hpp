@@ -0,0 +1,114 @@
+// message_log.hpp
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "message_store.hpp"
+
+struct MessageLogOptions {
+    std::string dir;                          // segment directory
+    uint64_t segment_bytes = 64ull << 20;     // preallocated size of the active segment
+    std::size_t max_segments = 16;            // retention: oldest segments beyond this are deleted
+    uint32_t fsync_interval_ms = 20;          // group-commit window
+    uint32_t index_interval = 64;             // one sparse index entry per N records
+    std::string legacy_room;                  // room given to group messages read from format 1 segments
+};
+
+// Durable append-only message log made of fixed-size segments.
+//
+// The active segment is preallocated and memory-mapped read/write; appends
+// are a memcpy into the mapping and a background thread flushes the dirty
+// range every fsync_interval_ms (group commit). Full segments are sealed
+// by that thread too, off the append path: truncated to their used size,
+// written a sparse (id, ts, offset) index file next to them and remapped
+// read-only. Startup maps the sealed segments and loads their index files,
+// and only scans the active segment, so restart time does not depend on the
+// amount of history stored.
+//
+// Record layout (little endian, format 2):
+//   u32 len | u32 crc32 | u64 id | u64 ts | u16 from_len | u16 to_len | u16 room_len | u16 reserved |
+//   u32 text_len | from | to | room | text
+// Format 1 segments (no room field) are still readable.
+// where len counts the bytes after the len field and crc covers them minus the crc itself.
+class MessageLog {
+public:
+    explicit MessageLog(MessageLogOptions options);
+    ~MessageLog();
+
+    // map existing segments and recover the active one; throws on I/O errors
+    void open();
+
+    // false when msg cannot be stored: a record larger than a segment, or a
+    // name longer than 0xFFFF bytes. Checked before an id is given out.
+    bool fits(const ChatMsg& msg) const;
+    // msg.id must be above last_id() (MessageStore assigns ids) and msg must fit()
+    void append(const ChatMsg& msg);
+    // flush everything appended so far to disk
+    void sync();
+
+    uint64_t last_id(); // 0 when empty
+
+    // the newest `count` records, oldest first
+    std::vector<ChatMsg> read_tail(std::size_t count);
+    // visit records with id < before_id from newest to oldest; stops when the
+    // visitor returns false or after max_records records have been examined
+    void visit_backward(uint64_t before_id, std::size_t max_records, const std::function<bool(const ChatMsg&)>& visitor);
+    // visit records with id > after_id from oldest to newest, same stopping rules
+    void visit_forward(uint64_t after_id, std::size_t max_records, const std::function<bool(const ChatMsg&)>& visitor);
+
+private:
+    struct IndexEntry {
+        uint64_t id;
+        uint64_t ts;
+        uint64_t offset;
+    };
+
+    struct Segment {
+        std::string path;
+        uint64_t base_id = 0;
+        uint64_t last_id = 0;   // 0 while empty
+        uint64_t used = 0;      // bytes in use, including the header
+        uint64_t records = 0;
+        int version = 0;        // record format, from the segment header
+        bool writable = false;
+        bool retired = false;   // delete files once the last reader lets go
+        boost::interprocess::file_mapping file;
+        boost::interprocess::mapped_region region;
+        std::vector<IndexEntry> index;
+
+        const char* data() const { return static_cast<const char*>(region.get_address()); }
+        ~Segment();
+    };
+    using SegmentPtr = std::shared_ptr<Segment>;
+
+    std::string segment_path(uint64_t base_id) const;
+    SegmentPtr map_sealed(const std::string& path, uint64_t base_id);
+    SegmentPtr create_active_locked(uint64_t base_id);
+    SegmentPtr recover_active(const std::string& path, uint64_t base_id);
+    void scan_segment(Segment& seg, uint64_t limit);
+    SegmentPtr seal(Segment& active);
+    void seal_pending();
+    void enforce_retention_locked();
+    void write_index_file(const Segment& seg);
+    bool load_index_file(Segment& seg);
+    void commit_loop();
+
+    MessageLogOptions options_;
+    std::mutex log_mutex_;
+    std::vector<SegmentPtr> segments_; // oldest first; the last one is active
+    uint64_t synced_offset_ = 0;       // flushed prefix of the active segment
+    std::vector<SegmentPtr> to_seal_;  // full segments waiting for the commit thread
+
+    std::mutex commit_mutex_;
+    std::condition_variable commit_cv_;
+    std::atomic<bool> stop_commit_{false};
+    std::thread commit_thread_;
+};
@@ -1,31 +1,463 @@
 // message_store.cpp
 #include "message_store.hpp"
+#include "message_log.hpp"
 #include "logger.hpp"
 
-void MessageStore::add_message(const ChatMsg& chat_message) {
-    std::lock_guard<std::mutex> lk(messages_mutex_);
-    message_buffer_.push_back(chat_message);
-    Logger::instance().debug("Message pushed to store", { {"from", chat_message.from}, {"to", chat_message.to}, {"ts", chat_message.ts} });
-    if (message_buffer_.size() > 10000) {
-        message_buffer_.erase(message_buffer_.begin(), message_buffer_.begin() + 1000);
-        Logger::instance().info("Message store trimmed", { {"new_size", static_cast<uint64_t>(message_buffer_.size())} });
+// a search stops after examining this many candidates and returns a cursor to continue from
+static constexpr size_t kSearchScanLimit = 50000;
+// candidates examined per hold of the store lock (about 10 us)
+static constexpr size_t kSearchSliceCandidates = 1024;
+static constexpr size_t kMaxPrefixTokens = 512;
+// text arena chunk; a longer message gets a chunk of its own
+static constexpr size_t kTextChunkBytes = 64 * 1024;
+
+uint32_t NameTable::acquire(std::string_view name) {
+    if (name.empty()) return kEmpty;
+    auto it = ids_.find(name);
+    if (it != ids_.end()) {
+        ++refs_[it->second];
+        return it->second;
+    }
+    uint32_t id;
+    if (!free_.empty()) {
+        id = free_.back();
+        free_.pop_back();
+        names_[id] = std::make_shared<const std::string>(name);
+    } else {
+        id = static_cast<uint32_t>(names_.size());
+        names_.push_back(std::make_shared<const std::string>(name));
+        refs_.push_back(0);
+    }
+    refs_[id] = 1;
+    ids_.emplace(*names_[id], id);
+    return id;
+}
+
+void NameTable::release(uint32_t id) {
+    if (id == kEmpty || --refs_[id] > 0) return;
+    ids_.erase(*names_[id]);
+    names_[id].reset();
+    free_.push_back(id);
+}
+
+uint32_t NameTable::find(std::string_view name) const {
+    if (name.empty()) return kEmpty;
+    auto it = ids_.find(name);
+    return it == ids_.end() ? kMissing : it->second;
+}
+
+MessageStore::MessageStore(size_t capacity, bool search_index) : capacity_(std::max<size_t>(capacity, 1)) {
+    message_buffer_.reserve(capacity_);
+    if (search_index) search_ = std::make_unique<SearchIndex>();
+}
+
+MessageStore::~MessageStore() = default;
+
+void MessageStore::detach_log() {
+    std::unique_ptr<MessageLog> log;
+    {
+        std::lock_guard<std::mutex> lk(messages_mutex_);
+        log = std::move(log_);
     }
+    if (log) log->sync();
 }
 
-std::vector<ChatMsg> MessageStore::get_recent_messages(size_t count) {
+void MessageStore::attach_log(std::unique_ptr<MessageLog> log, size_t disk_scan_limit) {
+    std::vector<ChatMsg> tail = log->read_tail(capacity_);
+    uint64_t last_id = log->last_id();
+    // the ring needs consecutive ids; keep only the contiguous newest run
+    for (size_t i = tail.size(); i-- > 1;) {
+        if (tail[i - 1].id + 1 != tail[i].id) {
+            tail.erase(tail.begin(), tail.begin() + static_cast<std::ptrdiff_t>(i));
+            break;
+        }
+    }
+
     std::lock_guard<std::mutex> lk(messages_mutex_);
-    std::vector<ChatMsg> out;
-    size_t start = (message_buffer_.size() > count) ? (message_buffer_.size() - count) : 0;
-    for (size_t i = start; i < message_buffer_.size(); ++i) out.push_back(message_buffer_[i]);
-    return out;
+    message_buffer_.clear();
+    room_index_.clear();
+    private_index_.clear();
+    names_ = NameTable();
+    chunks_.clear();
+    arena_bytes_ = 0;
+    if (search_) search_ = std::make_unique<SearchIndex>();
+    base_id_ = first_id_ = next_id_ = tail.empty() ? last_id + 1 : tail.front().id;
+    for (const auto& m : tail) insert_locked(m, m.id);
+    next_id_ = last_id + 1;
+    log_ = std::move(log);
+    disk_scan_limit_ = disk_scan_limit;
+    LOG_INFO("Message store warmed from log", { {"loaded", static_cast<uint64_t>(tail.size())}, {"next_id", next_id_} });
 }
 
-std::vector<ChatMsg> MessageStore::get_messages_for_user(const std::string& user, size_t count) {
+uint64_t MessageStore::add_message(const ChatMsg& chat_message) {
     std::lock_guard<std::mutex> lk(messages_mutex_);
+    if (log_ && !log_->fits(chat_message)) {
+        LOG_WARN("Message refused - too large for the message log", { {"from", chat_message.from}, {"bytes", static_cast<uint64_t>(chat_message.text.size())} });
+        return 0;
+    }
+    uint64_t id = next_id_;
+    insert_locked(chat_message, id);
+    if (log_) {
+        ChatMsg logged = chat_message; // the text is shared, not copied
+        logged.id = id;
+        log_->append(logged);
+    }
+    LOG_DEBUG("Message pushed to store", { {"id", id}, {"from", chat_message.from}, {"to", chat_message.to}, {"ts", chat_message.ts} });
+    return id;
+}
+
+std::string_view MessageStore::text_locked(const Record& r) const {
+    if (r.size == 0) return {};
+    return { chunks_[r.chunk - first_chunk_]->bytes.get() + r.offset, r.size };
+}
+
+ChatMsg MessageStore::message_locked(uint64_t id) {
+    const Record& r = slot_locked(id);
+    ChatMsg m;
+    m.from = names_.name(r.from);
+    m.to = names_.name(r.to);
+    m.room = names_.name(r.room);
+    if (r.size > 0) m.text = SharedText(chunks_[r.chunk - first_chunk_], text_locked(r));
+    m.ts = r.ts;
+    m.id = id;
+    return m;
+}
+
+void MessageStore::insert_locked(const ChatMsg& chat_message, uint64_t id) {
+    if (next_id_ - first_id_ == capacity_) evict_oldest_locked();
+    next_id_ = id + 1;
+
+    Record r{};
+    r.ts = chat_message.ts;
+    r.from = names_.acquire(chat_message.from);
+    r.to = names_.acquire(chat_message.to);
+    r.room = r.to == NameTable::kEmpty ? names_.acquire(chat_message.room) : NameTable::kEmpty;
+    const std::string_view text = chat_message.text.view();
+    if (!text.empty()) {
+        if (chunks_.empty() || chunks_.back()->capacity - chunks_.back()->used < text.size()) {
+            auto chunk = std::make_shared<TextChunk>();
+            chunk->capacity = std::max(kTextChunkBytes, text.size());
+            chunk->bytes.reset(new char[chunk->capacity]);
+            chunks_.push_back(std::move(chunk));
+            arena_bytes_ += chunks_.back()->capacity;
+        }
+        TextChunk& chunk = *chunks_.back();
+        // bytes past `used` are not visible to any result yet, so writing them needs no more than the store lock
+        std::copy(text.begin(), text.end(), chunk.bytes.get() + chunk.used);
+        r.chunk = first_chunk_ + static_cast<uint32_t>(chunks_.size() - 1);
+        r.offset = static_cast<uint32_t>(chunk.used);
+        r.size = static_cast<uint32_t>(text.size());
+        chunk.used += text.size();
+        chunk.last_id = id;
+    }
+    if (message_buffer_.size() < capacity_) message_buffer_.push_back(r);
+    else slot_locked(id) = r;
+
+    if (r.to == NameTable::kEmpty) {
+        room_index_[r.room].push_back(id);
+    } else {
+        private_index_[r.from].push_back(id);
+        if (r.to != r.from) private_index_[r.to].push_back(id);
+    }
+    if (search_) search_->add(id, text);
+}
+
+// Drop the oldest message. Indexes are in id order, so its id is at the
+// front of every index that references it.
+void MessageStore::evict_oldest_locked() {
+    const Record& oldest = slot_locked(first_id_);
+    if (oldest.to == NameTable::kEmpty) {
+        auto it = room_index_.find(oldest.room);
+        if (it != room_index_.end()) {
+            it->second.pop_front();
+            if (it->second.empty()) room_index_.erase(it);
+        }
+    } else {
+        for (uint32_t user : { oldest.from, oldest.to }) {
+            auto it = private_index_.find(user);
+            if (it == private_index_.end()) continue;
+            if (!it->second.empty() && it->second.front() == first_id_) it->second.pop_front();
+            if (it->second.empty()) private_index_.erase(it);
+        }
+    }
+    if (search_) search_->remove(first_id_, text_locked(oldest));
+    names_.release(oldest.from);
+    names_.release(oldest.to);
+    names_.release(oldest.room);
+    ++first_id_;
+    // a chunk goes once the ring has moved past its newest text; results still holding it keep it alive
+    while (!chunks_.empty() && chunks_.front()->last_id < first_id_) {
+        arena_bytes_ -= chunks_.front()->capacity;
+        chunks_.pop_front();
+        ++first_chunk_;
+    }
+}
+
+std::vector<const std::deque<uint64_t>*> MessageStore::lists_for_locked(const std::string& user, const std::vector<std::string>& rooms) {
+    std::vector<const std::deque<uint64_t>*> lists;
+    if (!user.empty()) {
+        auto pit = private_index_.find(names_.find(user));
+        if (pit != private_index_.end()) lists.push_back(&pit->second);
+    }
+    for (const auto& room : rooms) {
+        auto rit = room_index_.find(names_.find(room));
+        if (rit != room_index_.end()) lists.push_back(&rit->second);
+    }
+    return lists;
+}
+
+std::vector<ChatMsg> MessageStore::newest_from_locked(const std::vector<const std::deque<uint64_t>*>& lists, size_t count,
+                                                      uint64_t before_id, uint64_t after_id) {
+    std::vector<std::deque<uint64_t>::const_reverse_iterator> cursors;
+    size_t available = 0;
+    for (const auto* list : lists) {
+        cursors.push_back(std::make_reverse_iterator(std::lower_bound(list->begin(), list->end(), before_id)));
+        available += static_cast<size_t>(list->rend() - cursors.back());
+    }
     std::vector<ChatMsg> out;
-    for (auto it = message_buffer_.rbegin(); it != message_buffer_.rend() && out.size() < count; ++it) {
-        if (it->to.empty() || it->to == user || it->from == user) out.push_back(*it);
+    out.reserve(std::min(count, available));
+    while (out.size() < count) {
+        // a user is in a handful of rooms, so a linear pick beats a heap here
+        int best = -1;
+        for (size_t i = 0; i < cursors.size(); ++i) {
+            if (cursors[i] == lists[i]->rend() || *cursors[i] <= after_id) continue;
+            if (best < 0 || *cursors[i] > *cursors[static_cast<size_t>(best)]) best = static_cast<int>(i);
+        }
+        if (best < 0) break;
+        out.push_back(message_locked(*cursors[static_cast<size_t>(best)]++));
     }
     std::reverse(out.begin(), out.end());
     return out;
 }
+
+std::vector<ChatMsg> MessageStore::oldest_from_locked(const std::vector<const std::deque<uint64_t>*>& lists, size_t count,
+                                                      uint64_t before_id, uint64_t after_id) {
+    std::vector<std::deque<uint64_t>::const_iterator> cursors;
+    for (const auto* list : lists) cursors.push_back(std::upper_bound(list->begin(), list->end(), after_id));
+    std::vector<ChatMsg> out;
+    while (out.size() < count) {
+        int best = -1;
+        for (size_t i = 0; i < cursors.size(); ++i) {
+            if (cursors[i] == lists[i]->end() || *cursors[i] >= before_id) continue;
+            if (best < 0 || *cursors[i] < *cursors[static_cast<size_t>(best)]) best = static_cast<int>(i);
+        }
+        if (best < 0) break;
+        out.push_back(message_locked(*cursors[static_cast<size_t>(best)]++));
+    }
+    return out;
+}
+
+std::vector<ChatMsg> MessageStore::get_messages_for_user(const std::string& user, size_t count, const std::vector<std::string>& rooms) {
+    return get_history_page(user, rooms, 0, 0, count).messages;
+}
+
+HistoryPage MessageStore::get_history_page(const std::string& user, const std::vector<std::string>& rooms,
+                                           uint64_t before_id, uint64_t after_id, size_t limit) {
+    HistoryPage page;
+    const uint64_t upper = before_id ? before_id : UINT64_MAX;
+    if (limit == 0 || upper <= after_id + 1) return page;
+    const bool forward = after_id != 0;
+
+    // one match past the page is fetched to tell whether there are more
+    std::unique_lock<std::mutex> lk(messages_mutex_);
+    auto lists = lists_for_locked(user, rooms);
+    std::vector<ChatMsg> ring = forward ? oldest_from_locked(lists, limit + 1, upper, after_id)
+                                        : newest_from_locked(lists, limit + 1, upper, after_id);
+    uint64_t oldest_in_ring = first_id_;
+    lk.unlock();
+
+    // ids below the ring are only in the log; read it without the store lock.
+    // A scan cut short by disk_scan_limit_ still advances the cursor past
+    // what it examined, so paging makes progress through sparse stretches.
+    std::vector<ChatMsg> disk;
+    size_t examined = 0;
+    uint64_t last_examined = 0;
+    bool scanned = false, stopped = false;
+    auto visit = [&](const ChatMsg& m) {
+        if (forward && m.id >= std::min(upper, oldest_in_ring)) return !(stopped = true);
+        ++examined;
+        last_examined = m.id;
+        bool visible = m.to.empty() ? std::find(rooms.begin(), rooms.end(), m.room) != rooms.end()
+                                    : !user.empty() && (m.to == user || m.from == user);
+        if (visible) disk.push_back(m);
+        if ((forward ? disk.size() : disk.size() + ring.size()) > limit) stopped = true;
+        return !stopped;
+    };
+    if (log_ && disk_scan_limit_ > 0 && after_id + 1 < oldest_in_ring && (forward || ring.size() <= limit)) {
+        scanned = true;
+        if (forward) log_->visit_forward(after_id, disk_scan_limit_, visit);
+        else log_->visit_backward(std::min(upper, oldest_in_ring), disk_scan_limit_, visit);
+    }
+    const bool truncated = scanned && !stopped && examined == disk_scan_limit_;
+
+    auto& out = page.messages;
+    if (forward) {
+        out = std::move(disk);
+        if (!truncated) out.insert(out.end(), ring.begin(), ring.end());
+        if (out.size() > limit) {
+            out.resize(limit);
+            page.has_more = true;
+            page.next_cursor = out.back().id;
+        }
+    } else {
+        out.assign(disk.rbegin(), disk.rend());
+        out.insert(out.end(), ring.begin(), ring.end());
+        if (out.size() > limit) {
+            out.erase(out.begin(), out.begin() + static_cast<std::ptrdiff_t>(out.size() - limit));
+            page.has_more = true;
+            page.next_cursor = out.front().id;
+        }
+    }
+    if (truncated && !page.has_more) {
+        page.has_more = true;
+        page.next_cursor = last_examined;
+    }
+    return page;
+}
+
+std::vector<ChatMsg> MessageStore::get_room_messages(const std::string& room, size_t count) {
+    std::lock_guard<std::mutex> lk(messages_mutex_);
+    auto it = room_index_.find(names_.find(room));
+    if (it == room_index_.end()) return {};
+    return newest_from_locked({ &it->second }, count);
+}
+
+uint64_t MessageStore::id_at_time_locked(uint64_t ts) {
+    // ts is taken when the message is stored, so it does not decrease along the ring
+    uint64_t lo = first_id_, hi = next_id_;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (slot_locked(mid).ts < ts) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+SearchPage MessageStore::search(const SearchQuery& query) {
+    SearchPage page;
+    const std::vector<SearchIndex::Term> terms = SearchIndex::parse_query(query.text);
+    if (terms.empty() || query.limit == 0) return page;
+
+    std::vector<ChatMsg> found; // newest first
+    size_t examined = 0;
+    uint64_t last = 0; // newest candidate not examined yet is below this (0: none examined)
+    bool done = false;
+    // The walk runs in slices of kSearchSliceCandidates, each under its own
+    // hold of the store lock, so writers wait microseconds rather than the
+    // length of the whole search. Postings move and tokens come and go
+    // between slices, so each slice looks its lists up again and resumes
+    // below the last id it examined.
+    while (!done) {
+        std::lock_guard<std::mutex> lk(messages_mutex_);
+        if (!search_) return page;
+        // candidate id window [lo, hi) from the cursor, the time range and the progress so far
+        uint64_t lo = first_id_, hi = next_id_;
+        if (query.before_id) hi = std::min(hi, query.before_id);
+        if (last) hi = std::min(hi, last);
+        if (query.since) lo = std::max(lo, id_at_time_locked(query.since));
+        if (query.until) hi = std::min(hi, id_at_time_locked(query.until + 1));
+        if (lo >= hi) break;
+        // visibility and filters compare interned ids; a name the ring has never seen matches nothing
+        const uint32_t user = query.user.empty() ? NameTable::kMissing : names_.find(query.user);
+        std::vector<uint32_t> rooms;
+        for (const auto& room : query.rooms) rooms.push_back(names_.find(room));
+        const uint32_t from = names_.find(query.from), to = names_.find(query.to);
+
+        // every term must match; candidates come from the term with the fewest ids
+        std::vector<std::vector<const SearchIndex::Postings*>> lists(terms.size());
+        size_t driver = 0, driver_ids = SIZE_MAX;
+        for (size_t t = 0; t < terms.size() && driver_ids; ++t) {
+            if (!search_->lookup(terms[t], kMaxPrefixTokens, lists[t])) {
+                if (!last) {
+                    page.too_broad = true;
+                    return page;
+                }
+                // a prefix grew too broad mid-search: hand back a cursor instead
+                page.has_more = true;
+                page.next_cursor = last;
+                done = true;
+                break;
+            }
+            size_t n = 0;
+            for (const auto* p : lists[t]) n += p->size();
+            if (n < driver_ids) {
+                driver = t;
+                driver_ids = n;
+            }
+        }
+        if (done || driver_ids == 0) break;
+        auto contains = [&](size_t t, uint64_t id) {
+            for (const auto* p : lists[t]) {
+                if (std::binary_search(p->begin(), p->end(), id)) return true;
+            }
+            return false;
+        };
+
+        // walk the driver's lists from the newest id down, merging them (a prefix has several)
+        std::vector<const uint64_t*> cursors;
+        for (const auto* p : lists[driver]) cursors.push_back(std::lower_bound(p->begin(), p->end(), hi));
+        size_t slice = 0;
+        uint64_t prev = 0;
+        for (;;) {
+            if (found.size() > query.limit) {
+                done = true;
+                break;
+            }
+            int best = -1;
+            for (size_t i = 0; i < cursors.size(); ++i) {
+                if (cursors[i] == lists[driver][i]->begin() || cursors[i][-1] < lo) continue;
+                if (best < 0 || cursors[i][-1] > cursors[static_cast<size_t>(best)][-1]) best = static_cast<int>(i);
+            }
+            if (best < 0) {
+                done = true;
+                break;
+            }
+            uint64_t id = cursors[static_cast<size_t>(best)][-1];
+            if (id == prev) { // in two of a prefix's lists
+                --cursors[static_cast<size_t>(best)];
+                continue;
+            }
+            if (examined == kSearchScanLimit) {
+                page.has_more = true;
+                page.next_cursor = last;
+                done = true;
+                break;
+            }
+            if (slice++ == kSearchSliceCandidates) break; // let writers in, then resume at id
+            --cursors[static_cast<size_t>(best)];
+            ++examined;
+            prev = last = id;
+
+            bool match = true;
+            for (size_t t = 0; t < terms.size() && match; ++t) match = t == driver || contains(t, id);
+            if (!match) continue;
+            const Record& r = slot_locked(id);
+            bool visible = r.to == NameTable::kEmpty ? std::find(rooms.begin(), rooms.end(), r.room) != rooms.end()
+                                                     : user != NameTable::kMissing && (r.to == user || r.from == user);
+            if (!visible || (!query.from.empty() && r.from != from) || (!query.to.empty() && r.to != to)) continue;
+            found.push_back(message_locked(id));
+        }
+    }
+    if (found.size() > query.limit) {
+        found.pop_back();
+        page.has_more = true;
+        page.next_cursor = found.back().id;
+    }
+    page.messages.assign(found.rbegin(), found.rend());
+    return page;
+}
+
+size_t MessageStore::search_tokens() {
+    std::lock_guard<std::mutex> lk(messages_mutex_);
+    return search_ ? search_->token_count() : 0;
+}
+
+size_t MessageStore::memory_bytes() {
+    std::lock_guard<std::mutex> lk(messages_mutex_);
+    return message_buffer_.capacity() * sizeof(Record) + arena_bytes_ + names_.size() * 64;
+}
+
+size_t MessageStore::size() {
+    std::lock_guard<std::mutex> lk(messages_mutex_);
+    return static_cast<size_t>(next_id_ - first_id_);
+}
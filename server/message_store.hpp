@@ -1,22 +1,198 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
+#include <deque>
+#include <unordered_map>
 #include <mutex>
 #include <algorithm>
+#include <cstdint>
+#include <memory>
+#include "search_index.hpp"
+
+class MessageLog;
+
+// Immutable string with shared ownership. Text returned by the store points
+// into its arena and keeps the chunk alive, and names point at the interned
+// copy in its NameTable, so copying a ChatMsg bumps reference counts
+// instead of copying strings.
+class SharedText {
+public:
+    SharedText() = default;
+    SharedText(std::string text) {
+        if (text.empty()) return;
+        auto owned = std::make_shared<const std::string>(std::move(text));
+        view_ = *owned;
+        owner_ = std::move(owned);
+    }
+    SharedText(const char* text) : SharedText(std::string(text)) {}
+    // a null owner borrows text: for a message only handed to add_message, which copies it
+    SharedText(std::shared_ptr<const void> owner, std::string_view text) : owner_(std::move(owner)), view_(text) {}
+
+    void assign(const char* data, std::size_t size) { *this = SharedText(std::string(data, size)); }
+
+    std::string_view view() const { return view_; }
+    operator std::string_view() const { return view_; }
+    const char* data() const { return view_.data(); }
+    std::size_t size() const { return view_.size(); }
+    bool empty() const { return view_.empty(); }
+    std::string str() const { return std::string(view_); }
+    friend bool operator==(const SharedText& a, std::string_view b) { return a.view_ == b; }
+    friend bool operator!=(const SharedText& a, std::string_view b) { return a.view_ != b; }
+
+private:
+    std::shared_ptr<const void> owner_;
+    std::string_view view_;
+};
 
 struct ChatMsg {
-    std::string from;
-    std::string to; // empty for group
-    std::string text;
+    SharedText from;
+    SharedText to; // empty for group
+    SharedText text;
     uint64_t ts; // epoch ms
+    uint64_t id = 0; // sequence number assigned by MessageStore (monotonic, starts at 1)
+    SharedText room; // room of a group message; empty for private
 };
 
+// One page of history, oldest first.
+struct HistoryPage {
+    std::vector<ChatMsg> messages;
+    bool has_more = false;    // further matches exist beyond the page in the paging direction
+    uint64_t next_cursor = 0; // before/after id that continues in that direction (0 when !has_more)
+};
+
+// Full-text search over the messages in the ring. Results are paged like
+// history: newest matches before before_id, returned oldest first.
+struct SearchQuery {
+    std::string user;               // private messages are visible when sent or received by this user
+    std::vector<std::string> rooms; // group messages are visible in these rooms
+    std::string text;               // see SearchIndex::parse_query
+    std::string from;               // sender, when not empty
+    std::string to;                 // private recipient, when not empty
+    uint64_t since = 0;             // ts range in ms, inclusive; 0 leaves that side open
+    uint64_t until = 0;
+    uint64_t before_id = 0;
+    size_t limit = 20;
+};
+
+struct SearchPage : HistoryPage {
+    bool too_broad = false; // a prefix term matched too many tokens; nothing was searched
+};
+
+// Usernames and room names interned to 32-bit ids, counted by the records
+// that use them; an id is reused once its last record is evicted.
+class NameTable {
+public:
+    static constexpr uint32_t kEmpty = 0;          // the empty name
+    static constexpr uint32_t kMissing = UINT32_MAX; // find(): not stored
+
+    uint32_t acquire(std::string_view name);
+    void release(uint32_t id);
+    uint32_t find(std::string_view name) const;
+    // shares the interned string, which outlives the id if a result still holds it
+    SharedText name(uint32_t id) const {
+        if (!names_[id]) return SharedText();
+        return SharedText(names_[id], *names_[id]);
+    }
+    std::size_t size() const { return ids_.size(); }
+
+private:
+    std::vector<std::shared_ptr<const std::string>> names_{ nullptr }; // ids_ keys point into these
+    std::vector<uint32_t> refs_{ 0 };
+    std::vector<uint32_t> free_;
+    std::unordered_map<std::string_view, uint32_t> ids_;
+};
+
+// Fixed-capacity history. Messages live in a ring buffer (O(1) append and
+// eviction of the oldest) of fixed-size records: names are NameTable ids
+// and the text is appended to arena chunks that are freed in order as the
+// ring wraps past them. Secondary indexes hold the ids of each room's
+// timeline and of each user's private threads so per-user history is O(k)
+// in the number of results instead of a scan of the whole buffer. Results
+// are ChatMsg values whose text shares the arena chunk it was stored in.
+//
+// With a MessageLog attached every message is also appended to disk, the
+// ring is warmed from the log tail at startup and history requests that
+// reach past the ring continue into the log.
 class MessageStore {
 public:
-    void add_message(const ChatMsg& chat_message);
-    std::vector<ChatMsg> get_recent_messages(size_t count = 50);
-    std::vector<ChatMsg> get_messages_for_user(const std::string& user, size_t count = 50);
+    // with search_index the text of every message in the ring is indexed for search()
+    explicit MessageStore(size_t capacity = 10000, bool search_index = false);
+    ~MessageStore();
+
+    // take ownership of an opened log; loads its newest messages into the ring
+    void attach_log(std::unique_ptr<MessageLog> log, size_t disk_scan_limit);
+    // flush and close the log; later messages are kept in memory only (hot restart)
+    void detach_log();
+
+    // stores a copy and returns the id assigned to it, or 0 (and stores
+    // nothing) when the attached log could not persist the message
+    uint64_t add_message(const ChatMsg& chat_message);
+    // newest `count` messages visible to `user`: its private threads plus the given rooms
+    std::vector<ChatMsg> get_messages_for_user(const std::string& user, size_t count, const std::vector<std::string>& rooms);
+    std::vector<ChatMsg> get_room_messages(const std::string& room, size_t count = 50);
+    // Cursor-based page of what `user` can see (private threads, skipped when
+    // `user` is empty, plus `rooms`). Ids are exclusive bounds and 0 means
+    // unbounded: with after_id set the page holds the oldest matches after it,
+    // otherwise the newest matches before before_id.
+    HistoryPage get_history_page(const std::string& user, const std::vector<std::string>& rooms,
+                                 uint64_t before_id, uint64_t after_id, size_t limit);
+
+    // empty when the store was built without a search index
+    SearchPage search(const SearchQuery& query);
+
+    size_t size();
+    size_t search_tokens();
+    // approximate: ring records, text arena and interned names
+    size_t memory_bytes();
+    size_t capacity() const { return capacity_; }
+
 private:
+    // one stored message, 32 bytes
+    struct Record {
+        uint64_t ts;
+        uint32_t from, to, room; // NameTable ids; to is kEmpty for group, room for private
+        uint32_t chunk;          // arena chunk sequence number
+        uint32_t offset, size;   // text within the chunk
+    };
+    // text of consecutive messages; last_id is the newest one written to it
+    struct TextChunk {
+        std::unique_ptr<char[]> bytes;
+        size_t capacity = 0;
+        size_t used = 0;
+        uint64_t last_id = 0;
+    };
+
+    Record& slot_locked(uint64_t id) { return message_buffer_[(id - base_id_) % capacity_]; }
+    std::string_view text_locked(const Record& r) const;
+    ChatMsg message_locked(uint64_t id);
+    void insert_locked(const ChatMsg& chat_message, uint64_t id);
+    void evict_oldest_locked();
+    // first id in the ring with ts >= the given timestamp (next_id_ if none)
+    uint64_t id_at_time_locked(uint64_t ts);
+    std::vector<const std::deque<uint64_t>*> lists_for_locked(const std::string& user, const std::vector<std::string>& rooms);
+    // k-way merge of id lists from the newest end, ids in (after_id, before_id); returns messages oldest first
+    std::vector<ChatMsg> newest_from_locked(const std::vector<const std::deque<uint64_t>*>& lists, size_t count,
+                                            uint64_t before_id = UINT64_MAX, uint64_t after_id = 0);
+    // the same from the oldest end
+    std::vector<ChatMsg> oldest_from_locked(const std::vector<const std::deque<uint64_t>*>& lists, size_t count,
+                                            uint64_t before_id, uint64_t after_id);
+
     std::mutex messages_mutex_;
-    std::vector<ChatMsg> message_buffer_;
+    const size_t capacity_;
+    std::vector<Record> message_buffer_; // ring, grows to capacity_ then wraps
+    uint64_t base_id_ = 1;  // id stored in message_buffer_[0]
+    uint64_t first_id_ = 1; // oldest id still stored
+    uint64_t next_id_ = 1;  // id the next message will get
+    NameTable names_;
+    std::deque<std::shared_ptr<TextChunk>> chunks_; // oldest first; results hold references to them
+    uint32_t first_chunk_ = 0; // sequence number of chunks_.front()
+    size_t arena_bytes_ = 0;
+    std::unordered_map<uint32_t, std::deque<uint64_t>> room_index_; // room -> ids of its messages, oldest first
+    std::unordered_map<uint32_t, std::deque<uint64_t>> private_index_; // user -> ids of private messages sent or received
+
+    std::unique_ptr<SearchIndex> search_; // text of the messages in the ring
+
+    std::unique_ptr<MessageLog> log_;
+    size_t disk_scan_limit_ = 0; // max log records examined per history request
 };
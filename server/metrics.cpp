@@ -0,0 +1,234 @@
+// metrics.cpp
+#include "metrics.hpp"
+#include "wire_codec.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+using json = nlohmann::json;
+
+namespace {
+
+struct CounterInfo {
+    const char* name;
+    const char* help;
+};
+
+const CounterInfo kCounters[] = {
+    { "chat_connections_accepted_total", "Connections accepted" },
+    { "chat_connections_closed_total", "Connections closed" },
+    { "chat_idle_reaped_total", "Connections closed by the idle reaper" },
+    { "chat_slow_consumer_disconnects_total", "Connections closed because their send queue overflowed" },
+    { "chat_send_queue_frames_in_total", "Frames queued for sending" },
+    { "chat_send_queue_frames_written_total", "Queued frames written to a socket" },
+    { "chat_send_queue_frames_dropped_total", "Queued frames dropped by the slow-consumer policy" },
+    { "chat_send_queue_frames_unsent_total", "Frames still queued when their session closed" },
+    { "chat_write_calls_total", "Socket write calls" },
+    { "chat_write_bytes_total", "Bytes written to sockets" },
+    { "chat_compress_input_bytes_total", "Frame bytes compressed for connections that negotiated compression" },
+    { "chat_compress_output_bytes_total", "Compressed size of those frames" },
+    { "chat_rate_limited_frames_total", "Inbound frames rejected by rate limits" },
+    { "chat_rate_limit_disconnects_total", "Connections closed for flooding past the rate limits" },
+    { "chat_pool_buffer_hits_total", "Frame buffers reused from a per-thread pool" },
+    { "chat_pool_buffer_misses_total", "Frame buffers allocated because the pool had none of the size" },
+    { "chat_pool_block_hits_total", "Pooled object blocks reused" },
+    { "chat_pool_block_misses_total", "Pooled object blocks allocated from the heap" },
+    { "chat_cluster_frames_sent_total", "Frames written to other cluster nodes" },
+    { "chat_cluster_frames_received_total", "Frames received from other cluster nodes" },
+    { "chat_cluster_frames_dropped_total", "Frames for other cluster nodes that were not sent" },
+    { "chat_cluster_links_rejected_total", "Cluster links dropped for presenting the wrong secret" },
+    { "chat_cluster_messages_rejected_total", "Forwarded messages dropped because the sender is not logged in on the forwarding node" },
+};
+static_assert(sizeof(kCounters) / sizeof(kCounters[0]) == static_cast<std::size_t>(Counter::kCount), "counter table out of sync");
+
+const CounterInfo kHistograms[] = {
+    { "chat_parse_seconds", "Time to decode one inbound payload" },
+    { "chat_fanout_seconds", "Time to queue one message for the recipients on one shard" },
+    { "chat_send_queue_latency_seconds", "Time from queueing a frame to completing its write" },
+};
+static_assert(sizeof(kHistograms) / sizeof(kHistograms[0]) == static_cast<std::size_t>(Histogram::kCount), "histogram table out of sync");
+
+// Prometheus bucket bounds in seconds; the fine buckets are folded into these
+const double kExportBounds[] = { 1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4,
+                                 1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+
+// index of the highest set bit (value > 0)
+std::size_t highest_bit(uint64_t value) {
+    std::size_t bit = 0;
+    for (std::size_t shift = 32; shift > 0; shift /= 2) {
+        if (value >> shift) { value >>= shift; bit += shift; }
+    }
+    return bit;
+}
+
+std::string format_double(double v) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.9g", v);
+    return buf;
+}
+
+} // namespace
+
+Metrics& Metrics::instance() {
+    static Metrics metrics;
+    return metrics;
+}
+
+Metrics::Slot* Metrics::register_slot() {
+    std::lock_guard<std::mutex> lk(slots_mutex_);
+    slots_.push_back(std::make_unique<Slot>());
+    return slots_.back().get();
+}
+
+std::size_t Metrics::bucket_for(uint64_t value) {
+    constexpr uint64_t sub_count = 1u << kSubBucketBits;
+    if (value < sub_count) return static_cast<std::size_t>(value);
+    std::size_t exponent = highest_bit(value);
+    if (exponent > kMaxExponent) return kHistogramBuckets - 1;
+    std::size_t sub = static_cast<std::size_t>(value >> (exponent - kSubBucketBits)) & (sub_count - 1);
+    std::size_t bucket = (exponent - kSubBucketBits + 1) * sub_count + sub;
+    return std::min(bucket, kHistogramBuckets - 1);
+}
+
+uint64_t Metrics::bucket_upper(std::size_t bucket) {
+    constexpr uint64_t sub_count = 1u << kSubBucketBits;
+    if (bucket < sub_count) return bucket;
+    std::size_t exponent = bucket / sub_count + kSubBucketBits - 1;
+    uint64_t lower = (sub_count + bucket % sub_count) << (exponent - kSubBucketBits);
+    return lower + (uint64_t(1) << (exponent - kSubBucketBits)) - 1;
+}
+
+uint64_t Metrics::HistogramSnapshot::quantile(double q) const {
+    if (count == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count - 1)) + 1, seen = 0;
+    for (std::size_t b = 0; b < kHistogramBuckets; ++b) {
+        seen += buckets[b];
+        if (seen >= rank) return bucket_upper(b);
+    }
+    return bucket_upper(kHistogramBuckets - 1);
+}
+
+void Metrics::add_gauge(const void* owner, std::string name, std::string help, std::function<double()> sample) {
+    std::lock_guard<std::mutex> lk(gauges_mutex_);
+    gauges_.push_back({ owner, std::move(name), std::move(help), std::move(sample) });
+}
+
+void Metrics::remove_gauges(const void* owner) {
+    std::lock_guard<std::mutex> lk(gauges_mutex_);
+    gauges_.erase(std::remove_if(gauges_.begin(), gauges_.end(), [owner](const Gauge& g) { return g.owner == owner; }), gauges_.end());
+}
+
+uint64_t Metrics::sum_counter(Counter counter) {
+    std::lock_guard<std::mutex> lk(slots_mutex_);
+    uint64_t total = 0;
+    for (auto& s : slots_) total += s->counters[static_cast<std::size_t>(counter)].load(std::memory_order_relaxed);
+    return total;
+}
+
+uint64_t Metrics::counter_value(Counter counter) {
+    return sum_counter(counter);
+}
+
+void Metrics::snapshot_histogram(Histogram histogram, HistogramSnapshot& out) {
+    const std::size_t h = static_cast<std::size_t>(histogram);
+    std::lock_guard<std::mutex> lk(slots_mutex_);
+    for (auto& s : slots_) {
+        for (std::size_t b = 0; b < kHistogramBuckets; ++b) out.buckets[b] += s->buckets[h][b].load(std::memory_order_relaxed);
+        out.sum += s->sums[h].load(std::memory_order_relaxed);
+    }
+    for (std::size_t b = 0; b < kHistogramBuckets; ++b) out.count += out.buckets[b];
+}
+
+std::vector<std::pair<std::string, double>> Metrics::sample_gauges(std::vector<std::string>* help) {
+    std::lock_guard<std::mutex> lk(gauges_mutex_);
+    std::vector<std::pair<std::string, double>> out;
+    for (auto& g : gauges_) {
+        out.emplace_back(g.name, g.sample());
+        if (help) help->push_back(g.help);
+    }
+    return out;
+}
+
+std::string Metrics::render_prometheus() {
+    std::ostringstream out;
+    for (std::size_t c = 0; c < static_cast<std::size_t>(Counter::kCount); ++c) {
+        out << "# HELP " << kCounters[c].name << ' ' << kCounters[c].help << '\n'
+            << "# TYPE " << kCounters[c].name << " counter\n"
+            << kCounters[c].name << ' ' << sum_counter(static_cast<Counter>(c)) << '\n';
+    }
+
+    // per message type traffic
+    uint64_t frames[2][kMaxTypeTags] = {}, bytes[2][kMaxTypeTags] = {};
+    {
+        std::lock_guard<std::mutex> lk(slots_mutex_);
+        for (auto& s : slots_) {
+            for (std::size_t d = 0; d < 2; ++d) {
+                for (std::size_t t = 0; t < kMaxTypeTags; ++t) {
+                    frames[d][t] += s->frames[d][t].load(std::memory_order_relaxed);
+                    bytes[d][t] += s->bytes[d][t].load(std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+    const char* directions[2] = { "in", "out" };
+    out << "# HELP chat_frames_total Frames received (in) and written (out) by message type\n# TYPE chat_frames_total counter\n";
+    for (std::size_t d = 0; d < 2; ++d)
+        for (std::size_t t = 0; t < kMaxTypeTags; ++t)
+            if (frames[d][t]) out << "chat_frames_total{direction=\"" << directions[d] << "\",type=\"" << wire_type_name(t) << "\"} " << frames[d][t] << '\n';
+    out << "# HELP chat_frame_bytes_total Frame bytes received (in) and written (out) by message type\n# TYPE chat_frame_bytes_total counter\n";
+    for (std::size_t d = 0; d < 2; ++d)
+        for (std::size_t t = 0; t < kMaxTypeTags; ++t)
+            if (frames[d][t]) out << "chat_frame_bytes_total{direction=\"" << directions[d] << "\",type=\"" << wire_type_name(t) << "\"} " << bytes[d][t] << '\n';
+
+    std::vector<std::string> help;
+    auto gauges = sample_gauges(&help);
+    for (std::size_t i = 0; i < gauges.size(); ++i) {
+        out << "# HELP " << gauges[i].first << ' ' << help[i] << '\n'
+            << "# TYPE " << gauges[i].first << " gauge\n"
+            << gauges[i].first << ' ' << format_double(gauges[i].second) << '\n';
+    }
+
+    for (std::size_t h = 0; h < static_cast<std::size_t>(Histogram::kCount); ++h) {
+        HistogramSnapshot snap;
+        snapshot_histogram(static_cast<Histogram>(h), snap);
+        const char* name = kHistograms[h].name;
+        out << "# HELP " << name << ' ' << kHistograms[h].help << '\n' << "# TYPE " << name << " histogram\n";
+        std::size_t b = 0;
+        uint64_t cumulative = 0;
+        for (double bound : kExportBounds) {
+            const uint64_t bound_ns = static_cast<uint64_t>(bound * 1e9);
+            while (b < kHistogramBuckets && bucket_upper(b) <= bound_ns) cumulative += snap.buckets[b++];
+            out << name << "_bucket{le=\"" << format_double(bound) << "\"} " << cumulative << '\n';
+        }
+        out << name << "_bucket{le=\"+Inf\"} " << snap.count << '\n'
+            << name << "_sum " << format_double(static_cast<double>(snap.sum) / 1e9) << '\n'
+            << name << "_count " << snap.count << '\n';
+    }
+    return out.str();
+}
+
+json Metrics::to_json() {
+    json j;
+    j["counters"] = json::object();
+    for (std::size_t c = 0; c < static_cast<std::size_t>(Counter::kCount); ++c)
+        j["counters"][kCounters[c].name] = sum_counter(static_cast<Counter>(c));
+
+    j["gauges"] = json::object();
+    for (auto& g : sample_gauges(nullptr)) j["gauges"][g.first] = g.second;
+
+    j["histograms"] = json::object();
+    for (std::size_t h = 0; h < static_cast<std::size_t>(Histogram::kCount); ++h) {
+        HistogramSnapshot snap;
+        snapshot_histogram(static_cast<Histogram>(h), snap);
+        j["histograms"][kHistograms[h].name] = {
+            {"count", snap.count},
+            {"mean_us", snap.count ? static_cast<double>(snap.sum) / snap.count / 1e3 : 0.0},
+            {"p50_us", snap.quantile(0.5) / 1e3},
+            {"p90_us", snap.quantile(0.9) / 1e3},
+            {"p99_us", snap.quantile(0.99) / 1e3},
+            {"p999_us", snap.quantile(0.999) / 1e3},
+            {"max_us", snap.quantile(1.0) / 1e3},
+        };
+    }
+    return j;
+}
@@ -0,0 +1,130 @@
+// metrics.hpp
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+enum class Counter : std::size_t {
+    ConnectionsAccepted,
+    ConnectionsClosed,
+    IdleReaped,
+    SlowConsumerDisconnects,
+    FramesQueued,   // entered a session's send queue
+    FramesWritten,  // left it through a completed write
+    FramesDropped,  // left it through the slow-consumer policy
+    FramesUnsent,   // still queued when the session went away
+    WriteCalls,
+    BytesWritten,
+    CompressInBytes,  // frame bytes handed to per-connection compression
+    CompressOutBytes, // what they compressed to
+    FramesRateLimited,     // inbound frames rejected by a session or user token bucket
+    RateLimitDisconnects,  // sessions closed for continuing past rate_strikes rejections
+    BufferPoolHits,        // frame buffers reused from a thread's pool
+    BufferPoolMisses,
+    BlockPoolHits,         // sessions and frame owners placed in a pooled block
+    BlockPoolMisses,
+    ClusterFramesSent,
+    ClusterFramesReceived,
+    ClusterFramesDropped, // no link to the node, link queue full, or unsent when a link went down
+    ClusterLinksRejected, // wrong secret in node_hello
+    ClusterMessagesRejected, // chat a node forwarded for a user it does not have
+    kCount
+};
+
+enum class Histogram : std::size_t {
+    Parse,        // decoding one inbound payload
+    Fanout,       // queueing one message to the recipients on one shard
+    QueueToWrite, // frame enqueued -> its write completed
+    kCount
+};
+
+enum class FrameDirection : std::size_t { In, Out };
+
+// In-process metrics registry.
+//
+// Hot paths record into a slot owned by the calling thread (relaxed
+// load + store, no read-modify-write, no shared cache lines); readers sum
+// the slots of every thread that ever recorded. Histograms are log-linear
+// over nanoseconds, HDR style: 8 sub-buckets per power of two, so any
+// reported value is within ~12% of the true one. Gauges are callbacks
+// sampled at read time.
+class Metrics {
+public:
+    static constexpr std::size_t kMaxTypeTags = 64;      // see wire_type_tag
+    static constexpr std::size_t kSubBucketBits = 3;
+    static constexpr std::size_t kMaxExponent = 40;      // ~18 minutes in ns; larger values clamp
+    static constexpr std::size_t kHistogramBuckets = (kMaxExponent - 1) * (1u << kSubBucketBits);
+
+    static Metrics& instance();
+
+    void inc(Counter counter, uint64_t n = 1) { bump(slot().counters[static_cast<std::size_t>(counter)], n); }
+    void count_frames(FrameDirection dir, std::size_t type_tag, uint64_t frames, uint64_t bytes) {
+        Slot& s = slot();
+        std::size_t d = static_cast<std::size_t>(dir), t = type_tag < kMaxTypeTags ? type_tag : 0;
+        bump(s.frames[d][t], frames);
+        bump(s.bytes[d][t], bytes);
+    }
+    void observe(Histogram histogram, uint64_t nanos) {
+        Slot& s = slot();
+        std::size_t h = static_cast<std::size_t>(histogram);
+        bump(s.buckets[h][bucket_for(nanos)], 1);
+        bump(s.sums[h], nanos);
+    }
+
+    // gauges are registered by an owner and removed with it
+    void add_gauge(const void* owner, std::string name, std::string help, std::function<double()> sample);
+    void remove_gauges(const void* owner);
+
+    uint64_t counter_value(Counter counter);
+    std::string render_prometheus();
+    nlohmann::json to_json();
+
+    static std::size_t bucket_for(uint64_t value);
+    static uint64_t bucket_upper(std::size_t bucket); // largest value that lands in `bucket`
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> counters[static_cast<std::size_t>(Counter::kCount)] = {};
+        std::atomic<uint64_t> frames[2][kMaxTypeTags] = {};
+        std::atomic<uint64_t> bytes[2][kMaxTypeTags] = {};
+        std::atomic<uint64_t> buckets[static_cast<std::size_t>(Histogram::kCount)][kHistogramBuckets] = {};
+        std::atomic<uint64_t> sums[static_cast<std::size_t>(Histogram::kCount)] = {};
+    };
+    struct Gauge {
+        const void* owner;
+        std::string name;
+        std::string help;
+        std::function<double()> sample;
+    };
+    struct HistogramSnapshot {
+        uint64_t buckets[kHistogramBuckets] = {};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t quantile(double q) const;
+    };
+
+    Metrics() = default;
+    // single writer per slot, so a plain load + store is enough
+    static void bump(std::atomic<uint64_t>& cell, uint64_t n) {
+        cell.store(cell.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    Slot& slot() {
+        thread_local Slot* s = register_slot();
+        return *s;
+    }
+    Slot* register_slot();
+    uint64_t sum_counter(Counter counter);
+    void snapshot_histogram(Histogram histogram, HistogramSnapshot& out);
+    std::vector<std::pair<std::string, double>> sample_gauges(std::vector<std::string>* help);
+
+    std::mutex slots_mutex_; // guards slots_ (the slots themselves are never freed)
+    std::vector<std::unique_ptr<Slot>> slots_;
+    std::mutex gauges_mutex_;
+    std::vector<Gauge> gauges_;
+};
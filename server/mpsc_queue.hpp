@@ -0,0 +1,78 @@
+// mpsc_queue.hpp
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Bounded lock-free queue for many producers and a single consumer
+// (Vyukov's bounded queue; capacity is rounded up to a power of two).
+// try_push fails instead of blocking when the queue is full.
+template <typename T>
+class BoundedMpscQueue {
+public:
+    explicit BoundedMpscQueue(std::size_t capacity) {
+        std::size_t cap = 2;
+        while (cap < capacity) cap <<= 1;
+        mask_ = cap - 1;
+        slots_.reset(new Slot[cap]);
+        for (std::size_t i = 0; i < cap; ++i) slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool try_push(T&& value) {
+        std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = slots_[pos & mask_];
+            std::size_t seq = slot.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.value = std::move(value);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // consumer thread only
+    bool try_pop(T& out) {
+        Slot& slot = slots_[dequeue_pos_ & mask_];
+        std::size_t seq = slot.sequence.load(std::memory_order_acquire);
+        if (static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(dequeue_pos_ + 1) < 0) return false;
+        out = std::move(slot.value);
+        slot.sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+        ++dequeue_pos_;
+        return true;
+    }
+
+    // true if a slot is free right now (a hint: another producer may take it first)
+    bool can_push() const {
+        std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        std::size_t seq = slots_[pos & mask_].sequence.load(std::memory_order_acquire);
+        return static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos) >= 0;
+    }
+
+    // consumer thread only: true if try_pop would succeed
+    bool can_pop() const {
+        std::size_t seq = slots_[dequeue_pos_ & mask_].sequence.load(std::memory_order_acquire);
+        return static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(dequeue_pos_ + 1) >= 0;
+    }
+
+    std::size_t capacity() const { return mask_ + 1; }
+
+private:
+    struct Slot {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    std::size_t mask_ = 0;
+    alignas(64) std::atomic<std::size_t> enqueue_pos_{0};
+    alignas(64) std::size_t dequeue_pos_ = 0;
+};
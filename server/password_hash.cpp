@@ -0,0 +1,186 @@
+// password_hash.cpp
+#include "password_hash.hpp"
+#include <array>
+#include <vector>
+#include <random>
+#include <cstring>
+
+namespace {
+
+// Minimal SHA-256 (FIPS 180-4), enough for HMAC/PBKDF2 without pulling in a crypto library
+struct Sha256 {
+    std::array<uint32_t, 8> h;
+    uint8_t block[64];
+    std::size_t block_len = 0;
+    uint64_t total_len = 0;
+
+    Sha256() { reset(); }
+
+    void reset() {
+        h = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+        block_len = 0;
+        total_len = 0;
+    }
+
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void compress(const uint8_t* p) {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i)
+            w[i] = (uint32_t(p[4 * i]) << 24) | (uint32_t(p[4 * i + 1]) << 16) | (uint32_t(p[4 * i + 2]) << 8) | uint32_t(p[4 * i + 3]);
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            hh = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+    }
+
+    void update(const uint8_t* p, std::size_t n) {
+        total_len += n;
+        while (n > 0) {
+            std::size_t take = std::min(n, sizeof(block) - block_len);
+            std::memcpy(block + block_len, p, take);
+            block_len += take;
+            p += take;
+            n -= take;
+            if (block_len == sizeof(block)) {
+                compress(block);
+                block_len = 0;
+            }
+        }
+    }
+
+    void finish(uint8_t out[32]) {
+        uint64_t bits = total_len * 8;
+        uint8_t pad = 0x80;
+        update(&pad, 1);
+        uint8_t zero = 0;
+        while (block_len != 56) update(&zero, 1);
+        uint8_t len_be[8];
+        for (int i = 0; i < 8; ++i) len_be[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+        update(len_be, 8);
+        for (int i = 0; i < 8; ++i) {
+            out[4 * i] = static_cast<uint8_t>(h[i] >> 24);
+            out[4 * i + 1] = static_cast<uint8_t>(h[i] >> 16);
+            out[4 * i + 2] = static_cast<uint8_t>(h[i] >> 8);
+            out[4 * i + 3] = static_cast<uint8_t>(h[i]);
+        }
+    }
+};
+
+// HMAC-SHA256 with the keyed inner/outer states precomputed once per password
+struct HmacSha256 {
+    Sha256 inner_base, outer_base;
+
+    explicit HmacSha256(const std::string& key) {
+        uint8_t k[64] = {};
+        if (key.size() > 64) {
+            Sha256 kh;
+            kh.update(reinterpret_cast<const uint8_t*>(key.data()), key.size());
+            kh.finish(k);
+        } else {
+            std::memcpy(k, key.data(), key.size());
+        }
+        uint8_t ipad[64], opad[64];
+        for (int i = 0; i < 64; ++i) { ipad[i] = k[i] ^ 0x36; opad[i] = k[i] ^ 0x5c; }
+        inner_base.update(ipad, 64);
+        outer_base.update(opad, 64);
+    }
+
+    void mac(const uint8_t* msg, std::size_t n, uint8_t out[32]) const {
+        Sha256 inner = inner_base;
+        inner.update(msg, n);
+        uint8_t ih[32];
+        inner.finish(ih);
+        Sha256 outer = outer_base;
+        outer.update(ih, 32);
+        outer.finish(out);
+    }
+};
+
+std::array<uint8_t, 32> pbkdf2_sha256(const std::string& password, const std::vector<uint8_t>& salt, uint32_t iterations) {
+    HmacSha256 hmac(password);
+    std::vector<uint8_t> first(salt);
+    first.insert(first.end(), { 0, 0, 0, 1 }); // block index 1 (one 32-byte block is all we need)
+    uint8_t u[32];
+    hmac.mac(first.data(), first.size(), u);
+    std::array<uint8_t, 32> t;
+    std::memcpy(t.data(), u, 32);
+    for (uint32_t i = 1; i < iterations; ++i) {
+        hmac.mac(u, 32, u);
+        for (int j = 0; j < 32; ++j) t[j] ^= u[j];
+    }
+    return t;
+}
+
+std::string to_hex(const uint8_t* p, std::size_t n) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(n * 2);
+    for (std::size_t i = 0; i < n; ++i) {
+        out.push_back(digits[p[i] >> 4]);
+        out.push_back(digits[p[i] & 0xF]);
+    }
+    return out;
+}
+
+bool from_hex(const std::string& s, std::vector<uint8_t>& out) {
+    if (s.size() % 2) return false;
+    out.clear();
+    for (std::size_t i = 0; i < s.size(); i += 2) {
+        int v = 0;
+        for (int j = 0; j < 2; ++j) {
+            char c = s[i + j];
+            v <<= 4;
+            if (c >= '0' && c <= '9') v |= c - '0';
+            else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+            else return false;
+        }
+        out.push_back(static_cast<uint8_t>(v));
+    }
+    return true;
+}
+
+} // namespace
+
+std::string hash_password(const std::string& password, uint32_t iterations) {
+    static thread_local std::mt19937_64 rng(std::random_device{}());
+    std::vector<uint8_t> salt(16);
+    for (auto& b : salt) b = static_cast<uint8_t>(rng());
+    auto dk = pbkdf2_sha256(password, salt, iterations);
+    return "pbkdf2-sha256$" + std::to_string(iterations) + "$" + to_hex(salt.data(), salt.size()) + "$" + to_hex(dk.data(), dk.size());
+}
+
+bool verify_password(const std::string& password, const std::string& credential) {
+    // pbkdf2-sha256$<iterations>$<salt>$<hash>
+    std::size_t p1 = credential.find('$');
+    std::size_t p2 = p1 == std::string::npos ? p1 : credential.find('$', p1 + 1);
+    std::size_t p3 = p2 == std::string::npos ? p2 : credential.find('$', p2 + 1);
+    if (p3 == std::string::npos || credential.compare(0, p1, "pbkdf2-sha256") != 0) return false;
+    uint32_t iterations = 0;
+    try { iterations = static_cast<uint32_t>(std::stoul(credential.substr(p1 + 1, p2 - p1 - 1))); } catch (...) { return false; }
+    std::vector<uint8_t> salt, expected;
+    if (iterations == 0 || !from_hex(credential.substr(p2 + 1, p3 - p2 - 1), salt) || !from_hex(credential.substr(p3 + 1), expected) || expected.size() != 32) return false;
+    auto dk = pbkdf2_sha256(password, salt, iterations);
+    // constant-time comparison
+    uint8_t diff = 0;
+    for (int i = 0; i < 32; ++i) diff |= static_cast<uint8_t>(dk[i] ^ expected[i]);
+    return diff == 0;
+}
@@ -0,0 +1,10 @@
+// password_hash.hpp
+#pragma once
+#include <string>
+#include <cstdint>
+
+// Salted PBKDF2-HMAC-SHA256 credentials, stored as
+//   pbkdf2-sha256$<iterations>$<salt hex>$<hash hex>
+// Deliberately CPU-expensive: call from a worker thread, not an io thread.
+std::string hash_password(const std::string& password, uint32_t iterations);
+bool verify_password(const std::string& password, const std::string& credential);
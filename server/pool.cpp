@@ -0,0 +1,159 @@
+// pool.cpp
+#include "pool.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+namespace {
+
+constexpr std::size_t kMinBufferShift = 7;   // 128 B
+constexpr std::size_t kMaxBufferShift = 16;  // 64 KiB
+constexpr std::size_t kBufferClasses = kMaxBufferShift - kMinBufferShift + 1;
+constexpr std::size_t kBlockGranule = 64;
+constexpr std::size_t kMaxBlockBytes = 4096;
+constexpr std::size_t kBlockClasses = kMaxBlockBytes / kBlockGranule;
+constexpr std::size_t kClassBudgetBytes = 512 * 1024; // cached per class and thread
+
+std::size_t ceil_shift(std::size_t bytes) {
+    std::size_t shift = kMinBufferShift;
+    while ((std::size_t{1} << shift) < bytes) ++shift;
+    return shift;
+}
+
+std::size_t floor_shift(std::size_t bytes) {
+    std::size_t shift = 0;
+    while ((bytes >> (shift + 1)) != 0) ++shift;
+    return shift;
+}
+
+struct ThreadCache;
+std::mutex caches_mutex;
+std::vector<ThreadCache*> caches; // live caches, for the gauge
+
+struct ThreadCache {
+    std::vector<std::vector<uint8_t>> buffers[kBufferClasses];
+    std::vector<void*> blocks[kBlockClasses];
+    std::size_t buffer_bytes[kBufferClasses] = {};
+    std::atomic<uint64_t> cached_bytes{0}; // written by the owner only
+
+    ThreadCache() {
+        std::lock_guard<std::mutex> lk(caches_mutex);
+        caches.push_back(this);
+    }
+    ~ThreadCache();
+
+    void account(int64_t delta) {
+        cached_bytes.store(cached_bytes.load(std::memory_order_relaxed) + static_cast<uint64_t>(delta), std::memory_order_relaxed);
+    }
+};
+
+thread_local ThreadCache* tl_cache = nullptr;
+thread_local bool tl_cache_gone = false;
+
+ThreadCache::~ThreadCache() {
+    {
+        std::lock_guard<std::mutex> lk(caches_mutex);
+        caches.erase(std::remove(caches.begin(), caches.end(), this), caches.end());
+    }
+    for (auto& list : blocks) {
+        for (void* block : list) ::operator delete(block);
+    }
+    tl_cache = nullptr;
+    tl_cache_gone = true; // frames freed during the rest of thread exit go straight to the heap
+}
+
+ThreadCache* cache() {
+    if (tl_cache) return tl_cache;
+    if (tl_cache_gone) return nullptr;
+    thread_local ThreadCache instance;
+    tl_cache = &instance;
+    return tl_cache;
+}
+
+// owner of a shared frame's storage; gives it back when the last reference goes
+struct PooledFrame {
+    std::vector<uint8_t> bytes;
+    ~PooledFrame() { recycle_frame_buffer(std::move(bytes)); }
+};
+
+} // namespace
+
+std::vector<uint8_t> take_frame_buffer(std::size_t bytes) {
+    std::vector<uint8_t> buffer;
+    if (bytes > (std::size_t{1} << kMaxBufferShift)) {
+        buffer.reserve(bytes);
+        return buffer;
+    }
+    const std::size_t shift = ceil_shift(bytes);
+    ThreadCache* c = cache();
+    if (c) {
+        auto& list = c->buffers[shift - kMinBufferShift];
+        if (!list.empty()) {
+            buffer = std::move(list.back());
+            list.pop_back();
+            c->buffer_bytes[shift - kMinBufferShift] -= buffer.capacity();
+            c->account(-static_cast<int64_t>(buffer.capacity()));
+            Metrics::instance().inc(Counter::BufferPoolHits);
+            return buffer;
+        }
+    }
+    Metrics::instance().inc(Counter::BufferPoolMisses);
+    buffer.reserve(std::size_t{1} << shift);
+    return buffer;
+}
+
+void recycle_frame_buffer(std::vector<uint8_t> buffer) {
+    const std::size_t capacity = buffer.capacity();
+    if (capacity < (std::size_t{1} << kMinBufferShift)) return;
+    const std::size_t shift = std::min(floor_shift(capacity), kMaxBufferShift);
+    if (capacity > (std::size_t{2} << kMaxBufferShift)) return; // one-off giant frame: free it
+    ThreadCache* c = cache();
+    if (!c) return;
+    const std::size_t index = shift - kMinBufferShift;
+    if (c->buffer_bytes[index] + capacity > kClassBudgetBytes) return;
+    buffer.clear();
+    c->buffer_bytes[index] += capacity;
+    c->account(static_cast<int64_t>(capacity));
+    c->buffers[index].push_back(std::move(buffer));
+}
+
+std::shared_ptr<const std::vector<uint8_t>> share_frame(std::vector<uint8_t> bytes) {
+    auto owner = std::allocate_shared<PooledFrame>(PoolAllocator<PooledFrame>());
+    owner->bytes = std::move(bytes);
+    return std::shared_ptr<const std::vector<uint8_t>>(owner, &owner->bytes);
+}
+
+void* take_pool_block(std::size_t bytes) {
+    const std::size_t index = (bytes + kBlockGranule - 1) / kBlockGranule - 1;
+    if (index >= kBlockClasses) return ::operator new(bytes);
+    ThreadCache* c = cache();
+    if (c && !c->blocks[index].empty()) {
+        void* block = c->blocks[index].back();
+        c->blocks[index].pop_back();
+        c->account(-static_cast<int64_t>((index + 1) * kBlockGranule));
+        Metrics::instance().inc(Counter::BlockPoolHits);
+        return block;
+    }
+    Metrics::instance().inc(Counter::BlockPoolMisses);
+    return ::operator new((index + 1) * kBlockGranule);
+}
+
+void give_pool_block(void* block, std::size_t bytes) {
+    const std::size_t index = (bytes + kBlockGranule - 1) / kBlockGranule - 1;
+    const std::size_t class_bytes = (index + 1) * kBlockGranule;
+    ThreadCache* c = index < kBlockClasses ? cache() : nullptr;
+    if (!c || (c->blocks[index].size() + 1) * class_bytes > kClassBudgetBytes) {
+        ::operator delete(block);
+        return;
+    }
+    c->blocks[index].push_back(block);
+    c->account(static_cast<int64_t>(class_bytes));
+}
+
+uint64_t pool_cached_bytes() {
+    std::lock_guard<std::mutex> lk(caches_mutex);
+    uint64_t total = 0;
+    for (const ThreadCache* c : caches) total += c->cached_bytes.load(std::memory_order_relaxed);
+    return total;
+}
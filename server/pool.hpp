@@ -0,0 +1,54 @@
+// pool.hpp
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+// Per-thread recycling for the allocations every message makes.
+//
+// Frame buffers come in power-of-two size classes from 128 B to 64 KiB;
+// a buffer taken from class k has at least 2^k bytes of capacity and is
+// returned to the class its capacity falls in. Blocks are fixed-size
+// objects (sessions, frame owners, shared_ptr control blocks) in 64-byte
+// classes up to 4 KiB. Both caches belong to the calling thread, so taking
+// and returning never lock; memory freed on another thread than the one
+// that allocated it simply joins that thread's cache. Each class holds a
+// bounded number of bytes and anything beyond goes back to the heap, as do
+// larger requests. Hits and misses are counted in Metrics.
+
+// an empty buffer with capacity for at least `bytes`
+std::vector<uint8_t> take_frame_buffer(std::size_t bytes);
+// hand a buffer's storage back to the calling thread's cache
+void recycle_frame_buffer(std::vector<uint8_t> buffer);
+// an immutable shared frame whose owner comes from the block pool and whose
+// storage is recycled when the last reference goes
+std::shared_ptr<const std::vector<uint8_t>> share_frame(std::vector<uint8_t> bytes);
+
+void* take_pool_block(std::size_t bytes);
+void give_pool_block(void* block, std::size_t bytes);
+
+// bytes held by the caches of every thread (the chat_pool_cached_bytes gauge)
+uint64_t pool_cached_bytes();
+
+// Allocator for allocate_shared: single objects come from the block pool.
+template <typename T>
+struct PoolAllocator {
+    using value_type = T;
+    static constexpr bool kPooled = alignof(T) <= alignof(std::max_align_t);
+
+    PoolAllocator() = default;
+    template <typename U> PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(std::size_t n) {
+        if (kPooled && n == 1) return static_cast<T*>(take_pool_block(sizeof(T)));
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* p, std::size_t n) {
+        if (kPooled && n == 1) give_pool_block(p, sizeof(T));
+        else ::operator delete(p);
+    }
+    template <typename U> bool operator==(const PoolAllocator<U>&) const { return true; }
+    template <typename U> bool operator!=(const PoolAllocator<U>&) const { return false; }
+};
@@ -2,7 +2,17 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <memory>
 #include <boost/asio.hpp>
+#include "pool.hpp"
+
+// An encoded frame (header + payload). Frames are immutable once built so a
+// single instance can be queued to many sessions; fan-out only bumps the refcount.
+using SharedFrame = std::shared_ptr<const std::vector<uint8_t>>;
+
+// High bit of the length prefix: the payload is a deflate block of the
+// connection's compression stream (only after "hello" negotiated it).
+constexpr uint32_t kCompressedFrameFlag = 0x80000000u;
 
 // Helpers to encode/decode 4-byte big-endian length prefix
 inline std::vector<uint8_t> make_frame(const std::string& payload) {
@@ -16,10 +26,27 @@ inline std::vector<uint8_t> make_frame(const std::string& payload) {
     return out;
 }
 
+// same bytes as make_frame, in a pooled buffer that is recycled with the frame
+inline SharedFrame make_shared_frame(const std::string& payload) {
+    const uint32_t len = static_cast<uint32_t>(payload.size());
+    std::vector<uint8_t> out = take_frame_buffer(4 + payload.size());
+    out.push_back(static_cast<uint8_t>((len >> 24) & 0xFF));
+    out.push_back(static_cast<uint8_t>((len >> 16) & 0xFF));
+    out.push_back(static_cast<uint8_t>((len >> 8) & 0xFF));
+    out.push_back(static_cast<uint8_t>((len) & 0xFF));
+    out.insert(out.end(), payload.begin(), payload.end());
+    return share_frame(std::move(out));
+}
+
+// caller guarantees at least 4 readable bytes at p
+inline uint32_t parse_length(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) |
+           (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) |
+           (static_cast<uint32_t>(p[3]));
+}
+
 inline uint32_t parse_length(const std::vector<uint8_t>& buf) {
     if (buf.size() < 4) return 0;
-    return (static_cast<uint32_t>(buf[0]) << 24) |
-           (static_cast<uint32_t>(buf[1]) << 16) |
-           (static_cast<uint32_t>(buf[2]) << 8) |
-           (static_cast<uint32_t>(buf[3]));
+    return parse_length(buf.data());
 }
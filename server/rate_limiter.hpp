@@ -0,0 +1,75 @@
+// rate_limiter.hpp
+#pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Inbound frame types that are rate limited, each with its own buckets
+enum class RateClass : std::size_t {
+    Message,   // room messages (each one fans out to the room)
+    Private,
+    History,   // history and search
+    Directory, // list_users, list_rooms, join, leave, stats
+    kCount
+};
+constexpr std::size_t kRateClassCount = static_cast<std::size_t>(RateClass::kCount);
+
+// kCount for frame types that are not limited
+inline RateClass rate_class_of(const std::string& type) {
+    if (type == "message") return RateClass::Message;
+    if (type == "private") return RateClass::Private;
+    if (type == "history" || type == "search") return RateClass::History;
+    if (type == "list_users" || type == "list_rooms" || type == "join" || type == "leave" || type == "stats") return RateClass::Directory;
+    return RateClass::kCount;
+}
+
+inline const char* rate_class_name(RateClass cls) {
+    static const char* const names[] = { "message", "private", "history", "list" };
+    return cls < RateClass::kCount ? names[static_cast<std::size_t>(cls)] : "other";
+}
+
+struct RateLimit {
+    double per_second = 0; // sustained rate; 0 disables the limit
+    double burst = 1;      // bucket size: frames accepted back to back
+};
+
+// Token bucket that starts full and refills lazily on take(). Not
+// synchronised; a session's buckets are only touched on its strand.
+class TokenBucket {
+public:
+    bool take(std::chrono::steady_clock::time_point now, const RateLimit& limit) {
+        if (limit.per_second <= 0) return true;
+        if (!primed_) {
+            tokens_ = limit.burst;
+            primed_ = true;
+        } else if (now > last_) {
+            tokens_ = std::min(limit.burst, tokens_ + std::chrono::duration<double>(now - last_).count() * limit.per_second);
+        }
+        last_ = std::max(last_, now);
+        if (tokens_ < 1.0) return false;
+        tokens_ -= 1.0;
+        return true;
+    }
+
+    // until the next token, after a failed take()
+    uint64_t retry_ms(const RateLimit& limit) const {
+        if (limit.per_second <= 0 || tokens_ >= 1.0) return 0;
+        return static_cast<uint64_t>(std::ceil((1.0 - tokens_) * 1000.0 / limit.per_second));
+    }
+
+private:
+    double tokens_ = 0;
+    std::chrono::steady_clock::time_point last_{};
+    bool primed_ = false;
+};
+
+// Buckets shared by every session of one user (see Server::user_rate_state)
+struct UserRateState {
+    std::mutex mutex;
+    std::array<TokenBucket, kRateClassCount> buckets;
+};
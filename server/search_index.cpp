@@ -0,0 +1,96 @@
+// search_index.cpp
+#include "search_index.hpp"
+#include <algorithm>
+
+void SearchIndex::tokenize(std::string_view text, std::vector<std::string>& out) {
+    std::string word;
+    auto flush = [&]() {
+        if (!word.empty()) out.push_back(std::move(word));
+        word.clear();
+    };
+    for (std::size_t i = 0; i < text.size();) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c < 0x80) {
+            if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')) {
+                if (word.size() < kMaxTokenBytes) word.push_back(static_cast<char>(c));
+            } else if (c >= 'A' && c <= 'Z') {
+                if (word.size() < kMaxTokenBytes) word.push_back(static_cast<char>(c - 'A' + 'a'));
+            } else {
+                flush();
+            }
+            ++i;
+            continue;
+        }
+        // one UTF-8 sequence; stray continuation bytes count as one byte
+        flush();
+        std::size_t len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        len = std::min(len, text.size() - i);
+        out.emplace_back(text.substr(i, len));
+        i += len;
+    }
+    flush();
+}
+
+std::vector<SearchIndex::Term> SearchIndex::parse_query(const std::string& query) {
+    std::vector<Term> terms;
+    std::vector<std::string> tokens;
+    std::size_t i = 0;
+    while (i < query.size()) {
+        std::size_t end = query.find_first_of(" \t\r\n", i);
+        if (end == std::string::npos) end = query.size();
+        std::string word = query.substr(i, end - i);
+        i = end + 1;
+        const bool prefix = !word.empty() && word.back() == '*';
+        tokens.clear();
+        tokenize(word, tokens);
+        for (std::size_t t = 0; t < tokens.size(); ++t) {
+            Term term{ std::move(tokens[t]), prefix && t + 1 == tokens.size() };
+            if (term.prefix && term.token.size() < kMinPrefixBytes) term.prefix = false;
+            terms.push_back(std::move(term));
+        }
+    }
+    return terms;
+}
+
+void SearchIndex::unique_tokens(std::string_view text) {
+    scratch_.clear();
+    tokenize(text, scratch_);
+    std::sort(scratch_.begin(), scratch_.end());
+    scratch_.erase(std::unique(scratch_.begin(), scratch_.end()), scratch_.end());
+}
+
+void SearchIndex::add(uint64_t id, std::string_view text) {
+    unique_tokens(text);
+    for (auto& token : scratch_) postings_[std::move(token)].ids.push_back(id);
+}
+
+void SearchIndex::remove(uint64_t id, std::string_view text) {
+    unique_tokens(text);
+    for (const auto& token : scratch_) {
+        auto it = postings_.find(token);
+        if (it == postings_.end()) continue;
+        Postings& p = it->second;
+        if (p.size() > 0 && *p.begin() == id) ++p.head;
+        if (p.size() == 0) {
+            postings_.erase(it);
+        } else if (p.head >= 64 && p.head * 2 >= p.ids.size()) {
+            // compact once evicted ids make up half the list
+            p.ids.erase(p.ids.begin(), p.ids.begin() + static_cast<std::ptrdiff_t>(p.head));
+            p.head = 0;
+        }
+    }
+}
+
+bool SearchIndex::lookup(const Term& term, std::size_t max_lists, std::vector<const Postings*>& out) const {
+    if (!term.prefix) {
+        auto it = postings_.find(term.token);
+        if (it != postings_.end()) out.push_back(&it->second);
+        return true;
+    }
+    for (auto it = postings_.lower_bound(term.token);
+         it != postings_.end() && it->first.compare(0, term.token.size(), term.token) == 0; ++it) {
+        if (out.size() == max_lists) return false;
+        out.push_back(&it->second);
+    }
+    return true;
+}
@@ -0,0 +1,55 @@
+// search_index.hpp
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Inverted index over message text: token -> ids of the messages that
+// contain it, ascending. Words are runs of ASCII letters and digits,
+// lowercased, and other ASCII characters separate them; every non-ASCII
+// character is a token of its own, so CJK text (no spaces between words)
+// is searchable character by character.
+//
+// Not synchronised: MessageStore updates and queries it under its own lock.
+class SearchIndex {
+public:
+    struct Term {
+        std::string token;
+        bool prefix = false; // "depl*": every token starting with "depl"
+    };
+
+    // ids of one token; [head, ids.size()) are live, the rest were evicted
+    struct Postings {
+        std::vector<uint64_t> ids;
+        std::size_t head = 0;
+        const uint64_t* begin() const { return ids.data() + head; }
+        const uint64_t* end() const { return ids.data() + ids.size(); }
+        std::size_t size() const { return ids.size() - head; }
+    };
+
+    static constexpr std::size_t kMaxTokenBytes = 32;     // longer words are indexed by their first 32 bytes
+    static constexpr std::size_t kMinPrefixBytes = 2;     // "d*" would expand to most of the index
+
+    static void tokenize(std::string_view text, std::vector<std::string>& out);
+    // whitespace separated terms, all required; a trailing '*' makes the word's last token a prefix
+    static std::vector<Term> parse_query(const std::string& query);
+
+    // ids are added in ascending order and removed oldest first
+    void add(uint64_t id, std::string_view text);
+    void remove(uint64_t id, std::string_view text);
+
+    // the posting lists a term matches (several for a prefix); false when a
+    // prefix matches more than max_lists tokens
+    bool lookup(const Term& term, std::size_t max_lists, std::vector<const Postings*>& out) const;
+
+    std::size_t token_count() const { return postings_.size(); }
+
+private:
+    void unique_tokens(std::string_view text);
+
+    std::map<std::string, Postings, std::less<>> postings_; // ordered, so a prefix is one range
+    std::vector<std::string> scratch_;
+};
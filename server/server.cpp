@@ -1,99 +1,742 @@
 // server.cpp
 // Windows socket headers should come before other network includes to avoid macro/definition conflicts
+#ifdef _WIN32
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
 #endif
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#endif
 
 #include <boost/asio.hpp>
 #include "server.hpp"
 #include "session.hpp"
+#include "protocol.hpp"
+#include "wire_codec.hpp"
+#include "message_log.hpp"
 #include "logger.hpp"
+#include "metrics.hpp"
+#include "admin_server.hpp"
+#include "cluster_bus.hpp"
 #include <nlohmann/json.hpp>
+#include <condition_variable>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 namespace asio = boost::asio;
 using tcp = asio::ip::tcp;
 using json = nlohmann::json;
 
-Server::Server(asio::io_context& ioc, unsigned short port)
-    : acceptor_(ioc, tcp::endpoint(tcp::v4(), port)), ioc_(ioc) {
-    Logger::instance().info("Server constructed", { {"port", port} });
+namespace {
+
+// A message encoded at most once per wire encoding, shared by the fan-out tasks of all shards
+struct FanoutFrames {
+    explicit FanoutFrames(const json& m) : message(m), type_tag(wire_type_tag(m.value("type", ""))) {}
+    const SharedFrame& get(WireEncoding encoding) {
+        int i = static_cast<int>(encoding);
+        std::call_once(once[i], [&]() { frames[i] = encode_frame(message, encoding); });
+        return frames[i];
+    }
+    json message;
+    std::size_t type_tag;
+    std::once_flag once[2];
+    SharedFrame frames[2];
+};
+
+uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+std::unique_ptr<tcp::acceptor> open_acceptor(asio::io_context& ioc, unsigned short port, bool reuse_port) {
+    auto acceptor = std::make_unique<tcp::acceptor>(ioc);
+    tcp::endpoint endpoint(tcp::v4(), port);
+    acceptor->open(endpoint.protocol());
+    acceptor->set_option(tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+    // every shard listens on the same port; the kernel spreads new connections across them
+    if (reuse_port) acceptor->set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#else
+    (void)reuse_port;
+#endif
+    acceptor->bind(endpoint);
+    acceptor->listen();
+    return acceptor;
+}
+
+} // namespace
+
+Server::Server(std::vector<asio::io_context*> shards, const ServerConfig& config, HandoffState inherited)
+    : config_(config), shards_(std::move(shards)), live_sessions_(shards_.size()),
+      presence_timer_(*shards_.front()),
+      idle_wheel_(config.idle_timeout_ms() / config.idle_wheel_tick_ms + 2), idle_timer_(*shards_.front()),
+      user_store_(config.pbkdf2_iterations), msg_store_(config.history_capacity, config.enable_search),
+      auth_pool_(config.auth_threads, config.auth_queue_limit) {
+#ifdef SO_REUSEPORT
+    const bool reuse_port = config_.io_per_core && shards_.size() > 1;
+#else
+    const bool reuse_port = false; // one acceptor hands connections to the shards round robin
+#endif
+    if (!inherited.listeners.empty()) {
+        // the previous process's listeners, with whatever connections are waiting in their backlog
+        for (std::size_t i = 0; i < inherited.listeners.size(); ++i) {
+            auto acceptor = std::make_unique<tcp::acceptor>(*shards_[i % shards_.size()]);
+            acceptor->assign(tcp::v4(), inherited.listeners[i]);
+            acceptors_.push_back(std::move(acceptor));
+        }
+    } else {
+        for (std::size_t i = 0; i < (reuse_port ? shards_.size() : 1); ++i)
+            acceptors_.push_back(open_acceptor(*shards_[i], config_.port, reuse_port));
+    }
+
+    LOG_INFO("Server constructed", { {"port", config_.port},
+        {"shards", static_cast<uint64_t>(shards_.size())}, {"acceptors", static_cast<uint64_t>(acceptors_.size())},
+        {"write_batch_max_frames", static_cast<uint64_t>(config_.write_batch_max_frames)},
+        {"write_batch_max_bytes", static_cast<uint64_t>(config_.write_batch_max_bytes)},
+        {"history_capacity", static_cast<uint64_t>(config_.history_capacity)} });
+
+    if (!config_.data_dir.empty()) {
+        user_store_.open(config_.data_dir);
+
+        MessageLogOptions opts;
+        opts.dir = config_.data_dir;
+        opts.segment_bytes = config_.log_segment_bytes;
+        opts.max_segments = config_.log_max_segments;
+        opts.fsync_interval_ms = config_.log_fsync_interval_ms;
+        opts.legacy_room = config_.default_room;
+        auto log = std::make_unique<MessageLog>(opts);
+        log->open();
+        msg_store_.attach_log(std::move(log), config_.history_disk_scan_limit);
+    }
+
+    register_gauges();
+    if (config_.admin_port != 0) {
+        admin_ = std::make_unique<AdminServer>(*shards_.front(), config_.admin_port, []() { return Metrics::instance().render_prometheus(); });
+    }
+    if (config_.cluster_port != 0) {
+        ClusterBus::Callbacks callbacks;
+        callbacks.snapshot = [this]() { return cluster_snapshot(); };
+        callbacks.on_message = [this](const std::string& node, const json& m) { on_cluster_message(node, m); };
+        callbacks.on_node_down = [this](const std::string& node) { on_cluster_node_down(node); };
+        cluster_ = std::make_unique<ClusterBus>(*shards_.front(), config_, std::move(callbacks));
+    }
+
+    if (config_.idle_timeout_ms() > 0) {
+        idle_timer_.expires_after(std::chrono::milliseconds(config_.idle_wheel_tick_ms));
+        schedule_idle_tick();
+    }
+
+    adopt_sessions(std::move(inherited.sessions), inherited.presence_version);
+    if (!config_.handoff_path.empty()) {
+        HandoffServer::Callbacks callbacks;
+        callbacks.collect = [this]() { return collect_handoff(); };
+        callbacks.done = [this]() {
+            LOG_INFO("Handoff complete, stopping");
+            for (auto* ioc : shards_) ioc->stop();
+        };
+        handoff_ = std::make_unique<HandoffServer>(config_.handoff_path, std::move(callbacks));
+    }
+}
+
+Server::~Server() {
+    handoff_.reset(); // its thread calls back into this object
+    Metrics::instance().remove_gauges(this);
+}
+
+void Server::register_gauges() {
+    Metrics& m = Metrics::instance();
+    m.add_gauge(this, "chat_online_users", "Logged-in users", [this]() {
+        std::lock_guard<std::mutex> lk(online_users_mutex_);
+        return static_cast<double>(online_user_sessions_.size());
+    });
+    m.add_gauge(this, "chat_rooms", "Rooms with at least one member (plus the default room)", [this]() {
+        std::shared_lock<std::shared_mutex> lk(rooms_mutex_);
+        return static_cast<double>(rooms_.size());
+    });
+    m.add_gauge(this, "chat_message_store_size", "Messages held in the in-memory history window", [this]() {
+        return static_cast<double>(msg_store_.size());
+    });
+    m.add_gauge(this, "chat_message_store_bytes", "Approximate memory held by the in-memory history window (bytes)", [this]() {
+        return static_cast<double>(msg_store_.memory_bytes());
+    });
+    m.add_gauge(this, "chat_cluster_nodes", "Other cluster nodes this node has a link to", [this]() {
+        return cluster_ ? static_cast<double>(cluster_->connected_nodes()) : 0.0;
+    });
+    m.add_gauge(this, "chat_cluster_remote_users", "Users logged in on other cluster nodes", [this]() {
+        std::lock_guard<std::mutex> lk(online_users_mutex_);
+        return static_cast<double>(remote_users_.size());
+    });
+    m.add_gauge(this, "chat_search_index_tokens", "Distinct tokens in the message search index", [this]() {
+        return static_cast<double>(msg_store_.search_tokens());
+    });
+    m.add_gauge(this, "chat_send_queue_frames", "Frames waiting in session send queues", []() {
+        Metrics& mm = Metrics::instance();
+        uint64_t in = mm.counter_value(Counter::FramesQueued);
+        uint64_t out = mm.counter_value(Counter::FramesWritten) + mm.counter_value(Counter::FramesDropped) + mm.counter_value(Counter::FramesUnsent);
+        return in > out ? static_cast<double>(in - out) : 0.0;
+    });
+    m.add_gauge(this, "chat_send_queue_high_water_frames", "Deepest any session send queue has been (frames)", [this]() {
+        return static_cast<double>(queue_high_water_frames_.load(std::memory_order_relaxed));
+    });
+    m.add_gauge(this, "chat_send_queue_high_water_bytes", "Deepest any session send queue has been (bytes)", [this]() {
+        return static_cast<double>(queue_high_water_bytes_.load(std::memory_order_relaxed));
+    });
+    m.add_gauge(this, "chat_auth_pending", "Register/login checks queued or running on the auth pool", [this]() {
+        return static_cast<double>(auth_pool_.pending());
+    });
+    m.add_gauge(this, "chat_idle_wheel_entries", "Deadlines held by the idle reaper", [this]() {
+        return static_cast<double>(idle_wheel_.size());
+    });
+    m.add_gauge(this, "chat_log_dropped_records", "Log records dropped by the async logger", []() {
+        return static_cast<double>(Logger::instance().dropped_count());
+    });
+    m.add_gauge(this, "chat_pool_cached_bytes", "Frame buffers and object blocks held by the per-thread pools (bytes)", []() {
+        return static_cast<double>(pool_cached_bytes());
+    });
+}
+
+void Server::schedule_idle_tick() {
+    idle_timer_.async_wait([this](const boost::system::error_code& ec) {
+        if (ec) return;
+        for (auto& entry : idle_wheel_.advance()) {
+            if (auto sess = entry.lock()) sess->check_idle();
+        }
+        // fixed cadence: the next tick is relative to this one's deadline, not to now
+        idle_timer_.expires_at(idle_timer_.expiry() + std::chrono::milliseconds(config_.idle_wheel_tick_ms));
+        schedule_idle_tick();
+    });
+}
+
+void Server::watch_idle(const std::shared_ptr<Session>& sess, std::size_t delay_ms) {
+    if (config_.idle_timeout_ms() == 0) return;
+    idle_wheel_.schedule(sess, (delay_ms + config_.idle_wheel_tick_ms - 1) / config_.idle_wheel_tick_ms);
 }
 
 void Server::run_accept() {
-    acceptor_.async_accept([this](std::error_code ec, tcp::socket socket) {
+    {
+        std::lock_guard<std::mutex> lk(accept_mutex_);
+        accept_chains_ = acceptors_.size();
+    }
+    for (std::size_t i = 0; i < acceptors_.size(); ++i) accept_on(i);
+    if (admin_) admin_->start();
+    if (cluster_) cluster_->start();
+    if (handoff_) handoff_->start();
+}
+
+void Server::accept_on(std::size_t acceptor_index) {
+    // with an acceptor per shard each accepts onto its own shard; a lone acceptor deals round robin
+    const std::size_t shard = acceptors_.size() > 1 ? acceptor_index % shards_.size() : next_shard_++ % shards_.size();
+    auto on_accept = [this, acceptor_index, shard](boost::system::error_code ec, tcp::socket socket) {
+        // a connection accepted as the handoff starts is tracked like any other and moves with the rest
         if (!ec) {
-            auto s = std::make_shared<Session>(std::move(socket), *this);
-            Logger::instance().info("New connection accepted");
+            Metrics::instance().inc(Counter::ConnectionsAccepted);
+            auto s = std::allocate_shared<Session>(PoolAllocator<Session>(), std::move(socket), *this, shard);
+            LOG_INFO("New connection accepted", { {"shard", static_cast<uint64_t>(shard)} });
+            track_session(s);
             s->start();
-        } else {
-            Logger::instance().error("Accept error", { {"what", ec.message()}, {"value", ec.value()} });
+        } else if (ec != asio::error::operation_aborted) {
+            LOG_ERROR("Accept error", { {"what", ec.message()}, {"value", ec.value()} });
         }
-        run_accept();
-    });
+        // the check and the next accept are atomic with respect to collect_handoff's cancel
+        std::lock_guard<std::mutex> lk(accept_mutex_);
+        if (handing_off_) {
+            // the listener belongs to the next process now; this chain ends here
+            if (--accept_chains_ == 0) accept_done_.notify_all();
+            return;
+        }
+        accept_on(acceptor_index);
+    };
+    if (config_.io_per_core) {
+        // a shard's io_context runs on a single thread, so its sessions need no strand
+        acceptors_[acceptor_index]->async_accept(*shards_[shard], on_accept);
+    } else {
+        // each connection gets its own strand so its handlers never run concurrently
+        acceptors_[acceptor_index]->async_accept(asio::make_strand(*shards_[shard]), on_accept);
+    }
+}
+
+template <typename Task>
+void Server::run_on_shard(std::size_t shard, Task&& task) {
+    if (shards_.size() == 1) task(); // a single shared reactor: deliver inline
+    else asio::post(*shards_[shard], std::forward<Task>(task));
 }
 
 void Server::on_login(std::shared_ptr<Session> sess, const std::string& username) {
 	{
 		std::lock_guard<std::mutex> lk(online_users_mutex_);
 		online_user_sessions_[username] = sess;
-		Logger::instance().info("User logged in", { {"username", username}, {"online_count", static_cast<uint64_t>(online_user_sessions_.size())} });
+		LOG_INFO("User logged in", { {"username", username}, {"online_count", static_cast<uint64_t>(online_user_sessions_.size())} });
 	}
-	// broadcast updated user list to everyone
-    broadcast_user_list();
+    // the new session starts from a snapshot; everyone else learns about it from the next delta
+    sess->deliver(presence_snapshot());
+    note_presence(username);
+    if (cluster_) cluster_->publish({ {"type", "user_online"}, {"username", username} });
+}
+
+std::shared_ptr<UserRateState> Server::user_rate_state(const std::string& username) {
+    std::lock_guard<std::mutex> lk(user_rates_mutex_);
+    auto& slot = user_rates_[username];
+    auto state = slot.lock();
+    if (!state) {
+        state = std::make_shared<UserRateState>();
+        slot = state;
+        // drop the entries of users with no session left once they pile up
+        if (user_rates_.size() > 2 * user_rates_live_ + 1024) {
+            for (auto it = user_rates_.begin(); it != user_rates_.end();) {
+                if (it->second.expired()) it = user_rates_.erase(it);
+                else ++it;
+            }
+            user_rates_live_ = user_rates_.size();
+        }
+    }
+    return state;
+}
+
+void Server::track_session(const std::shared_ptr<Session>& sess) {
+    ShardSessions& shard = live_sessions_[sess->shard()];
+    std::lock_guard<std::mutex> lk(shard.mutex);
+    shard.sessions.emplace(sess.get(), sess);
+}
+
+void Server::adopt_sessions(std::vector<HandoffSession> sessions, uint64_t presence_version) {
+    if (sessions.empty()) return;
+    std::vector<std::shared_ptr<Session>> logged_in;
+    for (auto& state : sessions) {
+        const std::size_t shard = next_shard_++ % shards_.size();
+        tcp::socket socket = config_.io_per_core ? tcp::socket(*shards_[shard]) : tcp::socket(asio::make_strand(*shards_[shard]));
+        boost::system::error_code ec;
+        socket.assign(tcp::v4(), state.fd, ec);
+        if (ec) {
+            LOG_WARN("Cannot adopt handed-off socket", { {"what", ec.message()}, {"user", state.username} });
+#ifndef _WIN32
+            ::close(state.fd);
+#endif
+            continue;
+        }
+        auto s = std::allocate_shared<Session>(PoolAllocator<Session>(), std::move(socket), *this, shard);
+        track_session(s);
+        if (!state.username.empty()) {
+            std::lock_guard<std::mutex> presence_lk(presence_mutex_);
+            std::lock_guard<std::mutex> users_lk(online_users_mutex_);
+            online_user_sessions_[state.username] = s;
+            presence_published_.insert(state.username);
+            logged_in.push_back(s);
+        }
+        Metrics::instance().inc(Counter::ConnectionsAccepted);
+        s->resume(std::move(state));
+    }
+    {
+        // continue the old numbering so clients take the snapshot as the newest state
+        std::lock_guard<std::mutex> lk(presence_mutex_);
+        presence_version_ = presence_version + 1;
+    }
+    const json snapshot = presence_snapshot();
+    for (auto& s : logged_in) s->deliver(snapshot);
+    LOG_INFO("Sessions adopted", { {"sessions", static_cast<uint64_t>(sessions.size())}, {"logged_in", static_cast<uint64_t>(logged_in.size())} });
+}
+
+HandoffState Server::collect_handoff() {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(config_.handoff_timeout_ms);
+
+    // stop accepting before anything else, so every session this process will ever have is
+    // tracked by the time they are parked and none is accepted after its listener is sent
+    {
+        std::unique_lock<std::mutex> lk(accept_mutex_);
+        handing_off_ = true;
+        for (const auto& acceptor : acceptors_) {
+            boost::system::error_code ignored;
+            acceptor->cancel(ignored);
+        }
+        accept_done_.wait_until(lk, deadline, [this]() { return accept_chains_ == 0; });
+    }
+
+    // stop every session at a frame boundary: no read, write or credential check in flight
+    struct Parking {
+        std::mutex mutex;
+        std::condition_variable done;
+        std::size_t waiting = 0;
+        std::vector<std::shared_ptr<Session>> movable;
+    };
+    auto parking = std::make_shared<Parking>();
+    std::vector<std::shared_ptr<Session>> sessions;
+    for (auto& shard : live_sessions_) {
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        for (const auto& entry : shard.sessions) {
+            if (auto s = entry.second.lock()) sessions.push_back(std::move(s));
+        }
+    }
+    parking->waiting = sessions.size();
+    for (const auto& sess : sessions) {
+        sess->park([parking, sess](bool movable) {
+            std::lock_guard<std::mutex> lk(parking->mutex);
+            if (movable) parking->movable.push_back(sess);
+            if (--parking->waiting == 0) parking->done.notify_all();
+        });
+    }
+    std::vector<std::shared_ptr<Session>> movable;
+    {
+        // stragglers stay behind and are closed when this process exits
+        std::unique_lock<std::mutex> lk(parking->mutex);
+        parking->done.wait_until(lk, deadline, [&]() { return parking->waiting == 0; });
+        movable = parking->movable;
+    }
+
+    // the next process opens the stores and binds the other ports once it has the state
+    auth_pool_.wait_idle(deadline);
+    msg_store_.detach_log();
+    user_store_.close();
+    if (admin_) admin_->stop_accepting();
+    if (cluster_) cluster_->stop_accepting();
+
+    HandoffState state;
+    for (const auto& acceptor : acceptors_) state.listeners.push_back(acceptor->native_handle());
+    for (const auto& sess : movable) {
+        HandoffSession s;
+        if (sess->export_handoff(s)) state.sessions.push_back(std::move(s));
+    }
+    parked_sessions_ = std::move(sessions); // idle now, so nothing else keeps their sockets open
+    {
+        std::lock_guard<std::mutex> lk(presence_mutex_);
+        state.presence_version = presence_version_;
+    }
+    LOG_INFO("Handoff collected", { {"sessions", static_cast<uint64_t>(sessions.size())}, {"moved", static_cast<uint64_t>(state.sessions.size())} });
+    return state;
 }
 
 void Server::on_disconnect(std::shared_ptr<Session> sess) {
+    {
+        ShardSessions& shard = live_sessions_[sess->shard()];
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        shard.sessions.erase(sess.get());
+    }
+    const std::string username = sess->username();
+    for (const auto& room : sess->joined_rooms()) leave_room(room, sess);
+    bool removed = false;
 	{
 		std::lock_guard<std::mutex> lk(online_users_mutex_);
-		for (auto it = online_user_sessions_.begin(); it != online_user_sessions_.end();) {
-			if (it->second == sess) {
-				Logger::instance().info("User disconnected", { {"username", it->first} });
-				it = online_user_sessions_.erase(it);
-			} else ++it;
+		auto it = online_user_sessions_.find(username);
+		// a newer login of the same user may have replaced this session
+		if (it != online_user_sessions_.end() && it->second == sess) {
+			online_user_sessions_.erase(it);
+			removed = true;
+			LOG_INFO("User disconnected", { {"username", username} });
 		}
 	}
-    // broadcast updated user list to everyone
-    broadcast_user_list();
+    if (!removed) return;
+    note_presence(username);
+    if (cluster_) cluster_->publish({ {"type", "user_offline"}, {"username", username} });
 }
 
-void Server::broadcast(const std::string& json_text, std::shared_ptr<Session> except) {
-    std::lock_guard<std::mutex> lk(online_users_mutex_);
-    Logger::instance().debug("Broadcasting message", { {"len", static_cast<uint64_t>(json_text.size())}, {"except", except ? except->username() : ""} });
-    for (auto& kv : online_user_sessions_) {
-        if (kv.second != except) kv.second->deliver(json_text);
+void Server::note_presence(const std::string& username) {
+    std::lock_guard<std::mutex> lk(presence_mutex_);
+    presence_pending_.insert(username);
+    if (presence_flush_scheduled_) return;
+    presence_flush_scheduled_ = true;
+    presence_timer_.expires_after(std::chrono::milliseconds(config_.presence_batch_ms));
+    presence_timer_.async_wait([this](const boost::system::error_code& ec) {
+        if (!ec) flush_presence();
+    });
+}
+
+void Server::flush_presence() {
+    // held across the broadcasts so deltas reach every session in version order
+    std::lock_guard<std::mutex> lk(presence_mutex_);
+    presence_flush_scheduled_ = false;
+    json joined = json::array(), left = json::array();
+    {
+        // the state at flush time decides, so a login and logout within one window cancel
+        // out, and a user stays online while logged in here or on any other node
+        std::lock_guard<std::mutex> users_lk(online_users_mutex_);
+        for (const auto& name : presence_pending_) {
+            if (online_user_sessions_.count(name) || remote_users_.count(name)) {
+                if (presence_published_.insert(name).second) joined.push_back(name);
+            } else if (presence_published_.erase(name)) {
+                left.push_back(name);
+            }
+        }
     }
+    presence_pending_.clear();
+    if (!left.empty()) broadcast({ {"type", "user_left"}, {"version", ++presence_version_}, {"usernames", left} });
+    if (!joined.empty()) broadcast({ {"type", "user_joined"}, {"version", ++presence_version_}, {"usernames", joined} });
+    LOG_DEBUG("Presence published", { {"version", presence_version_}, {"joined", static_cast<uint64_t>(joined.size())},
+        {"left", static_cast<uint64_t>(left.size())} });
 }
 
-void Server::send_to_user(const std::string& username, const std::string& json_text) {
-    std::lock_guard<std::mutex> lk(online_users_mutex_);
-    auto it = online_user_sessions_.find(username);
-    if (it != online_user_sessions_.end()) {
-        it->second->deliver(json_text);
-        Logger::instance().debug("Sent message to user", { {"to", username}, {"len", static_cast<uint64_t>(json_text.size())} });
+json Server::presence_snapshot() {
+    std::lock_guard<std::mutex> lk(presence_mutex_);
+    json j = { {"type", "user_list"}, {"version", presence_version_} };
+    j["users"] = json::array();
+    for (auto& name : presence_published_) j["users"].push_back(name);
+    return j;
+}
+
+void Server::broadcast(const json& message, std::shared_ptr<Session> except) {
+    // encode once per wire encoding; every recipient queues the same immutable buffer
+    auto frames = std::allocate_shared<FanoutFrames>(PoolAllocator<FanoutFrames>(), message);
+    std::vector<std::vector<std::shared_ptr<Session>>> by_shard(shards_.size());
+    {
+        std::lock_guard<std::mutex> lk(online_users_mutex_);
+        for (auto& kv : online_user_sessions_) {
+            if (kv.second == except) continue;
+            by_shard[kv.second->shard()].push_back(kv.second);
+        }
+    }
+    for (std::size_t shard = 0; shard < by_shard.size(); ++shard) {
+        if (by_shard[shard].empty()) continue;
+        run_on_shard(shard, [frames, sessions = std::move(by_shard[shard])]() {
+            const auto start = std::chrono::steady_clock::now();
+            for (auto& sess : sessions) sess->deliver_frame(frames->get(sess->encoding()), FrameClass::Droppable, frames->type_tag);
+            Metrics::instance().observe(Histogram::Fanout, elapsed_ns(start));
+        });
+    }
+    LOG_DEBUG("Broadcasting message", { {"type", message.value("type", "")}, {"except", except ? except->username() : ""} });
+}
+
+void Server::join_room(const std::string& room_name, const std::shared_ptr<Session>& sess) {
+    std::shared_ptr<Room> room;
+    {
+        std::unique_lock<std::shared_mutex> lk(rooms_mutex_);
+        auto& slot = rooms_[room_name];
+        if (!slot) {
+            slot = std::make_shared<Room>(room_name, shards_.size());
+            LOG_INFO("Room created", { {"room", room_name} });
+        }
+        ++slot->members; // counted before the bucket insert, so the room cannot be removed in between
+        room = slot;
+    }
+    Room::Bucket& bucket = room->buckets[sess->shard()];
+    std::unique_lock<std::shared_mutex> bucket_lock(bucket.mutex);
+    bucket.members.insert(sess);
+    bucket.size.store(bucket.members.size(), std::memory_order_relaxed);
+    LOG_INFO("Joined room", { {"room", room_name}, {"username", sess->username()} });
+}
+
+bool Server::leave_room(const std::string& room_name, const std::shared_ptr<Session>& sess) {
+    std::shared_ptr<Room> room;
+    {
+        std::shared_lock<std::shared_mutex> lk(rooms_mutex_);
+        auto it = rooms_.find(room_name);
+        if (it == rooms_.end()) return false;
+        room = it->second;
+    }
+    {
+        Room::Bucket& bucket = room->buckets[sess->shard()];
+        std::unique_lock<std::shared_mutex> bucket_lock(bucket.mutex);
+        if (!bucket.members.erase(sess)) return false;
+        bucket.size.store(bucket.members.size(), std::memory_order_relaxed);
+    }
+    LOG_INFO("Left room", { {"room", room_name}, {"username", sess->username()} });
+
+    std::unique_lock<std::shared_mutex> lk(rooms_mutex_);
+    if (--room->members == 0 && room_name != config_.default_room) {
+        auto it = rooms_.find(room_name);
+        if (it != rooms_.end() && it->second == room) {
+            rooms_.erase(it);
+            LOG_INFO("Room removed", { {"room", room_name} });
+        }
+    }
+    return true;
+}
+
+void Server::broadcast_to_room(const std::string& room_name, const json& message) {
+    if (cluster_) cluster_->publish({ {"type", "room"}, {"room", room_name}, {"message", message} });
+    fanout_to_room(room_name, message);
+}
+
+void Server::fanout_to_room(const std::string& room_name, const json& message) {
+    std::shared_ptr<Room> room;
+    {
+        std::shared_lock<std::shared_mutex> lk(rooms_mutex_);
+        auto it = rooms_.find(room_name);
+        if (it == rooms_.end()) return;
+        room = it->second;
+    }
+    // one task per shard that has members; each walks only its own bucket
+    auto frames = std::allocate_shared<FanoutFrames>(PoolAllocator<FanoutFrames>(), message);
+    for (std::size_t shard = 0; shard < room->buckets.size(); ++shard) {
+        if (room->buckets[shard].size.load(std::memory_order_relaxed) == 0) continue;
+        run_on_shard(shard, [room, shard, frames]() {
+            const auto start = std::chrono::steady_clock::now();
+            Room::Bucket& bucket = room->buckets[shard];
+            std::shared_lock<std::shared_mutex> bucket_lock(bucket.mutex);
+            for (auto& sess : bucket.members) sess->deliver_frame(frames->get(sess->encoding()), FrameClass::Droppable, frames->type_tag);
+            Metrics::instance().observe(Histogram::Fanout, elapsed_ns(start));
+        });
+    }
+    LOG_DEBUG("Room broadcast", { {"room", room_name} });
+}
+
+json Server::room_list() {
+    json out = json::array();
+    std::shared_lock<std::shared_mutex> lk(rooms_mutex_);
+    for (auto& kv : rooms_) out.push_back({ {"name", kv.first}, {"members", kv.second->members} });
+    return out;
+}
+
+void Server::send_to_user(const std::string& username, const json& message) {
+    std::shared_ptr<Session> sess;
+    std::string node;
+    {
+        std::lock_guard<std::mutex> lk(online_users_mutex_);
+        auto it = online_user_sessions_.find(username);
+        if (it != online_user_sessions_.end()) {
+            sess = it->second;
+        } else {
+            auto rit = remote_users_.find(username);
+            if (rit != remote_users_.end()) node = rit->second;
+        }
+    }
+    if (sess) {
+        const std::size_t shard = sess->shard();
+        run_on_shard(shard, [sess = std::move(sess), message]() { sess->deliver(message); });
+        LOG_DEBUG("Sent message to user", { {"to", username}, {"type", message.value("type", "")} });
+    } else if (!node.empty()) {
+        cluster_->send_to(node, { {"type", "route"}, {"to", username}, {"message", message} });
+        LOG_DEBUG("Forwarded message to node", { {"to", username}, {"node", node} });
     } else {
-        Logger::instance().warn("User not online for send", { {"to", username} });
+        LOG_WARN("User not online for send", { {"to", username} });
     }
 }
 
-void Server::broadcast_user_list() {
-    json j;
+void Server::on_cluster_message(const std::string& node, const json& j) {
+    const std::string type = j.value("type", "");
+    if (type == "route" || type == "room") {
+        json message = j.value("message", json::object());
+        // a node only forwards what its own logged-in users sent, to the user or room it names
+        const std::string from = message.value("from", "");
+        const char* target = type == "route" ? "to" : "room";
+        bool trusted = message.value(target, "") == j.value(target, "");
+        if (trusted) {
+            std::lock_guard<std::mutex> lk(online_users_mutex_);
+            auto it = node_users_.find(node);
+            trusted = it != node_users_.end() && it->second.count(from) != 0;
+        }
+        if (!trusted) {
+            Metrics::instance().inc(Counter::ClusterMessagesRejected);
+            LOG_WARN("Dropping forwarded message", { {"node", node}, {"from", from}, {"type", type} });
+            return;
+        }
+        // forwarded chat goes into this node's history as well, under this node's id
+        const std::string chat_type = message.value("type", "");
+        if (chat_type == "message" || chat_type == "private") {
+            const bool group = chat_type == "message";
+            ChatMsg cm{ message.value("from", ""), group ? "" : message.value("to", ""), message.value("text", ""),
+                        message.value("ts", uint64_t{0}), 0, group ? message.value("room", "") : "" };
+            const uint64_t id = msg_store_.add_message(cm);
+            if (id == 0) return; // this node's log cannot hold it
+            message["id"] = id;
+        }
+        if (type == "room") {
+            fanout_to_room(j.value("room", ""), message);
+            return;
+        }
+        // routed to a user of this node; never forwarded again
+        const std::string to = j.value("to", "");
+        std::shared_ptr<Session> sess;
+        {
+            std::lock_guard<std::mutex> lk(online_users_mutex_);
+            auto it = online_user_sessions_.find(to);
+            if (it != online_user_sessions_.end()) sess = it->second;
+        }
+        if (!sess) {
+            LOG_WARN("Routed user not online", { {"to", to}, {"node", node} });
+            return;
+        }
+        const std::size_t shard = sess->shard();
+        run_on_shard(shard, [sess = std::move(sess), message = std::move(message)]() { sess->deliver(message); });
+        return;
+    }
+
+    std::vector<std::string> changed;
+    if (type == "user_online" || type == "user_offline") {
+        std::string username = j.value("username", "");
+        std::lock_guard<std::mutex> lk(online_users_mutex_);
+        set_remote_user_locked(node, username, type == "user_online");
+        changed.push_back(std::move(username));
+    } else if (type == "node_sync") {
+        // the node's complete user list: replaces whatever we knew about it
+        std::unordered_set<std::string> users;
+        for (const auto& name : j.value("usernames", json::array())) {
+            if (name.is_string()) users.insert(name.get<std::string>());
+        }
+        std::lock_guard<std::mutex> lk(online_users_mutex_);
+        const auto previous = node_users_[node];
+        for (const auto& name : previous) {
+            if (!users.count(name)) set_remote_user_locked(node, name, false);
+        }
+        for (const auto& name : users) set_remote_user_locked(node, name, true);
+        changed.assign(previous.begin(), previous.end());
+        changed.insert(changed.end(), users.begin(), users.end());
+        LOG_INFO("Cluster node synced", { {"node", node}, {"users", static_cast<uint64_t>(users.size())} });
+    } else {
+        LOG_WARN("Unknown cluster message", { {"type", type}, {"node", node} });
+    }
+    for (const auto& name : changed) note_presence(name);
+}
+
+void Server::on_cluster_node_down(const std::string& node) {
+    std::vector<std::string> changed;
     {
         std::lock_guard<std::mutex> lk(online_users_mutex_);
-        j["type"] = "user_list";
-        j["users"] = json::array();
-        for (auto& kv : online_user_sessions_) {
-            j["users"].push_back(kv.first);
+        auto it = node_users_.find(node);
+        if (it == node_users_.end()) return;
+        changed.assign(it->second.begin(), it->second.end());
+        for (const auto& name : changed) set_remote_user_locked(node, name, false);
+        node_users_.erase(node);
+    }
+    LOG_WARN("Cluster node users offline", { {"node", node}, {"users", static_cast<uint64_t>(changed.size())} });
+    for (const auto& name : changed) note_presence(name);
+}
+
+void Server::set_remote_user_locked(const std::string& node, const std::string& username, bool online) {
+    auto& users = node_users_[node];
+    if (online) {
+        users.insert(username);
+        remote_users_[username] = node;
+        return;
+    }
+    users.erase(username);
+    auto it = remote_users_.find(username);
+    if (it == remote_users_.end() || it->second != node) return;
+    remote_users_.erase(it);
+    // still logged in on another node?
+    for (const auto& kv : node_users_) {
+        if (kv.second.count(username)) {
+            remote_users_[username] = kv.first;
+            break;
         }
     }
-    broadcast(j.dump());  // The lock online_users_mutex_ is no longer held here
 }
 
-std::vector<std::string> Server::online_usernames() {
+json Server::cluster_snapshot() {
+    json users = json::array();
     std::lock_guard<std::mutex> lk(online_users_mutex_);
-    std::vector<std::string> out;
-    out.reserve(online_user_sessions_.size());
-    for (auto& kv : online_user_sessions_) out.push_back(kv.first);
-    return out;
+    for (const auto& kv : online_user_sessions_) users.push_back(kv.first);
+    return { {"type", "node_sync"}, {"usernames", std::move(users)} };
+}
+
+void Server::record_write(std::size_t frames, std::size_t bytes) {
+    Metrics& m = Metrics::instance();
+    m.inc(Counter::WriteCalls);
+    m.inc(Counter::FramesWritten, frames);
+    m.inc(Counter::BytesWritten, bytes);
+}
+
+// raise `target` to at least `value`
+static void store_max(std::atomic<uint64_t>& target, uint64_t value) {
+    uint64_t cur = target.load(std::memory_order_relaxed);
+    while (cur < value && !target.compare_exchange_weak(cur, value, std::memory_order_relaxed)) {}
+}
+
+void Server::record_queue_depth(std::size_t frames, std::size_t bytes) {
+    store_max(queue_high_water_frames_, frames);
+    store_max(queue_high_water_bytes_, bytes);
+}
+
+void Server::record_frames_dropped(std::size_t frames) {
+    Metrics::instance().inc(Counter::FramesDropped, frames);
+}
+
+void Server::record_slow_consumer_disconnect() {
+    Metrics::instance().inc(Counter::SlowConsumerDisconnects);
 }
@@ -3,35 +3,149 @@
 #include <boost/asio.hpp>
 #include <memory>
 #include <unordered_map>
+#include <unordered_set>
 #include <mutex>
+#include <condition_variable>
+#include <shared_mutex>
 #include <string>
 #include <vector>
+#include <atomic>
+#include <nlohmann/json.hpp>
+#include <cstdint>
+#include "server_config.hpp"
 #include "user_store.hpp"
+#include "worker_pool.hpp"
 #include "message_store.hpp"
+#include "timing_wheel.hpp"
+#include "handoff.hpp"
 
 class Session;
+class AdminServer;
+class ClusterBus;
+class HandoffServer;
+
+// A chat room. Members are bucketed by io shard: a bucket is only walked by the
+// fan-out task running on its own shard, so delivering to a room never touches
+// another shard's sessions and never contends with other rooms.
+struct Room {
+    struct Bucket {
+        std::shared_mutex mutex;
+        std::unordered_set<std::shared_ptr<Session>> members;
+        std::atomic<std::size_t> size{0}; // read without the lock to skip empty shards
+    };
+    Room(std::string room_name, std::size_t shards) : name(std::move(room_name)), buckets(shards) {}
+
+    std::string name;
+    std::vector<Bucket> buckets; // indexed by Session::shard()
+    std::size_t members = 0;     // guarded by Server::rooms_mutex_; the room is removed at zero
+};
 
 class Server {
 public:
-    Server(boost::asio::io_context& ioc, unsigned short port);
+    // shards: one io_context per pinned thread in per-core mode, or a single shared one.
+    // inherited: sockets passed on by the previous process (see request_handoff);
+    // its listeners are used instead of binding the port and its sessions carry on.
+    Server(std::vector<boost::asio::io_context*> shards, const ServerConfig& config, HandoffState inherited = {});
+    ~Server();
     void run_accept();
+    std::size_t shard_count() const { return shards_.size(); }
     void on_login(std::shared_ptr<Session> sess, const std::string& username);
     void on_disconnect(std::shared_ptr<Session> sess);
-    void broadcast(const std::string& json_text, std::shared_ptr<Session> except = nullptr);
-    void send_to_user(const std::string& username, const std::string& json_text);
+    void broadcast(const nlohmann::json& message, std::shared_ptr<Session> except = nullptr);
+    void send_to_user(const std::string& username, const nlohmann::json& message);
+
+    // rooms: group messages only reach the sessions that joined the room
+    void join_room(const std::string& room, const std::shared_ptr<Session>& sess);
+    bool leave_room(const std::string& room, const std::shared_ptr<Session>& sess);
+    void broadcast_to_room(const std::string& room, const nlohmann::json& message);
+    nlohmann::json room_list();
+
+    // idle reaper: (re)arm the session's deadline; see Session::check_idle
+    void watch_idle(const std::shared_ptr<Session>& sess, std::size_t delay_ms);
 
-    // new helpers for online users
-    void broadcast_user_list();
-    std::vector<std::string> online_usernames();
+    // presence: full user_list snapshot at the current presence version
+    nlohmann::json presence_snapshot();
+
+    // cluster mode: frames from the other nodes (see ClusterBus), applied to local sessions
+    void on_cluster_message(const std::string& node, const nlohmann::json& message);
+    void on_cluster_node_down(const std::string& node);
+    // this node's online users, sent first on every new cluster link
+    nlohmann::json cluster_snapshot();
+
+    const ServerConfig& config() const { return config_; }
+    void record_write(std::size_t frames, std::size_t bytes);
+    void record_queue_depth(std::size_t frames, std::size_t bytes);
+    void record_frames_dropped(std::size_t frames);
+    void record_slow_consumer_disconnect();
 
     UserStore& user_store() { return user_store_; }
+    WorkerPool& auth_pool() { return auth_pool_; }
     MessageStore& message_store() { return msg_store_; }
+    // rate-limit buckets shared by the sessions of one user; lives while any of them holds it
+    std::shared_ptr<UserRateState> user_rate_state(const std::string& username);
 
 private:
-    boost::asio::ip::tcp::acceptor acceptor_;
-    boost::asio::io_context& ioc_;
+    void accept_on(std::size_t acceptor_index);
+    void track_session(const std::shared_ptr<Session>& sess);
+    void adopt_sessions(std::vector<HandoffSession> sessions, uint64_t presence_version);
+    // hot restart, old process: quiesce every session, release the stores and ports, export the state
+    HandoffState collect_handoff();
+    // cross-shard work is handed to the owning shard's io_context instead of sharing its state
+    template <typename Task> void run_on_shard(std::size_t shard, Task&& task);
+    void register_gauges();
+    void schedule_idle_tick();
+    void note_presence(const std::string& username);
+    void flush_presence();
+    // room fan-out to this node's members only
+    void fanout_to_room(const std::string& room, const nlohmann::json& message);
+    // caller holds online_users_mutex_
+    void set_remote_user_locked(const std::string& node, const std::string& username, bool online);
+
+    ServerConfig config_;
+    std::vector<boost::asio::io_context*> shards_;
+    // one SO_REUSEPORT acceptor per shard in per-core mode, otherwise a single one
+    std::vector<std::unique_ptr<boost::asio::ip::tcp::acceptor>> acceptors_;
+    std::size_t next_shard_ = 0; // round robin for a lone acceptor; only touched by its accept chain
+    // every open session by shard (the online map only holds logged-in users), for the handoff
+    struct ShardSessions {
+        std::mutex mutex;
+        std::unordered_map<Session*, std::weak_ptr<Session>> sessions;
+    };
+    std::vector<ShardSessions> live_sessions_;
+    // accept chains end once handing_off_ is set: the next process owns the listeners
+    std::mutex accept_mutex_;
+    std::condition_variable accept_done_;
+    std::size_t accept_chains_ = 0; // accept_on chains still running
+    bool handing_off_ = false;
+    std::vector<std::shared_ptr<Session>> parked_sessions_; // held until exit once handed off
     std::mutex online_users_mutex_;
     std::unordered_map<std::string, std::shared_ptr<Session>> online_user_sessions_;
+    // cluster directory, also guarded by online_users_mutex_: who is logged in on the other nodes
+    std::unordered_map<std::string, std::string> remote_users_;                   // username -> node
+    std::unordered_map<std::string, std::unordered_set<std::string>> node_users_; // node -> its usernames
+    // presence: login/logout events are coalesced for presence_batch_ms and published
+    // as versioned user_joined/user_left deltas instead of full user lists. Lock order:
+    // presence_mutex_ before online_users_mutex_.
+    std::mutex presence_mutex_;
+    std::unordered_set<std::string> presence_pending_;   // usernames whose state may have changed this window
+    std::unordered_set<std::string> presence_published_;     // online set as of presence_version_
+    uint64_t presence_version_ = 0;
+    bool presence_flush_scheduled_ = false;
+    boost::asio::steady_timer presence_timer_;
+    TimingWheel<Session> idle_wheel_;
+    boost::asio::steady_timer idle_timer_;
+    std::mutex user_rates_mutex_;
+    std::unordered_map<std::string, std::weak_ptr<UserRateState>> user_rates_;
+    std::size_t user_rates_live_ = 0; // live entries after the last prune
+    std::shared_mutex rooms_mutex_; // guards the room map and member counts, never held during fan-out
+    std::unordered_map<std::string, std::shared_ptr<Room>> rooms_;
     UserStore user_store_;
     MessageStore msg_store_;
+    std::unique_ptr<AdminServer> admin_;
+    std::unique_ptr<ClusterBus> cluster_;
+    std::unique_ptr<HandoffServer> handoff_;
+    WorkerPool auth_pool_; // last member: joined first, before the stores its tasks use are destroyed
+
+    std::atomic<uint64_t> queue_high_water_frames_{0};
+    std::atomic<uint64_t> queue_high_water_bytes_{0};
 };
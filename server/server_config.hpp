@@ -0,0 +1,108 @@
+// server_config.hpp
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "rate_limiter.hpp"
+
+// What to do when a session's outgoing queue exceeds its limits
+enum class SlowConsumerPolicy {
+    DropOldest, // discard the oldest droppable frames
+    Coalesce,   // discard them too, but leave one frames_dropped notice carrying the count
+    Disconnect, // close the connection
+};
+
+// Tunables for the server. main.cpp fills these from the environment.
+struct ServerConfig {
+    unsigned short port = 9000;
+    unsigned short admin_port = 0; // loopback HTTP endpoint serving /metrics; 0 = disabled
+
+    // threading: io_threads reactor threads (0 = one per core). In per-core mode every
+    // thread runs its own io_context pinned to a core, with its own SO_REUSEPORT acceptor
+    // where the platform has one, and each session lives on exactly one of them.
+    std::size_t io_threads = 0;
+    bool io_per_core = false;
+
+    // Session::do_write gathers queued frames into one async_write, capped by these
+    std::size_t write_batch_max_frames = 64;
+    std::size_t write_batch_max_bytes = 256 * 1024;
+
+    // per-session outgoing queue bounds; critical frames (replies, private messages) are never
+    // dropped, so a session still over the limit after dropping is disconnected under any policy
+    std::size_t send_queue_max_frames = 8192;
+    std::size_t send_queue_max_bytes = 16 * 1024 * 1024;
+    SlowConsumerPolicy slow_consumer_policy = SlowConsumerPolicy::DropOldest;
+
+    // receive path: frames larger than this close the connection; the per-session
+    // buffer starts at recv_buffer_initial and grows only as far as a frame needs
+    std::size_t max_frame_size = 1024 * 1024;
+    std::size_t recv_buffer_initial = 8 * 1024;
+
+    // receive-path flood protection, per RateClass: one set of token buckets per session and
+    // one shared by all sessions of a user. Over-limit frames are answered with a rate_limited
+    // error; a session that keeps going after rate_strikes of those (refilled one per second)
+    // is disconnected.
+    RateLimit session_rate[kRateClassCount] = { {20, 40}, {20, 40}, {5, 10}, {2, 10} };
+    RateLimit user_rate[kRateClassCount] = { {30, 60}, {30, 60}, {8, 20}, {4, 20} };
+    double rate_strikes = 20;
+
+    // credential hashing runs on a dedicated bounded pool, off the io threads
+    std::uint32_t pbkdf2_iterations = 50000;
+    std::size_t auth_threads = 2;
+    std::size_t auth_queue_limit = 1024; // pending register/login checks before we answer "busy"
+
+    // idle reaper: a session with no inbound traffic for idle_heartbeats heartbeat
+    // intervals is closed (0 disables). Deadlines are kept on a timing wheel that
+    // advances every idle_wheel_tick_ms.
+    std::size_t heartbeat_interval_ms = 10000;
+    std::size_t idle_heartbeats = 3;
+    std::size_t idle_wheel_tick_ms = 1000;
+    std::size_t idle_timeout_ms() const { return heartbeat_interval_ms * idle_heartbeats; }
+
+    // presence changes within this window are coalesced into one user_joined/user_left delta
+    std::size_t presence_batch_ms = 200;
+
+    // rooms: every user joins default_room on login; group messages without a room go there
+    std::string default_room = "lobby";
+    std::size_t max_rooms_per_user = 32;
+
+    // allow clients to negotiate the CBOR encoding via "hello"
+    bool enable_binary_protocol = true;
+
+    // per-connection deflate of server->client frames, negotiated via "hello". Each
+    // compressing connection keeps a zlib stream (~(1 << (window_bits + 2)) + 128 KiB);
+    // frames with payloads under compress_min_bytes are sent as they are.
+    bool enable_compression = true;
+    int compress_level = 6;
+    int compress_window_bits = 15;
+    std::size_t compress_min_bytes = 64;
+
+    // cluster mode, off while cluster_port is 0: nodes share presence and forward
+    // private and room messages to each other over TCP (see ClusterBus)
+    unsigned short cluster_port = 0;
+    std::string cluster_bind = "127.0.0.1"; // address the cluster port listens on
+    std::string cluster_secret;             // shared by every node; links presenting another are dropped
+    std::string node_id;                    // unique per node; defaults to "<hostname>:<port>"
+    std::vector<std::string> cluster_peers; // "host:port" bus addresses; may include this node's own
+    std::size_t cluster_queue_bytes = 16u << 20; // per peer link; frames beyond are dropped
+
+    // hot restart (Linux): a new process started with the same handoff_path takes over the
+    // listening socket and the live sessions of the one running (see HandoffServer)
+    std::string handoff_path;
+    std::size_t handoff_timeout_ms = 2000; // sessions not quiesced by then are closed, not moved
+
+    // number of messages kept in MessageStore; the oldest is evicted beyond this
+    std::size_t history_capacity = 10000;
+    // most messages a single history request returns, paged or legacy "n"
+    std::size_t history_page_max = 200;
+    // keep an inverted index of the messages in memory for "search" (roughly doubles the store's memory)
+    bool enable_search = true;
+
+    // persistence for users and messages (disabled when data_dir is empty)
+    std::string data_dir;
+    std::uint64_t log_segment_bytes = 64ull << 20;
+    std::size_t log_max_segments = 16;
+    std::uint32_t log_fsync_interval_ms = 20;
+    std::size_t history_disk_scan_limit = 100000; // log records examined per history request
+};
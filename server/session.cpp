@@ -1,21 +1,33 @@
 // session.cpp
+#ifdef _WIN32
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
 #endif
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#endif
 
 #include "session.hpp"
 #include "server.hpp"
 #include "protocol.hpp"
 #include "logger.hpp"
+#include "metrics.hpp"
+#include "compression.hpp"
 #include <chrono>
 #include <nlohmann/json.hpp>
 #include <algorithm>
+#include <cstring>
 
 using json = nlohmann::json;
 namespace asio = boost::asio;
 
+static constexpr std::size_t kMaxRoomNameLength = 64;
+static constexpr std::size_t kMaxUserNameLength = 64;
+static constexpr std::size_t kJoinHistoryCount = 50; // recent room messages replayed after a join
+static constexpr std::size_t kLoginHistoryCount = 100; // recent messages replayed after login
+static constexpr std::size_t kHistoryPageDefault = 50; // page size when a history request has no limit
+static constexpr std::size_t kSearchPageDefault = 20;
+
 static std::string preview_text(const std::string& s, size_t maxlen = 200) {
     if (s.size() <= maxlen) return s;
     return s.substr(0, maxlen) + "...";
@@ -25,217 +37,834 @@ static std::string preview_text(const std::string& s, size_t maxlen = 200) {
 // - replace "password" with "<REDACTED>"
 // - replace "text" with preview
 // - keep username, type, etc.
-static json redact_for_logging(const std::string& raw) {
-    try {
-        json j = json::parse(raw);
-        if (j.contains("password")) j["password"] = "<REDACTED>";
-        if (j.contains("text")) j["text"] = preview_text(j["text"].get<std::string>(), 200);
-        return j;
-    } catch (...) {
-        json out;
-        out["raw_preview"] = preview_text(raw, 200);
-        return out;
-    }
+static json redact_for_logging(const json& message) {
+    json j = message;
+    if (j.contains("password")) j["password"] = "<REDACTED>";
+    if (j.contains("text") && j["text"].is_string()) j["text"] = preview_text(j["text"].get<std::string>(), 200);
+    return j;
+}
+
+// a stored message as clients see it: the live frame plus the id to page from
+static json history_entry(const ChatMsg& m) {
+    json mj = {
+        {"type", m.to.empty() ? "message" : "private"},
+        {"id", m.id},
+        {"from", m.from.view()},
+        {"to", m.to.view()},
+        {"text", m.text.view()},
+        {"ts", m.ts}
+    };
+    if (m.to.empty()) mj["room"] = m.room.view();
+    return mj;
 }
 
-Session::Session(asio::ip::tcp::socket socket, Server& server)
-    : socket_(std::move(socket)), server_(server), header_buf_(4) {
-    Logger::instance().debug("Session constructed");
+// history_result / search_result: the page's messages plus the cursor that continues it
+static json page_frame(const char* type, const HistoryPage& page, bool forward) {
+    json msgs = json::array();
+    for (const auto& m : page.messages) msgs.push_back(history_entry(m));
+    json r = { {"type", type}, {"messages", std::move(msgs)}, {"has_more", page.has_more} };
+    if (page.has_more) r[forward ? "next_after" : "next_before"] = page.next_cursor;
+    return r;
+}
+
+Session::Session(asio::ip::tcp::socket socket, Server& server, std::size_t shard)
+    : socket_(std::move(socket)), server_(server), shard_(shard), recv_buffer_(take_frame_buffer(server.config().recv_buffer_initial)) {
+    recv_buffer_.resize(server_.config().recv_buffer_initial);
+    LOG_DEBUG("Session constructed");
 }
 
 void Session::start() {
-    Logger::instance().info("Session start");
-    do_read_header();
+    LOG_INFO("Session start");
+    last_inbound_ = std::chrono::steady_clock::now();
+    server_.watch_idle(shared_from_this(), server_.config().idle_timeout_ms());
+    do_read();
 }
 
-void Session::do_read_header() {
-    auto self = shared_from_this();
-    asio::async_read(socket_, asio::buffer(header_buf_), [this, self](std::error_code ec, std::size_t) {
-        if (ec) {
-            server_.on_disconnect(self);
-            Logger::instance().info("Session read header error/disconnect", { {"ec", ec.message()}, {"user", session_username_} });
+void Session::check_idle() {
+    asio::post(socket_.get_executor(), [self = shared_from_this()]() {
+        if (self->disconnected_ || self->parking_) return;
+        const auto timeout = std::chrono::milliseconds(self->server_.config().idle_timeout_ms());
+        const auto idle = std::chrono::steady_clock::now() - self->last_inbound_;
+        if (idle < timeout) {
+            // traffic arrived since this deadline was set: come back when the new one is due
+            self->server_.watch_idle(self, static_cast<std::size_t>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(timeout - idle).count()));
             return;
         }
-        uint32_t len = parse_length(header_buf_);
-        if (len == 0) { do_read_header(); return; }
-        do_read_body(len);
+        Metrics::instance().inc(Counter::IdleReaped);
+        LOG_INFO("Reaping idle session", { {"user", self->session_username_},
+            {"idle_ms", static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(idle).count())} });
+        self->disconnect();
+        boost::system::error_code ignored;
+        self->socket_.close(ignored);
     });
 }
 
-void Session::do_read_body(uint32_t body_len) {
-    message_body_buffer_.assign(body_len, 0);
+void Session::do_read() {
+    const ServerConfig& cfg = server_.config();
+    if (recv_begin_ == recv_end_) {
+        recv_begin_ = recv_end_ = 0;
+        // give back memory after an unusually large frame
+        if (recv_buffer_.size() > 4 * cfg.recv_buffer_initial) {
+            std::vector<uint8_t> large = take_frame_buffer(cfg.recv_buffer_initial);
+            large.resize(cfg.recv_buffer_initial);
+            recv_buffer_.swap(large);
+            recycle_frame_buffer(std::move(large));
+        }
+    }
+    if (recv_end_ == recv_buffer_.size()) {
+        if (recv_begin_ > 0) {
+            // move the partial frame to the front
+            std::memmove(recv_buffer_.data(), recv_buffer_.data() + recv_begin_, recv_end_ - recv_begin_);
+            recv_end_ -= recv_begin_;
+            recv_begin_ = 0;
+        } else {
+            recv_buffer_.resize(std::min(recv_buffer_.size() * 2, cfg.max_frame_size + 4));
+        }
+    }
+
     auto self = shared_from_this();
-    asio::async_read(socket_, asio::buffer(message_body_buffer_), [this, self](std::error_code ec, std::size_t) {
+    read_pending_ = true;
+    socket_.async_read_some(asio::buffer(recv_buffer_.data() + recv_end_, recv_buffer_.size() - recv_end_),
+        [this, self](std::error_code ec, std::size_t bytes_read) {
+        read_pending_ = false;
+        if (ec == std::errc::operation_canceled && parking_) {
+            try_park();
+            return;
+        }
         if (ec) {
-            server_.on_disconnect(self);
-            Logger::instance().info("Session read body error/disconnect", { {"ec", ec.message()}, {"user", session_username_} });
+            disconnect();
+            try_park();
+            LOG_INFO("Session read error/disconnect", { {"ec", ec.message()}, {"user", session_username_},
+                {"write_calls", write_calls_}, {"avg_frames_per_write", write_calls_ ? static_cast<double>(frames_written_) / write_calls_ : 0.0} });
             return;
         }
-        std::string s(message_body_buffer_.begin(), message_body_buffer_.end());
-
-        // Log a redacted/preview copy of the JSON so we can see content without exposing passwords
-        json redacted = redact_for_logging(s);
-        Logger::instance().debug("Received JSON", { {"from", session_username_}, {"json_len", static_cast<uint64_t>(s.size())}, {"payload", redacted} });
+        recv_end_ += bytes_read;
+        last_inbound_ = std::chrono::steady_clock::now();
+        const bool ok = process_received_frames();
+        if (parking_) try_park();
+        else if (ok) do_read();
+    });
+}
 
-        try {
-            json j = json::parse(s);
-            process_message(j);
-        } catch (const std::exception& ex) {
-            Logger::instance().error("Bad JSON parse", { {"what", ex.what()}, {"payload_preview", preview_text(s, 200)} });
+// Handle every complete frame in the receive buffer. Returns false if the
+// peer violated the framing and the session is being closed.
+bool Session::process_received_frames() {
+    const std::size_t max_frame = server_.config().max_frame_size;
+    while (recv_end_ - recv_begin_ >= 4) {
+        const uint8_t* p = recv_buffer_.data() + recv_begin_;
+        uint32_t len = parse_length(p);
+        if (len > max_frame) {
+            LOG_WARN("Frame too large, closing session", { {"len", len}, {"max", static_cast<uint64_t>(max_frame)}, {"user", session_username_} });
+            json err = { {"type", "error"}, {"error", "frame_too_large"} };
+            close_after_write_ = true;
+            deliver(err);
+            return false;
         }
-        do_read_header();
-    });
+        if (recv_end_ - recv_begin_ - 4 < len) {
+            // partial frame: make sure the buffer can hold all of it
+            if (recv_buffer_.size() - recv_begin_ < 4 + static_cast<std::size_t>(len)) {
+                std::memmove(recv_buffer_.data(), p, recv_end_ - recv_begin_);
+                recv_end_ -= recv_begin_;
+                recv_begin_ = 0;
+                if (recv_buffer_.size() < 4 + static_cast<std::size_t>(len)) recv_buffer_.resize(4 + static_cast<std::size_t>(len));
+            }
+            break;
+        }
+        recv_begin_ += 4 + len;
+        if (len > 0) handle_frame(p + 4, len);
+        if (close_after_write_) return false; // flooding: stop reading, the error goes out first
+    }
+    return true;
+}
+
+void Session::handle_frame(const uint8_t* payload, std::size_t len) {
+    json j;
+    try {
+        const auto start = std::chrono::steady_clock::now();
+        j = decode_payload(payload, len);
+        Metrics::instance().observe(Histogram::Parse, static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+    } catch (const std::exception& ex) {
+        LOG_ERROR("Bad JSON parse", { {"what", ex.what()}, {"payload_preview", preview_text(std::string(payload, payload + std::min<std::size_t>(len, 201)), 200)} });
+        return;
+    }
+
+    std::size_t type_tag = 0;
+    if (j.is_object()) {
+        auto it = j.find("type");
+        if (it != j.end() && it->is_string()) type_tag = wire_type_tag(it->get<std::string>());
+    }
+    Metrics::instance().count_frames(FrameDirection::In, type_tag, 1, len + 4);
+
+    // Log a redacted/preview copy of the JSON so we can see content without exposing passwords
+    LOG_DEBUG("Received JSON", { {"from", session_username_}, {"json_len", static_cast<uint64_t>(len)}, {"payload", redact_for_logging(j)} });
+
+    try {
+        process_message(j);
+    } catch (const std::exception& ex) {
+        LOG_ERROR("Message handling failed", { {"what", ex.what()}, {"user", session_username_} });
+    }
 }
 
 void Session::process_message(const json& j) {
-    // message types: register, login, message, private, history, heartbeat, list_users
+    // message types: hello, register, login, message, private, history, search, heartbeat, list_users
     std::string type = j.value("type", "");
-    Logger::instance().debug("Processing message", { {"type", type}, {"user", session_username_} });
+    LOG_DEBUG("Processing message", { {"type", type}, {"user", session_username_} });
+    if (!admit_frame(type)) return;
+
+    if (type == "hello") {
+        // pick the first encoding the client offers that we support; JSON otherwise
+        WireEncoding chosen = WireEncoding::Json;
+        if (server_.config().enable_binary_protocol && j.contains("encodings") && j["encodings"].is_array()) {
+            for (const auto& name : j["encodings"]) {
+                WireEncoding candidate;
+                if (name.is_string() && parse_wire_encoding(name.get<std::string>(), candidate)) { chosen = candidate; break; }
+            }
+        }
+        // compression only changes how frames are written, so it can start with the next write;
+        // compressed frames are flagged in their length prefix
+        const ServerConfig& cfg = server_.config();
+        if (!deflater_ && cfg.enable_compression && compression_supported() && j.contains("compression") && j["compression"].is_array()) {
+            for (const auto& name : j["compression"]) {
+                if (name == "deflate") {
+                    deflater_ = std::make_unique<FrameDeflater>(cfg.compress_level, cfg.compress_window_bits);
+                    break;
+                }
+            }
+        }
+        json features = json::array();
+        if (j.contains("features") && j["features"].is_array()) {
+            for (const auto& name : j["features"]) {
+                if (name == "history_pages") {
+                    paged_history_ = true;
+                    features.push_back(name);
+                }
+            }
+        }
+        json r = { {"type","hello_result"}, {"encoding", wire_encoding_name(chosen)}, {"compression", deflater_ ? "deflate" : "none"},
+                   {"features", std::move(features)} };
+        deliver(r); // the reply itself still goes out in the old encoding
+        encoding_.store(chosen, std::memory_order_release);
+        LOG_INFO("Wire encoding negotiated", { {"encoding", wire_encoding_name(chosen)}, {"compression", deflater_ ? "deflate" : "none"} });
 
-    if (type == "register") {
+    } else if (type == "register") {
         std::string user = j.value("username", "");
         std::string pass = j.value("password", "");
-        bool ok = server_.user_store().register_user(user, pass);
-        json r = { {"type","register_result"}, {"ok", ok} };
-        if (!ok) {
-            r["reason"] = "username_exists";
-            Logger::instance().warn("Register failed", { {"username", user}, {"reason", "username_exists"} });
-        } else {
-            Logger::instance().info("User registered (via session)", { {"username", user} });
+        if (user.size() > kMaxUserNameLength) {
+            json r = { {"type","register_result"}, {"ok", false}, {"reason", "invalid_username"} };
+            LOG_WARN("Register rejected - username too long", { {"len", static_cast<uint64_t>(user.size())} });
+            deliver(r);
+            return;
+        }
+        // hashing is expensive: run it on the auth pool and finish on this session's strand
+        auto self = shared_from_this();
+        bool queued = server_.auth_pool().try_submit([this, self, user, pass]() {
+            bool ok = server_.user_store().register_user(user, pass);
+            asio::post(socket_.get_executor(), [this, self, user, ok]() { complete_register(user, ok); });
+        });
+        if (queued) ++auth_pending_;
+        if (!queued) {
+            json r = { {"type","register_result"}, {"ok", false}, {"reason", "busy"} };
+            LOG_WARN("Register rejected - auth pool saturated", { {"username", user} });
+            deliver(r);
         }
-        deliver(r.dump());
 
     } else if (type == "login") {
         std::string user = j.value("username", "");
         std::string pass = j.value("password", "");
-        bool ok = server_.user_store().check_login(user, pass);
-        json r = { {"type","login_result"}, {"ok", ok} };
-        if (!ok) {
-            r["reason"] = "invalid";
-            Logger::instance().warn("Login failed", { {"username", user}, {"reason", "invalid"} });
-        } else {
-            session_username_ = user;
-            server_.on_login(shared_from_this(), user);
-            Logger::instance().info("Login success", { {"username", user} });
-			r["username"] = user;
-        }
-		Logger::instance().info("login_result JSON", {{"json", r.dump()}});
-        deliver(r.dump());
-        if (ok) {
-            // send recent history
-            auto hs = server_.message_store().get_messages_for_user(user, 100);
-            for (auto& m : hs) {
-                json mj = {
-                    {"type", m.to.empty() ? "message" : "private"},
-                    {"from", m.from},
-                    {"to", m.to},
-                    {"text", m.text},
-                    {"ts", m.ts}
-                };
-                deliver(mj.dump());
-            }
+        if (user.size() > kMaxUserNameLength) {
+            json r = { {"type","login_result"}, {"ok", false}, {"reason", "invalid_username"} };
+            LOG_WARN("Login rejected - username too long", { {"len", static_cast<uint64_t>(user.size())} });
+            deliver(r);
+            return;
+        }
+        auto self = shared_from_this();
+        bool queued = server_.auth_pool().try_submit([this, self, user, pass]() {
+            bool ok = server_.user_store().check_login(user, pass);
+            asio::post(socket_.get_executor(), [this, self, user, ok]() { complete_login(user, ok); });
+        });
+        if (queued) ++auth_pending_;
+        if (!queued) {
+            json r = { {"type","login_result"}, {"ok", false}, {"reason", "busy"} };
+            LOG_WARN("Login rejected - auth pool saturated", { {"username", user} });
+            deliver(r);
         }
 
     } else if (type == "message") {
         // Reject messages from not-logged-in sessions
         if (session_username_.empty()) {
             json err = { {"type", "error"}, {"error", "not_logged_in"} };
-            deliver(err.dump());
-            Logger::instance().warn("Message rejected - not logged in");
+            deliver(err);
+            LOG_WARN("Message rejected - not logged in");
+            return;
+        }
+
+        std::string room = j.value("room", server_.config().default_room);
+        if (std::find(joined_rooms_.begin(), joined_rooms_.end(), room) == joined_rooms_.end()) {
+            json err = { {"type", "error"}, {"error", "not_in_room"}, {"room", room} };
+            deliver(err);
+            LOG_WARN("Message rejected - not in room", { {"username", session_username_}, {"room", room} });
             return;
         }
 
         std::string text = j.value("text", "");
         uint64_t ts = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
             std::chrono::system_clock::now().time_since_epoch()).count());
-        ChatMsg cm{ session_username_, "", text, ts };
-        server_.message_store().add_message(cm);
+        // the store copies what it keeps, so the message can borrow these strings
+        ChatMsg cm{ SharedText(nullptr, session_username_), "", SharedText(nullptr, text), ts, 0, SharedText(nullptr, room) };
+        uint64_t id = server_.message_store().add_message(cm);
+        if (id == 0) {
+            json err = { {"type", "error"}, {"error", "message_too_large"} };
+            deliver(err);
+            return;
+        }
 
-        // broadcast to all INCLUDING sender (so sender will also receive the canonical message)
-        json mj = { {"type","message"}, {"from", cm.from}, {"text", cm.text}, {"ts", cm.ts} };
-        server_.broadcast(mj.dump()); // do not exclude sender
+        // fan out to the room INCLUDING sender (so sender will also receive the canonical message)
+        json mj = { {"type","message"}, {"id", id}, {"from", cm.from.view()}, {"room", cm.room.view()}, {"text", text}, {"ts", cm.ts} };
+        server_.broadcast_to_room(room, mj);
 
         // Log a preview at INFO and the full text at DEBUG
-        Logger::instance().info("Broadcast message", { {"from", cm.from}, {"len", static_cast<uint64_t>(text.size())}, {"text_preview", preview_text(text, 200)} });
-        Logger::instance().debug("Broadcast full message", { {"from", cm.from}, {"text", text} });
+        LOG_INFO("Room message", { {"from", cm.from.view()}, {"room", room}, {"len", static_cast<uint64_t>(text.size())}, {"text_preview", preview_text(text, 200)} });
+        LOG_DEBUG("Room full message", { {"from", cm.from.view()}, {"room", room}, {"text", text} });
 
     } else if (type == "private") {
         // Reject private message if not logged in
         if (session_username_.empty()) {
             json err = { {"type", "error"}, {"error", "not_logged_in"} };
-            deliver(err.dump());
-            Logger::instance().warn("Private message rejected - not logged in");
+            deliver(err);
+            LOG_WARN("Private message rejected - not logged in");
             return;
         }
 
         std::string to = j.value("to", "");
+        if (to.empty() || to.size() > kMaxUserNameLength) {
+            json err = { {"type", "error"}, {"error", "invalid_recipient"} };
+            deliver(err);
+            LOG_WARN("Private message rejected - invalid recipient", { {"username", session_username_}, {"len", static_cast<uint64_t>(to.size())} });
+            return;
+        }
         std::string text = j.value("text", "");
         uint64_t ts = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
             std::chrono::system_clock::now().time_since_epoch()).count());
-        ChatMsg cm{ session_username_, to, text, ts };
-        server_.message_store().add_message(cm);
+        ChatMsg cm{ SharedText(nullptr, session_username_), SharedText(nullptr, to), SharedText(nullptr, text), ts, 0, "" };
+        uint64_t id = server_.message_store().add_message(cm);
+        if (id == 0) {
+            json err = { {"type", "error"}, {"error", "message_too_large"} };
+            deliver(err);
+            return;
+        }
 
-        json mj = { {"type","private"}, {"from", cm.from}, {"to", cm.to}, {"text", cm.text}, {"ts", cm.ts} };
-        server_.send_to_user(to, mj.dump());
+        json mj = { {"type","private"}, {"id", id}, {"from", cm.from.view()}, {"to", cm.to.view()}, {"text", text}, {"ts", cm.ts} };
+        server_.send_to_user(to, mj);
         // also deliver to sender
-        deliver(mj.dump());
+        deliver(mj);
 
-        Logger::instance().info("Private message", { {"from", cm.from}, {"to", cm.to}, {"len", static_cast<uint64_t>(text.size())}, {"text_preview", preview_text(text, 200)} });
-        Logger::instance().debug("Private message full", { {"from", cm.from}, {"to", cm.to}, {"text", text} });
+        LOG_INFO("Private message", { {"from", cm.from.view()}, {"to", cm.to.view()}, {"len", static_cast<uint64_t>(text.size())}, {"text_preview", preview_text(text, 200)} });
+        LOG_DEBUG("Private message full", { {"from", cm.from.view()}, {"to", cm.to.view()}, {"text", text} });
 
     } else if (type == "heartbeat") {
         json r = { {"type","pong"} };
-        deliver(r.dump());
+        deliver(r);
 
     } else if (type == "history") {
-        size_t n = j.value("n", 50);
-        auto hs = server_.message_store().get_messages_for_user(session_username_, n);
-        for (auto& m : hs) {
-            json mj = {
-                {"type", m.to.empty() ? "message" : "private"},
-                {"from", m.from},
-                {"to", m.to},
-                {"text", m.text},
-                {"ts", m.ts}
-            };
-            deliver(mj.dump());
+        const std::size_t page_max = server_.config().history_page_max;
+        // legacy form: {"n": N} answered with one frame per message
+        if (!paged_history_ && !j.contains("before") && !j.contains("after") && !j.contains("limit") && !j.contains("room")) {
+            size_t n = std::min<size_t>(j.value("n", 50), page_max);
+            deliver_history(server_.message_store().get_messages_for_user(session_username_, n, joined_rooms_));
+            return;
+        }
+        // paged form: one history_result frame, walking back from "before" or forward from "after"
+        std::string room = j.value("room", "");
+        std::vector<std::string> rooms = joined_rooms_;
+        if (!room.empty()) {
+            if (std::find(joined_rooms_.begin(), joined_rooms_.end(), room) == joined_rooms_.end()) {
+                json err = { {"type", "error"}, {"error", "not_in_room"}, {"room", room} };
+                deliver(err);
+                return;
+            }
+            rooms = { room };
+        }
+        uint64_t before = j.value("before", uint64_t{0});
+        uint64_t after = j.value("after", uint64_t{0});
+        size_t limit = std::min<size_t>(j.value("limit", kHistoryPageDefault), page_max);
+        HistoryPage page = server_.message_store().get_history_page(room.empty() ? session_username_ : std::string(),
+                                                                    rooms, before, after, limit);
+        deliver_history_page(page, after != 0, room, FrameClass::Critical);
+
+    } else if (type == "search") {
+        if (session_username_.empty()) {
+            json err = { {"type", "error"}, {"error", "not_logged_in"} };
+            deliver(err);
+            return;
+        }
+        SearchQuery q;
+        q.text = j.value("q", "");
+        q.from = j.value("from", "");
+        q.to = j.value("to", "");
+        q.since = j.value("since", uint64_t{0});
+        q.until = j.value("until", uint64_t{0});
+        q.before_id = j.value("before", uint64_t{0});
+        q.limit = std::min<size_t>(j.value("limit", kSearchPageDefault), server_.config().history_page_max);
+        // same visibility as history, optionally narrowed to one joined room
+        std::string room = j.value("room", "");
+        if (room.empty()) {
+            q.user = session_username_;
+            q.rooms = joined_rooms_;
+        } else if (std::find(joined_rooms_.begin(), joined_rooms_.end(), room) != joined_rooms_.end()) {
+            q.rooms = { room };
+        } else {
+            json err = { {"type", "error"}, {"error", "not_in_room"}, {"room", room} };
+            deliver(err);
+            return;
+        }
+        SearchPage page = server_.message_store().search(q);
+        if (page.too_broad) {
+            json err = { {"type", "error"}, {"error", "query_too_broad"} };
+            deliver(err);
+            return;
+        }
+        json r = page_frame("search_result", page, false);
+        r["q"] = q.text;
+        deliver(r);
+
+    } else if (type == "join" || type == "leave") {
+        if (session_username_.empty()) {
+            json err = { {"type", "error"}, {"error", "not_logged_in"} };
+            deliver(err);
+            return;
+        }
+        std::string room = j.value("room", "");
+        json r = { {"type", type + "_result"}, {"room", room} };
+        if (room.empty() || room.size() > kMaxRoomNameLength) {
+            r["ok"] = false;
+            r["reason"] = "invalid_room";
+        } else if (type == "join") {
+            bool ok = join(room);
+            r["ok"] = ok;
+            if (!ok) r["reason"] = "too_many_rooms";
+            deliver(r);
+            if (!ok) return;
+            if (paged_history_) {
+                HistoryPage page = server_.message_store().get_history_page("", { room }, 0, 0, kJoinHistoryCount);
+                deliver_history_page(page, false, room, FrameClass::Droppable);
+            } else {
+                deliver_history(server_.message_store().get_room_messages(room, kJoinHistoryCount));
+            }
+            return;
+        } else {
+            auto it = std::find(joined_rooms_.begin(), joined_rooms_.end(), room);
+            r["ok"] = it != joined_rooms_.end();
+            if (it != joined_rooms_.end()) {
+                joined_rooms_.erase(it);
+                server_.leave_room(room, shared_from_this());
+            } else {
+                r["reason"] = "not_in_room";
+            }
         }
+        deliver(r);
+
+    } else if (type == "stats") {
+        if (session_username_.empty()) {
+            json err = { {"type", "error"}, {"error", "not_logged_in"} };
+            deliver(err);
+            return;
+        }
+        json r = { {"type", "stats_result"}, {"metrics", Metrics::instance().to_json()} };
+        deliver(r);
+
+    } else if (type == "list_rooms") {
+        json r = { {"type", "room_list"}, {"rooms", server_.room_list()}, {"joined", joined_rooms_} };
+        deliver(r);
 
     } else if (type == "list_users") {
-        // respond with current online users to this session only
-        auto users = server_.online_usernames();
-        json r;
-        r["type"] = "user_list";
-        r["users"] = users;
-        deliver(r.dump());
+        // respond with a presence snapshot to this session only (also how clients resync after a version gap)
+        deliver(server_.presence_snapshot());
 
     } else if (type == "logout") {
-        Logger::instance().info("User requested logout", { {"username", session_username_} });
+        LOG_INFO("User requested logout", { {"username", session_username_} });
         socket_.close();
         return;
     } else {
-        Logger::instance().warn("Unknown message type", { {"type", type} });
+        LOG_WARN("Unknown message type", { {"type", type} });
+    }
+}
+
+void Session::complete_register(const std::string& user, bool ok) {
+    --auth_pending_;
+    json r = { {"type","register_result"}, {"ok", ok} };
+    if (!ok) {
+        r["reason"] = "username_exists";
+        LOG_WARN("Register failed", { {"username", user}, {"reason", "username_exists"} });
+    } else {
+        LOG_INFO("User registered (via session)", { {"username", user} });
+    }
+    deliver(r);
+    if (parking_) try_park();
+}
+
+bool Session::admit_frame(const std::string& type) {
+    const RateClass cls = rate_class_of(type);
+    if (cls == RateClass::kCount) return true;
+    const ServerConfig& cfg = server_.config();
+    const std::size_t i = static_cast<std::size_t>(cls);
+    const auto now = last_inbound_; // frames of one read share its timestamp
+    uint64_t retry_ms = 0;
+    if (!rate_buckets_[i].take(now, cfg.session_rate[i])) {
+        retry_ms = rate_buckets_[i].retry_ms(cfg.session_rate[i]);
+    } else if (user_rate_) {
+        std::lock_guard<std::mutex> lk(user_rate_->mutex);
+        TokenBucket& bucket = user_rate_->buckets[i];
+        if (bucket.take(now, cfg.user_rate[i])) return true;
+        retry_ms = bucket.retry_ms(cfg.user_rate[i]);
+    } else {
+        return true;
+    }
+
+    Metrics& metrics = Metrics::instance();
+    metrics.inc(Counter::FramesRateLimited);
+    json err = { {"type","error"}, {"error","rate_limited"}, {"frame", type}, {"retry_ms", std::max<uint64_t>(retry_ms, 1)} };
+    if (!rate_strikes_.take(now, RateLimit{ 1.0, cfg.rate_strikes })) {
+        LOG_WARN("Rate limits exceeded repeatedly, closing session", { {"user", session_username_}, {"class", rate_class_name(cls)} });
+        metrics.inc(Counter::RateLimitDisconnects);
+        close_after_write_ = true;
+    }
+    deliver(err);
+    return false;
+}
+
+void Session::complete_login(const std::string& user, bool ok) {
+    --auth_pending_;
+    if (disconnected_) return; // the peer went away while its credentials were being checked
+    json r = { {"type","login_result"}, {"ok", ok} };
+    if (!ok) {
+        r["reason"] = "invalid";
+        LOG_WARN("Login failed", { {"username", user}, {"reason", "invalid"} });
+    } else {
+        session_username_ = user;
+        user_rate_ = server_.user_rate_state(user);
+        server_.on_login(shared_from_this(), user);
+        join(server_.config().default_room);
+        LOG_INFO("Login success", { {"username", user} });
+        r["username"] = user;
+    }
+    LOG_INFO("login_result JSON", {{"json", r.dump()}});
+    deliver(r);
+    if (ok) {
+        // send recent history of the rooms joined on login plus private messages
+        if (paged_history_) {
+            HistoryPage page = server_.message_store().get_history_page(user, joined_rooms_, 0, 0, kLoginHistoryCount);
+            deliver_history_page(page, false, "", FrameClass::Droppable);
+        } else {
+            deliver_history(server_.message_store().get_messages_for_user(user, kLoginHistoryCount, joined_rooms_));
+        }
+    }
+    if (parking_) try_park();
+}
+
+bool Session::join(const std::string& room) {
+    if (std::find(joined_rooms_.begin(), joined_rooms_.end(), room) != joined_rooms_.end()) return true;
+    if (joined_rooms_.size() >= server_.config().max_rooms_per_user) return false;
+    server_.join_room(room, shared_from_this());
+    joined_rooms_.push_back(room);
+    return true;
+}
+
+void Session::deliver_history(const std::vector<ChatMsg>& msgs) {
+    for (auto& m : msgs) deliver(history_entry(m), FrameClass::Droppable);
+}
+
+void Session::deliver_history_page(const HistoryPage& page, bool forward, const std::string& room, FrameClass cls) {
+    json r = page_frame("history_result", page, forward);
+    if (!room.empty()) r["room"] = room;
+    deliver(r, cls);
+}
+
+void Session::deliver(const json& message, FrameClass cls) {
+    deliver_frame(encode_frame(message, encoding()), cls, wire_type_tag(message.value("type", "")));
+}
+
+void Session::deliver_frame(SharedFrame frame, FrameClass cls, std::size_t type_tag) {
+    const ServerConfig& cfg = server_.config();
+    bool writing, abandon = false, new_high_water = false;
+    std::size_t dropped = 0, depth_frames = 0, depth_bytes = 0;
+    const auto now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lk(write_mutex_);
+        if (send_abandoned_ || handed_off_) return;
+        writing = !outgoing_message_queue_.empty();
+        queued_bytes_ += frame->size();
+        outgoing_message_queue_.push_back({ std::move(frame), cls, type_tag, now });
+        Metrics::instance().inc(Counter::FramesQueued);
+
+        if (over_queue_limit_locked()) {
+            if (cfg.slow_consumer_policy != SlowConsumerPolicy::Disconnect) dropped = drop_oldest_locked();
+            if (over_queue_limit_locked()) {
+                // nothing left that may be dropped: give up on this consumer, keeping only the in-flight batch
+                abandon = send_abandoned_ = true;
+                dropped += outgoing_message_queue_.size() - write_batch_frames_;
+                outgoing_message_queue_.erase(outgoing_message_queue_.begin() + write_batch_frames_, outgoing_message_queue_.end());
+                queued_bytes_ = 0;
+                for (const auto& f : outgoing_message_queue_) queued_bytes_ += f.data->size();
+            } else if (dropped && cfg.slow_consumer_policy == SlowConsumerPolicy::Coalesce) {
+                queue_drop_notice_locked(dropped);
+            }
+        }
+        if (outgoing_message_queue_.size() > queue_high_water_frames_ || queued_bytes_ > queue_high_water_bytes_) {
+            queue_high_water_frames_ = std::max(queue_high_water_frames_, outgoing_message_queue_.size());
+            queue_high_water_bytes_ = std::max(queue_high_water_bytes_, queued_bytes_);
+            depth_frames = queue_high_water_frames_;
+            depth_bytes = queue_high_water_bytes_;
+            new_high_water = true;
+        }
+    }
+    if (new_high_water) server_.record_queue_depth(depth_frames, depth_bytes);
+    if (dropped) server_.record_frames_dropped(dropped);
+    if (abandon) {
+        server_.record_slow_consumer_disconnect();
+        asio::post(socket_.get_executor(), [self = shared_from_this()]() {
+            LOG_WARN("Disconnecting slow consumer", { {"user", self->session_username_} });
+            self->disconnect();
+            boost::system::error_code ignored;
+            self->socket_.close(ignored);
+            self->try_park();
+        });
+        return;
+    }
+    // the write itself is started on the session's strand
+    if (!writing) asio::post(socket_.get_executor(), [self = shared_from_this()]() { self->do_write(); });
+}
+
+bool Session::over_queue_limit_locked() const {
+    const ServerConfig& cfg = server_.config();
+    return outgoing_message_queue_.size() > cfg.send_queue_max_frames || queued_bytes_ > cfg.send_queue_max_bytes;
+}
+
+std::size_t Session::drop_oldest_locked() {
+    const ServerConfig& cfg = server_.config();
+    std::size_t frames = outgoing_message_queue_.size(), dropped = 0;
+    // the in-flight prefix is referenced by write_buffers_ and must stay put
+    auto out = outgoing_message_queue_.begin() + write_batch_frames_;
+    for (auto it = out; it != outgoing_message_queue_.end(); ++it) {
+        bool over = frames - dropped > cfg.send_queue_max_frames || queued_bytes_ > cfg.send_queue_max_bytes;
+        if (over && it->cls == FrameClass::Droppable) {
+            queued_bytes_ -= it->data->size();
+            ++dropped;
+            continue;
+        }
+        if (out != it) *out = std::move(*it);
+        ++out;
     }
+    outgoing_message_queue_.erase(out, outgoing_message_queue_.end());
+    frames_dropped_ += dropped;
+    return dropped;
 }
 
-void Session::deliver(const std::string& json_text) {
-    auto frame = make_frame(json_text);
-    bool writing = !outgoing_message_queue_.empty();
-    outgoing_message_queue_.push_back(std::move(frame));
-    if (!writing) do_write();
+void Session::queue_drop_notice_locked(std::size_t dropped) {
+    pending_drop_notice_ += dropped;
+    json notice = { {"type", "frames_dropped"}, {"count", pending_drop_notice_} };
+    SharedFrame frame = encode_frame(notice, encoding());
+    // refresh a notice that has not been written yet instead of queueing another one
+    for (auto it = outgoing_message_queue_.begin() + write_batch_frames_; it != outgoing_message_queue_.end(); ++it) {
+        if (it->cls != FrameClass::Notice) continue;
+        queued_bytes_ = queued_bytes_ - it->data->size() + frame->size();
+        it->data = std::move(frame);
+        return;
+    }
+    queued_bytes_ += frame->size();
+    outgoing_message_queue_.push_back({ std::move(frame), FrameClass::Notice, wire_type_tag("frames_dropped"), std::chrono::steady_clock::now() });
+    Metrics::instance().inc(Counter::FramesQueued);
 }
 
 void Session::do_write() {
+    // gather everything queued (up to the configured caps) into a single write;
+    // the frames stay at the queue front until the write completes
+    const ServerConfig& cfg = server_.config();
+    std::size_t batch_bytes = 0, batch_frames = 0;
+    write_buffers_.clear();
+    {
+        std::lock_guard<std::mutex> lk(write_mutex_);
+        if (writes_paused_) return; // left queued for the next process
+        for (const auto& frame : outgoing_message_queue_) {
+            if (batch_frames &&
+                (batch_frames >= cfg.write_batch_max_frames || batch_bytes + frame.data->size() > cfg.write_batch_max_bytes)) break;
+            if (!deflater_) write_buffers_.emplace_back(asio::buffer(*frame.data));
+            ++batch_frames;
+            batch_bytes += frame.data->size();
+            if (frame.cls == FrameClass::Notice) pending_drop_notice_ = 0; // in flight: later drops need a new notice
+        }
+        write_batch_frames_ = batch_frames;
+    }
+    if (deflater_) compress_batch();
+
     auto self = shared_from_this();
-    boost::asio::async_write(socket_, boost::asio::buffer(outgoing_message_queue_.front()), [this, self](std::error_code ec, std::size_t) {
+    boost::asio::async_write(socket_, write_buffers_, [this, self](std::error_code ec, std::size_t bytes_written) {
         if (ec) {
-            server_.on_disconnect(self);
-            Logger::instance().info("Session write error/disconnect", { {"ec", ec.message()}, {"user", session_username_} });
+            disconnect();
+            try_park();
+            LOG_INFO("Session write error/disconnect", { {"ec", ec.message()}, {"user", session_username_} });
             return;
         }
-        outgoing_message_queue_.pop_front();
-        if (!outgoing_message_queue_.empty()) do_write();
+        ++write_calls_;
+        frames_written_ += write_batch_frames_;
+        server_.record_write(write_batch_frames_, bytes_written);
+
+        bool more;
+        {
+            std::lock_guard<std::mutex> lk(write_mutex_);
+            Metrics& metrics = Metrics::instance();
+            const auto now = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < write_batch_frames_; ++i) {
+                const OutgoingFrame& f = outgoing_message_queue_[i];
+                queued_bytes_ -= f.data->size();
+                metrics.count_frames(FrameDirection::Out, f.type_tag, 1, f.data->size());
+                metrics.observe(Histogram::QueueToWrite, static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(now - f.enqueued).count()));
+            }
+            outgoing_message_queue_.erase(outgoing_message_queue_.begin(), outgoing_message_queue_.begin() + write_batch_frames_);
+            more = !outgoing_message_queue_.empty();
+            write_batch_frames_ = 0;
+        }
+        if (more) {
+            do_write();
+        } else if (close_after_write_) {
+            disconnect();
+            boost::system::error_code ignored;
+            socket_.close(ignored);
+        }
+        if (parking_) try_park();
     });
 }
 
+// Compress the in-flight batch with this connection's stream. The batch prefix
+// of the queue is never dropped or reordered while in flight, so its frames are
+// compressed outside the lock (fan-out threads keep queueing meanwhile) and the
+// compressed copies swapped in afterwards. Shared fan-out frames stay intact.
+void Session::compress_batch() {
+    std::vector<SharedFrame> frames;
+    {
+        std::lock_guard<std::mutex> lk(write_mutex_);
+        for (std::size_t i = 0; i < write_batch_frames_; ++i) frames.push_back(outgoing_message_queue_[i].data);
+    }
+    const std::size_t min_bytes = server_.config().compress_min_bytes;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    for (auto& frame : frames) {
+        if (frame->size() - 4 < min_bytes) continue;
+        SharedFrame compressed = deflater_->compress(*frame);
+        if (!compressed) {
+            // the peer's inflater would be out of step from here on
+            LOG_WARN("Compression failed, closing", { {"user", session_username_} });
+            close_after_write_ = true;
+            break;
+        }
+        bytes_in += frame->size();
+        bytes_out += compressed->size();
+        frame = std::move(compressed);
+    }
+    if (bytes_in) {
+        Metrics::instance().inc(Counter::CompressInBytes, bytes_in);
+        Metrics::instance().inc(Counter::CompressOutBytes, bytes_out);
+    }
+    std::lock_guard<std::mutex> lk(write_mutex_);
+    for (std::size_t i = 0; i < frames.size(); ++i) {
+        OutgoingFrame& f = outgoing_message_queue_[i];
+        queued_bytes_ = queued_bytes_ - f.data->size() + frames[i]->size();
+        f.data = std::move(frames[i]);
+        write_buffers_.emplace_back(asio::buffer(*f.data));
+    }
+}
+
+Session::~Session() {
+    // anything still queued (including an unfinished in-flight batch) is never written
+    if (!outgoing_message_queue_.empty()) Metrics::instance().inc(Counter::FramesUnsent, outgoing_message_queue_.size());
+    recycle_frame_buffer(std::move(recv_buffer_));
+}
+
+void Session::disconnect() {
+    if (disconnected_) return;
+    disconnected_ = true;
+    Metrics::instance().inc(Counter::ConnectionsClosed);
+    server_.on_disconnect(shared_from_this());
+
+    std::size_t hw_frames, hw_bytes;
+    uint64_t dropped;
+    {
+        std::lock_guard<std::mutex> lk(write_mutex_);
+        hw_frames = queue_high_water_frames_;
+        hw_bytes = queue_high_water_bytes_;
+        dropped = frames_dropped_;
+    }
+    LOG_INFO("Session send queue", { {"user", session_username_}, {"high_water_frames", static_cast<uint64_t>(hw_frames)},
+        {"high_water_bytes", static_cast<uint64_t>(hw_bytes)}, {"frames_dropped", dropped} });
+}
+
+void Session::park(std::function<void(bool)> parked) {
+    asio::post(socket_.get_executor(), [self = shared_from_this(), parked = std::move(parked)]() mutable {
+        self->parking_ = true;
+        self->parked_ = std::move(parked);
+        {
+            std::lock_guard<std::mutex> lk(self->write_mutex_);
+            self->writes_paused_ = true;
+        }
+        self->try_park();
+    });
+}
+
+// Called on the strand whenever an operation that blocks parking finishes
+void Session::try_park() {
+    if (!parked_) return;
+    // a deflate stream cannot be moved to another process mid-stream
+    bool movable = !disconnected_ && !close_after_write_ && !deflater_;
+    if (movable) {
+        if (auth_pending_ > 0) return;
+        {
+            std::lock_guard<std::mutex> lk(write_mutex_);
+            if (write_batch_frames_ > 0) return;
+            movable = !send_abandoned_;
+        }
+        if (read_pending_) {
+            // no write is in flight, so this only aborts the read
+            boost::system::error_code ignored;
+            socket_.cancel(ignored);
+            return;
+        }
+    }
+    auto parked = std::move(parked_);
+    parked_ = nullptr;
+    parked(movable);
+}
+
+bool Session::export_handoff(HandoffSession& out) {
+    // parked: the strand-only state below no longer changes
+    std::lock_guard<std::mutex> lk(write_mutex_);
+    if (send_abandoned_ || handed_off_) return false;
+    handed_off_ = true;
+    out.fd = socket_.native_handle();
+    out.username = session_username_;
+    out.encoding = encoding();
+    out.paged_history = paged_history_;
+    out.rooms = joined_rooms_;
+    out.unread.assign(recv_buffer_.begin() + static_cast<std::ptrdiff_t>(recv_begin_), recv_buffer_.begin() + static_cast<std::ptrdiff_t>(recv_end_));
+    for (const auto& f : outgoing_message_queue_) out.unsent.insert(out.unsent.end(), f.data->begin(), f.data->end());
+    outgoing_message_queue_.clear();
+    queued_bytes_ = 0;
+    return true;
+}
+
+void Session::resume(HandoffSession&& state) {
+    session_username_ = std::move(state.username);
+    encoding_.store(state.encoding, std::memory_order_release);
+    paged_history_ = state.paged_history;
+    if (!session_username_.empty()) user_rate_ = server_.user_rate_state(session_username_);
+    for (const auto& room : state.rooms) join(room);
+    // what the previous process had queued goes out first, as one opaque frame
+    if (!state.unsent.empty()) deliver_frame(std::make_shared<const std::vector<uint8_t>>(std::move(state.unsent)));
+    if (state.unread.size() > recv_buffer_.size()) recv_buffer_.resize(state.unread.size());
+    std::memcpy(recv_buffer_.data(), state.unread.data(), state.unread.size());
+    recv_end_ = state.unread.size();
+    LOG_INFO("Session resumed", { {"user", session_username_}, {"rooms", static_cast<uint64_t>(joined_rooms_.size())} });
+    start();
+}
+
 std::string Session::username() const { return session_username_; }
@@ -5,27 +5,122 @@
 #include <string>
 #include <vector>   // 
 #include <cstdint>  // 
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <nlohmann/json.hpp>
+#include "protocol.hpp"
+#include "wire_codec.hpp"
+#include "message_store.hpp"
+#include "rate_limiter.hpp"
+#include "handoff.hpp"
 
 class Server; // forward
+class FrameDeflater;
+
+// Delivery class of an outgoing frame, used when a slow consumer's queue overflows
+enum class FrameClass {
+    Critical,  // replies, errors, private messages: never dropped
+    Droppable, // room fan-out, presence deltas, history replay: may be dropped for a slow consumer
+    Notice,    // the coalesced frames_dropped notice (internal)
+};
 
 class Session : public std::enable_shared_from_this<Session> {
 public:
-    Session(boost::asio::ip::tcp::socket socket, Server& server);
+    Session(boost::asio::ip::tcp::socket socket, Server& server, std::size_t shard);
     void start();
-    void deliver(const std::string& json_text);
+    ~Session();
+    void deliver(const nlohmann::json& message, FrameClass cls = FrameClass::Critical);
+    // queue an already encoded frame; safe to call from any thread. type_tag
+    // (see wire_type_tag) only labels the frame in metrics.
+    void deliver_frame(SharedFrame frame, FrameClass cls = FrameClass::Critical, std::size_t type_tag = 0);
     std::string username() const;
+    // io shard (io_context) this session's socket and handlers live on
+    std::size_t shard() const { return shard_; }
+    // called by the idle reaper when this session's wheel slot comes due
+    void check_idle();
+    // rooms this session has joined; only touched on the session's strand
+    const std::vector<std::string>& joined_rooms() const { return joined_rooms_; }
+    // encoding of server->client frames, switched by the "hello" handshake
+    WireEncoding encoding() const { return encoding_.load(std::memory_order_acquire); }
+    // decode and dispatch one inbound payload; the read loop calls this per
+    // frame, benchmarks call it directly
+    void handle_frame(const uint8_t* payload, std::size_t len);
+
+    // hot restart (see HandoffServer). park: stop reading and stop starting
+    // writes, then report on the strand once no read, write or auth check is in
+    // flight; false when the session cannot be moved (compressed or closing).
+    void park(std::function<void(bool movable)> parked);
+    // after park reported true: the state the next process resumes from.
+    // Nothing is queued afterwards. False if the session was dropped meanwhile.
+    bool export_handoff(HandoffSession& out);
+    // in the next process, instead of start(); the server has already
+    // registered the login
+    void resume(HandoffSession&& state);
 
 private:
-    void do_read_header();
-    void do_read_body(uint32_t body_len);
+    void do_read();
+    bool process_received_frames();
     void process_message(const nlohmann::json& j);
+    // charge one frame of this type to the session's and the user's buckets;
+    // false (after answering rate_limited) when either is empty
+    bool admit_frame(const std::string& type);
+    // continuations of register/login once the auth pool has checked the credentials
+    void complete_register(const std::string& user, bool ok);
+    void complete_login(const std::string& user, bool ok);
     void do_write();
+    void compress_batch();
+    bool over_queue_limit_locked() const;
+    std::size_t drop_oldest_locked();
+    void queue_drop_notice_locked(std::size_t dropped);
+    // leave the server's online/room tables exactly once, whichever path noticed the close
+    void disconnect();
+    void try_park();
+    bool join(const std::string& room);
+    void deliver_history(const std::vector<ChatMsg>& msgs);
+    void deliver_history_page(const HistoryPage& page, bool forward, const std::string& room, FrameClass cls);
 
     boost::asio::ip::tcp::socket socket_;
     Server& server_;
-    std::vector<uint8_t> header_buf_;
-    std::vector<uint8_t> message_body_buffer_;
-    std::deque<std::vector<uint8_t>> outgoing_message_queue_;
+    std::size_t shard_;
+    // receive buffer: bytes [recv_begin_, recv_end_) are received but not yet parsed
+    std::vector<uint8_t> recv_buffer_;
+    std::size_t recv_begin_ = 0;
+    std::size_t recv_end_ = 0;
+    bool close_after_write_ = false;
+    bool disconnected_ = false;
+    bool read_pending_ = false;
+    std::size_t auth_pending_ = 0; // register/login checks on the auth pool
+    bool parking_ = false;         // hot restart: no new reads; strand only
+    std::function<void(bool)> parked_;
+    std::chrono::steady_clock::time_point last_inbound_; // last read completion; strand only
+    struct OutgoingFrame {
+        SharedFrame data;
+        FrameClass cls;
+        std::size_t type_tag;
+        std::chrono::steady_clock::time_point enqueued;
+    };
+    std::mutex write_mutex_; // guards the outgoing queue state below (deliver_frame runs on other sessions' threads)
+    std::deque<OutgoingFrame> outgoing_message_queue_;
+    std::size_t queued_bytes_ = 0;
+    std::size_t write_batch_frames_ = 0; // frames at the queue front owned by the in-flight write
+    std::size_t queue_high_water_frames_ = 0;
+    std::size_t queue_high_water_bytes_ = 0;
+    uint64_t frames_dropped_ = 0;
+    uint64_t pending_drop_notice_ = 0; // count carried by the queued frames_dropped notice
+    bool send_abandoned_ = false;      // over the limit with nothing left to drop: the queue is closed
+    bool writes_paused_ = false;       // parked for a hot restart: frames queue up unwritten
+    bool handed_off_ = false;          // exported to the next process: nothing more is queued
+    std::vector<boost::asio::const_buffer> write_buffers_; // gather list of the in-flight batch
+    std::unique_ptr<FrameDeflater> deflater_; // set by "hello" when compression is negotiated; strand only
+    uint64_t write_calls_ = 0;
+    uint64_t frames_written_ = 0;
     std::string session_username_;
+    std::vector<std::string> joined_rooms_;
+    std::array<TokenBucket, kRateClassCount> rate_buckets_; // strand only
+    TokenBucket rate_strikes_;                 // rejections left before the session is closed
+    std::shared_ptr<UserRateState> user_rate_; // set on login
+    bool paged_history_ = false; // "history_pages" negotiated: history arrives as history_result pages
+    std::atomic<WireEncoding> encoding_{WireEncoding::Json};
 };
@@ -0,0 +1,72 @@
+// compression_test.cpp
+#include <gtest/gtest.h>
+#include <zlib.h>
+#include <string>
+#include <vector>
+#include "compression.hpp"
+#include "protocol.hpp"
+
+namespace {
+
+// the client's side of the stream: raw inflate with the preset dictionary
+class Inflater {
+public:
+    Inflater() {
+        inflateInit2(&zs_, -15);
+        const std::string& dict = compression_dictionary();
+        inflateSetDictionary(&zs_, reinterpret_cast<const Bytef*>(dict.data()), static_cast<uInt>(dict.size()));
+    }
+    ~Inflater() { inflateEnd(&zs_); }
+
+    // compressed frame -> payload
+    std::string inflate_frame(const std::vector<uint8_t>& frame) {
+        EXPECT_TRUE(parse_length(frame.data()) & kCompressedFrameFlag);
+        EXPECT_EQ(parse_length(frame.data()) & ~kCompressedFrameFlag, frame.size() - 4);
+        std::vector<uint8_t> in(frame.begin() + 4, frame.end());
+        in.insert(in.end(), { 0x00, 0x00, 0xFF, 0xFF }); // the sync marker the sender leaves off
+        zs_.next_in = in.data();
+        zs_.avail_in = static_cast<uInt>(in.size());
+        std::string out;
+        char buffer[4096];
+        do {
+            zs_.next_out = reinterpret_cast<Bytef*>(buffer);
+            zs_.avail_out = sizeof(buffer);
+            const int rc = inflate(&zs_, Z_SYNC_FLUSH);
+            EXPECT_TRUE(rc == Z_OK || rc == Z_BUF_ERROR) << rc;
+            out.append(buffer, sizeof(buffer) - zs_.avail_out);
+        } while (zs_.avail_out == 0);
+        return out;
+    }
+
+private:
+    z_stream zs_{};
+};
+
+} // namespace
+
+TEST(Compression, FramesInflateInOrder) {
+    ASSERT_TRUE(compression_supported());
+    FrameDeflater deflater(6, 15);
+    Inflater inflater;
+    const std::vector<std::string> payloads = {
+        R"({"type":"message","id":1,"from":"alice","room":"lobby","text":"hello","ts":1700000000000})",
+        R"({"type":"message","id":2,"from":"alice","room":"lobby","text":"hello again","ts":1700000000001})",
+        std::string(20000, 'z'),
+        "",
+    };
+    for (const auto& payload : payloads) {
+        SharedFrame frame = deflater.compress(make_frame(payload));
+        ASSERT_TRUE(frame);
+        EXPECT_EQ(inflater.inflate_frame(*frame), payload);
+    }
+}
+
+TEST(Compression, DictionaryAndHistoryShrinkFrames) {
+    FrameDeflater deflater(6, 15);
+    const std::string payload = R"({"type":"message","id":7,"from":"alice","room":"lobby","text":"hi","ts":1700000000000})";
+    SharedFrame first = deflater.compress(make_frame(payload));
+    SharedFrame second = deflater.compress(make_frame(payload));
+    ASSERT_TRUE(first && second);
+    EXPECT_LT(first->size(), payload.size() + 4);
+    EXPECT_LT(second->size(), first->size()); // the second refers back to the first
+}
@@ -0,0 +1,177 @@
+// message_log_test.cpp
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "message_log.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+class MessageLogTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        dir_ = fs::temp_directory_path() / ("chat_log_test_" + std::to_string(::getpid()) + "_" +
+                                            ::testing::UnitTest::GetInstance()->current_test_info()->name());
+        fs::remove_all(dir_);
+    }
+    void TearDown() override { fs::remove_all(dir_); }
+
+    std::unique_ptr<MessageLog> open_log(uint64_t segment_bytes = 64 * 1024) {
+        MessageLogOptions options;
+        options.dir = dir_.string();
+        options.segment_bytes = segment_bytes;
+        options.index_interval = 4;
+        auto log = std::make_unique<MessageLog>(options);
+        log->open();
+        return log;
+    }
+
+    static void append(MessageLog& log, const std::string& text) {
+        ChatMsg m{ "alice", "", text, 1000 + log.last_id(), log.last_id() + 1, "lobby" };
+        log.append(m);
+    }
+
+    static std::vector<std::string> tail_texts(MessageLog& log, std::size_t count) {
+        std::vector<std::string> out;
+        for (const auto& m : log.read_tail(count)) out.push_back(m.text.str());
+        return out;
+    }
+
+    // the one segment still being appended to (it has no index file yet)
+    fs::path active_segment() const {
+        for (const auto& entry : fs::directory_iterator(dir_)) {
+            if (entry.path().extension() == ".seg" && !fs::exists(entry.path().string() + ".idx")) return entry.path();
+        }
+        return {};
+    }
+
+    // damage the segment from the first byte of `text` on, as a crash mid-write would
+    void tear_at(const std::string& text, bool zero_rest) {
+        const fs::path path = active_segment();
+        ASSERT_FALSE(path.empty());
+        std::string bytes;
+        {
+            std::ifstream in(path, std::ios::binary);
+            bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        const std::size_t at = bytes.find(text);
+        ASSERT_NE(at, std::string::npos);
+        if (zero_rest) std::fill(bytes.begin() + static_cast<std::ptrdiff_t>(at), bytes.end(), '\0');
+        else bytes[at] ^= 0x20;
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    }
+
+    fs::path dir_;
+};
+
+std::vector<std::string> numbered(int from, int to) {
+    std::vector<std::string> out;
+    for (int i = from; i < to; ++i) out.push_back("record-" + std::to_string(i));
+    return out;
+}
+
+} // namespace
+
+TEST_F(MessageLogTest, ReopensWithEveryRecord) {
+    {
+        auto log = open_log();
+        for (int i = 0; i < 10; ++i) append(*log, "record-" + std::to_string(i));
+    }
+    auto log = open_log();
+    EXPECT_EQ(log->last_id(), 10u);
+    auto tail = log->read_tail(3);
+    ASSERT_EQ(tail.size(), 3u);
+    EXPECT_EQ(tail[0].id, 8u);
+    EXPECT_EQ(tail[0].from, "alice");
+    EXPECT_EQ(tail[0].room, "lobby");
+    EXPECT_EQ(tail[2].text, "record-9");
+}
+
+TEST_F(MessageLogTest, CorruptLastRecordIsDropped) {
+    {
+        auto log = open_log();
+        for (int i = 0; i < 10; ++i) append(*log, "record-" + std::to_string(i));
+    }
+    tear_at("record-9", false); // checksum no longer matches
+    {
+        auto log = open_log();
+        EXPECT_EQ(log->last_id(), 9u);
+        EXPECT_EQ(tail_texts(*log, 100), numbered(0, 9));
+        append(*log, "after recovery");
+    }
+    // the new record took the torn one's place and nothing stale follows it
+    auto log = open_log();
+    EXPECT_EQ(log->last_id(), 10u);
+    auto expected = numbered(0, 9);
+    expected.push_back("after recovery");
+    EXPECT_EQ(tail_texts(*log, 100), expected);
+}
+
+TEST_F(MessageLogTest, TruncatedTailIsDropped) {
+    {
+        auto log = open_log();
+        for (int i = 0; i < 10; ++i) append(*log, "record-" + std::to_string(i));
+    }
+    tear_at("record-7", true); // records 7.. were only partly written
+    auto log = open_log();
+    EXPECT_EQ(log->last_id(), 7u);
+    EXPECT_EQ(tail_texts(*log, 100), numbered(0, 7));
+}
+
+TEST_F(MessageLogTest, RollsOverAndReadsAcrossSegments) {
+    {
+        auto log = open_log(1024);
+        for (int i = 0; i < 60; ++i) append(*log, "record-" + std::to_string(i));
+    }
+    std::size_t segments = 0;
+    for (const auto& entry : fs::directory_iterator(dir_)) segments += entry.path().extension() == ".seg";
+    EXPECT_GT(segments, 1u);
+
+    auto log = open_log(1024);
+    EXPECT_EQ(log->last_id(), 60u);
+    EXPECT_EQ(tail_texts(*log, 60), numbered(0, 60));
+    std::vector<uint64_t> ids;
+    log->visit_backward(31, 100, [&](const ChatMsg& m) {
+        ids.push_back(m.id);
+        return ids.size() < 5;
+    });
+    EXPECT_EQ(ids, (std::vector<uint64_t>{ 30, 29, 28, 27, 26 }));
+}
+
+TEST_F(MessageLogTest, RecordsAfterAGapSurviveRestart) {
+    {
+        auto log = open_log();
+        append(*log, "record-0");
+        append(*log, "record-1");
+        // id 3 was never written
+        log->append(ChatMsg{ "alice", "", "record-3", 1003, 4, "lobby" });
+        append(*log, "record-4");
+    }
+    auto log = open_log();
+    EXPECT_EQ(log->last_id(), 5u);
+    EXPECT_EQ(tail_texts(*log, 100), (std::vector<std::string>{ "record-0", "record-1", "record-3", "record-4" }));
+}
+
+TEST_F(MessageLogTest, StoreRefusesWhatTheLogCannotHold) {
+    {
+        MessageStore store(10);
+        store.attach_log(open_log(1024), 100);
+        EXPECT_EQ(store.add_message(ChatMsg{ "alice", "", "first", 1000, 0, "lobby" }), 1u);
+        EXPECT_EQ(store.add_message(ChatMsg{ "alice", std::string(70000, 'b'), "long name", 1001, 0, "" }), 0u);
+        EXPECT_EQ(store.add_message(ChatMsg{ "alice", "", std::string(2000, 'x'), 1002, 0, "lobby" }), 0u);
+        EXPECT_EQ(store.add_message(ChatMsg{ "alice", "", "second", 1003, 0, "lobby" }), 2u);
+        EXPECT_EQ(store.size(), 2u);
+        store.detach_log();
+    }
+    auto log = open_log(1024);
+    EXPECT_EQ(log->last_id(), 2u);
+    EXPECT_EQ(tail_texts(*log, 100), (std::vector<std::string>{ "first", "second" }));
+}
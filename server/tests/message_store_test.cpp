@@ -0,0 +1,156 @@
+// message_store_test.cpp
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "message_store.hpp"
+#include "message_log.hpp"
+
+namespace {
+
+uint64_t add_group(MessageStore& store, const std::string& from, const std::string& room, const std::string& text) {
+    return store.add_message(ChatMsg{ from, "", text, 1000, 0, room });
+}
+
+uint64_t add_private(MessageStore& store, const std::string& from, const std::string& to, const std::string& text) {
+    return store.add_message(ChatMsg{ from, to, text, 1000, 0, "" });
+}
+
+std::vector<std::string> texts(const std::vector<ChatMsg>& msgs) {
+    std::vector<std::string> out;
+    for (const auto& m : msgs) out.push_back(m.text.str());
+    return out;
+}
+
+} // namespace
+
+TEST(MessageStore, AssignsIncreasingIds) {
+    MessageStore store(10);
+    EXPECT_EQ(add_group(store, "alice", "lobby", "one"), 1u);
+    EXPECT_EQ(add_group(store, "alice", "lobby", "two"), 2u);
+    EXPECT_EQ(store.size(), 2u);
+}
+
+TEST(MessageStore, RingEvictsOldest) {
+    MessageStore store(3);
+    for (int i = 0; i < 5; ++i) add_group(store, "alice", "lobby", "m" + std::to_string(i));
+    EXPECT_EQ(store.size(), 3u);
+    EXPECT_EQ(texts(store.get_room_messages("lobby", 10)), (std::vector<std::string>{ "m2", "m3", "m4" }));
+}
+
+TEST(MessageStore, RoomHistoryIsPerRoom) {
+    MessageStore store(10);
+    add_group(store, "alice", "lobby", "hello lobby");
+    add_group(store, "bob", "ops", "hello ops");
+    add_group(store, "alice", "lobby", "again");
+    EXPECT_EQ(texts(store.get_room_messages("lobby", 10)), (std::vector<std::string>{ "hello lobby", "again" }));
+    EXPECT_EQ(texts(store.get_room_messages("ops", 10)), (std::vector<std::string>{ "hello ops" }));
+    EXPECT_TRUE(store.get_room_messages("nowhere", 10).empty());
+}
+
+TEST(MessageStore, UserSeesOwnPrivateThreadsAndJoinedRooms) {
+    MessageStore store(10);
+    add_group(store, "alice", "lobby", "public");
+    add_private(store, "alice", "bob", "to bob");
+    add_private(store, "carol", "alice", "to alice");
+    add_private(store, "carol", "dave", "not for bob");
+    add_group(store, "dave", "ops", "ops only");
+
+    auto bob = store.get_messages_for_user("bob", 10, { "lobby" });
+    EXPECT_EQ(texts(bob), (std::vector<std::string>{ "public", "to bob" }));
+    auto alice = store.get_messages_for_user("alice", 10, { "lobby", "ops" });
+    EXPECT_EQ(texts(alice), (std::vector<std::string>{ "public", "to bob", "to alice", "ops only" }));
+    // the newest `count`, still oldest first
+    EXPECT_EQ(texts(store.get_messages_for_user("alice", 2, { "lobby", "ops" })), (std::vector<std::string>{ "to alice", "ops only" }));
+}
+
+TEST(MessageStore, ResultsKeepFieldsAfterEviction) {
+    MessageStore store(2);
+    add_private(store, "alice", "bob", "kept by the result");
+    auto held = store.get_messages_for_user("bob", 1, {});
+    ASSERT_EQ(held.size(), 1u);
+    // push the message, its text chunk and its names out of the store
+    for (int i = 0; i < 4; ++i) add_group(store, "zed" + std::to_string(i), "room" + std::to_string(i), std::string(40000, 'x'));
+    EXPECT_EQ(held[0].from, "alice");
+    EXPECT_EQ(held[0].to, "bob");
+    EXPECT_EQ(held[0].text, "kept by the result");
+    EXPECT_TRUE(store.get_messages_for_user("bob", 10, {}).empty());
+}
+
+TEST(MessageStore, HistoryPagesBackwardAndForward) {
+    MessageStore store(100);
+    std::vector<uint64_t> ids;
+    for (int i = 0; i < 10; ++i) ids.push_back(add_group(store, "alice", "lobby", "m" + std::to_string(i)));
+    add_group(store, "bob", "elsewhere", "hidden");
+
+    // newest page first, then walk back with the cursor
+    HistoryPage page = store.get_history_page("carol", { "lobby" }, 0, 0, 4);
+    EXPECT_EQ(texts(page.messages), (std::vector<std::string>{ "m6", "m7", "m8", "m9" }));
+    ASSERT_TRUE(page.has_more);
+    EXPECT_EQ(page.next_cursor, ids[6]);
+    page = store.get_history_page("carol", { "lobby" }, page.next_cursor, 0, 4);
+    EXPECT_EQ(texts(page.messages), (std::vector<std::string>{ "m2", "m3", "m4", "m5" }));
+    page = store.get_history_page("carol", { "lobby" }, page.next_cursor, 0, 4);
+    EXPECT_EQ(texts(page.messages), (std::vector<std::string>{ "m0", "m1" }));
+    EXPECT_FALSE(page.has_more);
+    EXPECT_EQ(page.next_cursor, 0u);
+
+    // forward from an id: the oldest matches after it
+    page = store.get_history_page("carol", { "lobby" }, 0, ids[3], 3);
+    EXPECT_EQ(texts(page.messages), (std::vector<std::string>{ "m4", "m5", "m6" }));
+    ASSERT_TRUE(page.has_more);
+    EXPECT_EQ(page.next_cursor, ids[6]);
+    page = store.get_history_page("carol", { "lobby" }, 0, page.next_cursor, 10);
+    EXPECT_EQ(texts(page.messages), (std::vector<std::string>{ "m7", "m8", "m9" }));
+    EXPECT_FALSE(page.has_more);
+
+    // both bounds
+    page = store.get_history_page("carol", { "lobby" }, ids[5], ids[2], 10);
+    EXPECT_EQ(texts(page.messages), (std::vector<std::string>{ "m3", "m4" }));
+}
+
+TEST(MessageStore, HistoryPageMergesThreadsAndRooms) {
+    MessageStore store(100);
+    add_group(store, "alice", "lobby", "g1");
+    add_private(store, "alice", "bob", "p1");
+    add_group(store, "alice", "ops", "o1");
+    add_private(store, "bob", "alice", "p2");
+    add_group(store, "alice", "lobby", "g2");
+
+    HistoryPage page = store.get_history_page("bob", { "lobby" }, 0, 0, 3);
+    EXPECT_EQ(texts(page.messages), (std::vector<std::string>{ "p1", "p2", "g2" }));
+    ASSERT_TRUE(page.has_more);
+    page = store.get_history_page("bob", { "lobby" }, page.next_cursor, 0, 3);
+    EXPECT_EQ(texts(page.messages), (std::vector<std::string>{ "g1" }));
+    // no user: rooms only
+    page = store.get_history_page("", { "lobby", "ops" }, 0, 0, 10);
+    EXPECT_EQ(texts(page.messages), (std::vector<std::string>{ "g1", "o1", "g2" }));
+}
+
+TEST(MessageStore, HistoryContinuesIntoTheLog) {
+    const auto dir = std::filesystem::temp_directory_path() / ("chat_store_test_" + std::to_string(::getpid()));
+    std::filesystem::remove_all(dir);
+    {
+        MessageLogOptions options;
+        options.dir = dir.string();
+        options.segment_bytes = 64 * 1024;
+        auto log = std::make_unique<MessageLog>(options);
+        log->open();
+        MessageStore store(3);
+        store.attach_log(std::move(log), 1000);
+        for (int i = 0; i < 8; ++i) add_group(store, "alice", "lobby", "m" + std::to_string(i));
+        EXPECT_EQ(store.size(), 3u);
+
+        // the ring holds m5..m7; older pages are read back from disk
+        HistoryPage page = store.get_history_page("", { "lobby" }, 0, 0, 4);
+        EXPECT_EQ(texts(page.messages), (std::vector<std::string>{ "m4", "m5", "m6", "m7" }));
+        ASSERT_TRUE(page.has_more);
+        page = store.get_history_page("", { "lobby" }, page.next_cursor, 0, 10);
+        EXPECT_EQ(texts(page.messages), (std::vector<std::string>{ "m0", "m1", "m2", "m3" }));
+        EXPECT_FALSE(page.has_more);
+        store.detach_log();
+    }
+    std::filesystem::remove_all(dir);
+}
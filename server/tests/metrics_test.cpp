@@ -0,0 +1,31 @@
+// metrics_test.cpp
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <limits>
+#include "metrics.hpp"
+
+TEST(MetricsHistogram, SmallValuesAreExact) {
+    for (uint64_t v = 0; v < 16; ++v) EXPECT_EQ(Metrics::bucket_upper(Metrics::bucket_for(v)), v);
+}
+
+TEST(MetricsHistogram, BucketsAreContiguous) {
+    for (std::size_t b = 0; b < Metrics::kHistogramBuckets; ++b) {
+        EXPECT_EQ(Metrics::bucket_for(Metrics::bucket_upper(b)), b);
+        if (b + 1 < Metrics::kHistogramBuckets) {
+            EXPECT_EQ(Metrics::bucket_for(Metrics::bucket_upper(b) + 1), b + 1);
+        }
+    }
+}
+
+TEST(MetricsHistogram, ReportedValueIsWithinAnEighth) {
+    for (uint64_t v = 1; v < (uint64_t(1) << 40); v = v * 3 + 1) {
+        const uint64_t upper = Metrics::bucket_upper(Metrics::bucket_for(v));
+        EXPECT_GE(upper, v);
+        EXPECT_LE(upper - v, v / 8) << v;
+    }
+}
+
+TEST(MetricsHistogram, HugeValuesClampToTheLastBucket) {
+    EXPECT_EQ(Metrics::bucket_for(std::numeric_limits<uint64_t>::max()), Metrics::kHistogramBuckets - 1);
+    EXPECT_EQ(Metrics::bucket_for(uint64_t(1) << 50), Metrics::kHistogramBuckets - 1);
+}
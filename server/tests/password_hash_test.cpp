@@ -0,0 +1,65 @@
+// password_hash_test.cpp
+#include <gtest/gtest.h>
+#include <string>
+#include "password_hash.hpp"
+
+namespace {
+
+std::string hex(const std::string& bytes) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    for (unsigned char c : bytes) {
+        out.push_back(digits[c >> 4]);
+        out.push_back(digits[c & 0xF]);
+    }
+    return out;
+}
+
+// a stored credential whose hash is the first 32 bytes of a published derived key
+std::string credential(const std::string& salt, uint32_t iterations, const std::string& dk_hex) {
+    return "pbkdf2-sha256$" + std::to_string(iterations) + "$" + hex(salt) + "$" + dk_hex.substr(0, 64);
+}
+
+} // namespace
+
+// PBKDF2-HMAC-SHA256 test vectors: RFC 7914 section 11 and the widely used
+// set derived from RFC 6070's PBKDF2-HMAC-SHA1 inputs
+TEST(PasswordHash, MatchesPublishedVectors) {
+    EXPECT_TRUE(verify_password("password", credential("salt", 1,
+        "120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b")));
+    EXPECT_TRUE(verify_password("password", credential("salt", 2,
+        "ae4d0c95af6b46d32d0adff928f06dd02a303f8ef3c251dfd6e2d85a95474c43")));
+    EXPECT_TRUE(verify_password("password", credential("salt", 4096,
+        "c5e478d59288c841aa530db6845c4c8d962893a001ce4e11a4963873aa98134a")));
+    EXPECT_TRUE(verify_password("passwordPASSWORDpassword", credential("saltSALTsaltSALTsaltSALTsaltSALTsalt", 4096,
+        "348c89dbcbd32b2f32d814b8116e84cf2b17347ebc1800181c4e2a1fb8dd53e1c635518c7dac47e9")));
+    EXPECT_TRUE(verify_password("passwd", credential("salt", 1,
+        "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783")));
+    EXPECT_TRUE(verify_password("Password", credential("NaCl", 80000,
+        "4ddcd8f60b98be21830cee5ef22701f9641a4418d04c0414aeff08876b34ab56a1d425a1225833549adb841b51c9b3176a272bdebba1d078478f62b397f33c8d")));
+
+    EXPECT_FALSE(verify_password("passwore", credential("salt", 1,
+        "120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b")));
+    EXPECT_FALSE(verify_password("password", credential("salt", 2,
+        "120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b")));
+}
+
+TEST(PasswordHash, HashesVerifyWithFreshSalts) {
+    const std::string a = hash_password("hunter2", 100);
+    const std::string b = hash_password("hunter2", 100);
+    EXPECT_EQ(a.rfind("pbkdf2-sha256$100$", 0), 0u);
+    EXPECT_NE(a, b);
+    EXPECT_TRUE(verify_password("hunter2", a));
+    EXPECT_TRUE(verify_password("hunter2", b));
+    EXPECT_FALSE(verify_password("hunter3", a));
+    EXPECT_FALSE(verify_password("", a));
+}
+
+TEST(PasswordHash, MalformedCredentialsNeverVerify) {
+    EXPECT_FALSE(verify_password("x", ""));
+    EXPECT_FALSE(verify_password("x", "plain-text"));
+    EXPECT_FALSE(verify_password("password", "pbkdf2-sha1$1$73616c74$120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b"));
+    EXPECT_FALSE(verify_password("password", "pbkdf2-sha256$0$73616c74$120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b"));
+    EXPECT_FALSE(verify_password("password", "pbkdf2-sha256$1$73616c74$120fb6cf"));
+    EXPECT_FALSE(verify_password("password", "pbkdf2-sha256$1$7361zz74$120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b"));
+}
@@ -0,0 +1,62 @@
+// rate_limiter_test.cpp
+#include <gtest/gtest.h>
+#include <chrono>
+#include "rate_limiter.hpp"
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+TEST(TokenBucket, StartsFullThenRefusesBeyondBurst) {
+    TokenBucket bucket;
+    const RateLimit limit{ 10, 3 };
+    const auto t0 = Clock::now();
+    EXPECT_TRUE(bucket.take(t0, limit));
+    EXPECT_TRUE(bucket.take(t0, limit));
+    EXPECT_TRUE(bucket.take(t0, limit));
+    EXPECT_FALSE(bucket.take(t0, limit));
+    EXPECT_EQ(bucket.retry_ms(limit), 100u); // one token at 10/s
+}
+
+TEST(TokenBucket, RefillsAtTheSustainedRate) {
+    TokenBucket bucket;
+    const RateLimit limit{ 10, 2 };
+    const auto t0 = Clock::now();
+    EXPECT_TRUE(bucket.take(t0, limit));
+    EXPECT_TRUE(bucket.take(t0, limit));
+    EXPECT_FALSE(bucket.take(t0 + 50ms, limit)); // half a token
+    EXPECT_EQ(bucket.retry_ms(limit), 50u);
+    EXPECT_TRUE(bucket.take(t0 + 100ms, limit));
+    EXPECT_FALSE(bucket.take(t0 + 100ms, limit));
+    // a long pause refills only up to the burst
+    EXPECT_TRUE(bucket.take(t0 + 10s, limit));
+    EXPECT_TRUE(bucket.take(t0 + 10s, limit));
+    EXPECT_FALSE(bucket.take(t0 + 10s, limit));
+}
+
+TEST(TokenBucket, ClockGoingBackDoesNotRefill) {
+    TokenBucket bucket;
+    const RateLimit limit{ 1, 1 };
+    const auto t0 = Clock::now();
+    EXPECT_TRUE(bucket.take(t0, limit));
+    EXPECT_FALSE(bucket.take(t0 - 5s, limit));
+    EXPECT_FALSE(bucket.take(t0 + 500ms, limit));
+    EXPECT_TRUE(bucket.take(t0 + 1s, limit));
+}
+
+TEST(TokenBucket, ZeroRateDisablesTheLimit) {
+    TokenBucket bucket;
+    const RateLimit limit{ 0, 1 };
+    const auto t0 = Clock::now();
+    for (int i = 0; i < 1000; ++i) EXPECT_TRUE(bucket.take(t0, limit));
+    EXPECT_EQ(bucket.retry_ms(limit), 0u);
+}
+
+TEST(RateClass, GroupsFrameTypes) {
+    EXPECT_EQ(rate_class_of("message"), RateClass::Message);
+    EXPECT_EQ(rate_class_of("private"), RateClass::Private);
+    EXPECT_EQ(rate_class_of("search"), RateClass::History);
+    EXPECT_EQ(rate_class_of("history"), RateClass::History);
+    EXPECT_EQ(rate_class_of("join"), RateClass::Directory);
+    EXPECT_EQ(rate_class_of("heartbeat"), RateClass::kCount);
+    EXPECT_STREQ(rate_class_name(RateClass::Directory), "list");
+}
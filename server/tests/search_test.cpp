@@ -0,0 +1,142 @@
+// search_test.cpp
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "message_store.hpp"
+#include "search_index.hpp"
+
+namespace {
+
+std::vector<std::string> tokens(const std::string& text) {
+    std::vector<std::string> out;
+    SearchIndex::tokenize(text, out);
+    return out;
+}
+
+uint64_t add(MessageStore& store, const std::string& from, const std::string& to, const std::string& room,
+             const std::string& text, uint64_t ts = 1000) {
+    return store.add_message(ChatMsg{ from, to, text, ts, 0, room });
+}
+
+std::vector<uint64_t> ids(const SearchPage& page) {
+    std::vector<uint64_t> out;
+    for (const auto& m : page.messages) out.push_back(m.id);
+    return out;
+}
+
+SearchQuery query(const std::string& user, const std::string& text, std::vector<std::string> rooms = { "lobby" }) {
+    SearchQuery q;
+    q.user = user;
+    q.rooms = std::move(rooms);
+    q.text = text;
+    return q;
+}
+
+} // namespace
+
+TEST(SearchIndex, TokenizesWordsAndCharacters) {
+    EXPECT_EQ(tokens("Deploy FAILED on host-3!"), (std::vector<std::string>{ "deploy", "failed", "on", "host", "3" }));
+    // no spaces between CJK words: one token per character
+    EXPECT_EQ(tokens("部署失败"), (std::vector<std::string>{ "部", "署", "失", "败" }));
+    EXPECT_EQ(tokens(std::string(40, 'a'))[0].size(), SearchIndex::kMaxTokenBytes);
+}
+
+TEST(SearchIndex, ParsesPrefixTerms) {
+    auto terms = SearchIndex::parse_query("deploy host*");
+    ASSERT_EQ(terms.size(), 2u);
+    EXPECT_EQ(terms[0].token, "deploy");
+    EXPECT_FALSE(terms[0].prefix);
+    EXPECT_EQ(terms[1].token, "host");
+    EXPECT_TRUE(terms[1].prefix);
+    // shorter than kMinPrefixBytes: matched exactly
+    terms = SearchIndex::parse_query("d*");
+    ASSERT_EQ(terms.size(), 1u);
+    EXPECT_FALSE(terms[0].prefix);
+}
+
+TEST(Search, MatchesEveryTermCaseInsensitively) {
+    MessageStore store(100, true);
+    const uint64_t a = add(store, "alice", "", "lobby", "Deploy failed on host-3");
+    const uint64_t b = add(store, "alice", "", "lobby", "deployment finished");
+    add(store, "alice", "", "lobby", "nothing to see");
+    EXPECT_EQ(ids(store.search(query("carol", "deploy failed"))), (std::vector<uint64_t>{ a }));
+    EXPECT_EQ(ids(store.search(query("carol", "DEPLOY"))), (std::vector<uint64_t>{ a }));
+    EXPECT_EQ(ids(store.search(query("carol", "depl*"))), (std::vector<uint64_t>{ a, b }));
+    EXPECT_TRUE(store.search(query("carol", "missing")).messages.empty());
+}
+
+TEST(Search, OnlyVisibleMessagesMatch) {
+    MessageStore store(100, true);
+    const uint64_t room = add(store, "alice", "", "lobby", "secret plan");
+    add(store, "alice", "", "ops", "secret ops plan");
+    const uint64_t dm = add(store, "alice", "bob", "", "secret key");
+    EXPECT_EQ(ids(store.search(query("bob", "secret"))), (std::vector<uint64_t>{ room, dm }));
+    EXPECT_EQ(ids(store.search(query("alice", "secret", {}))), (std::vector<uint64_t>{ dm }));
+    EXPECT_EQ(ids(store.search(query("carol", "secret"))), (std::vector<uint64_t>{ room }));
+
+    SearchQuery from_q = query("bob", "secret");
+    from_q.from = "nobody";
+    EXPECT_TRUE(store.search(from_q).messages.empty());
+    SearchQuery to_q = query("bob", "secret");
+    to_q.to = "bob";
+    EXPECT_EQ(ids(store.search(to_q)), (std::vector<uint64_t>{ dm }));
+}
+
+TEST(Search, TimeRangeAndPaging) {
+    MessageStore store(100, true);
+    std::vector<uint64_t> all;
+    for (int i = 0; i < 10; ++i) all.push_back(add(store, "alice", "", "lobby", "tick " + std::to_string(i), 1000 + i * 10));
+
+    SearchQuery q = query("carol", "tick");
+    q.since = 1020;
+    q.until = 1050;
+    EXPECT_EQ(ids(store.search(q)), (std::vector<uint64_t>(all.begin() + 2, all.begin() + 6)));
+
+    q = query("carol", "tick");
+    q.limit = 4;
+    SearchPage page = store.search(q);
+    EXPECT_EQ(ids(page), (std::vector<uint64_t>(all.begin() + 6, all.end())));
+    ASSERT_TRUE(page.has_more);
+    q.before_id = page.next_cursor;
+    page = store.search(q);
+    EXPECT_EQ(ids(page), (std::vector<uint64_t>(all.begin() + 2, all.begin() + 6)));
+    q.before_id = page.next_cursor;
+    page = store.search(q);
+    EXPECT_EQ(ids(page), (std::vector<uint64_t>(all.begin(), all.begin() + 2)));
+    EXPECT_FALSE(page.has_more);
+}
+
+TEST(Search, EvictedMessagesLeaveTheIndex) {
+    MessageStore store(3, true);
+    add(store, "alice", "", "lobby", "needle");
+    for (int i = 0; i < 3; ++i) add(store, "alice", "", "lobby", "hay");
+    EXPECT_TRUE(store.search(query("carol", "needle")).messages.empty());
+    EXPECT_EQ(store.search(query("carol", "hay")).messages.size(), 3u);
+}
+
+TEST(Search, BroadPrefixIsRefused) {
+    MessageStore store(2000, true);
+    for (int i = 0; i < 600; ++i) add(store, "alice", "", "lobby", "zz" + std::to_string(i));
+    EXPECT_TRUE(store.search(query("carol", "zz*")).too_broad);
+    EXPECT_FALSE(store.search(query("carol", "zz12*")).too_broad);
+}
+
+TEST(Search, WalksLongCandidateListsAcrossLockSlices) {
+    // both terms are common but rarely together: thousands of candidates for a handful of matches
+    MessageStore store(10000, true);
+    std::vector<uint64_t> both;
+    for (int i = 0; i < 6000; ++i) {
+        if (i % 1000 == 0) both.push_back(add(store, "alice", "", "lobby", "hay straw"));
+        else add(store, "alice", "", "lobby", i % 2 ? "hay" : "straw");
+    }
+    SearchQuery q = query("carol", "hay straw");
+    q.limit = 50;
+    EXPECT_EQ(ids(store.search(q)), both);
+    q.limit = 2;
+    SearchPage page = store.search(q);
+    EXPECT_EQ(ids(page), (std::vector<uint64_t>(both.end() - 2, both.end())));
+    ASSERT_TRUE(page.has_more);
+    q.before_id = page.next_cursor;
+    q.limit = 50;
+    EXPECT_EQ(ids(store.search(q)), (std::vector<uint64_t>(both.begin(), both.end() - 2)));
+}
@@ -0,0 +1,53 @@
+// timing_wheel_test.cpp
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+#include "timing_wheel.hpp"
+
+namespace {
+
+std::vector<int> live(const std::vector<std::weak_ptr<int>>& due) {
+    std::vector<int> out;
+    for (const auto& entry : due) {
+        if (auto p = entry.lock()) out.push_back(*p);
+    }
+    return out;
+}
+
+} // namespace
+
+TEST(TimingWheel, EntriesComeDueAfterTheirTicks) {
+    TimingWheel<int> wheel(8);
+    auto a = std::make_shared<int>(1), b = std::make_shared<int>(2), c = std::make_shared<int>(3);
+    wheel.schedule(a, 1);
+    wheel.schedule(b, 3);
+    wheel.schedule(c, 3);
+    EXPECT_EQ(wheel.size(), 3u);
+    EXPECT_EQ(live(wheel.advance()), (std::vector<int>{ 1 }));
+    EXPECT_TRUE(wheel.advance().empty());
+    EXPECT_EQ(live(wheel.advance()), (std::vector<int>{ 2, 3 }));
+    EXPECT_EQ(wheel.size(), 0u);
+}
+
+TEST(TimingWheel, DelaysAreClampedToTheWheel) {
+    TimingWheel<int> wheel(4);
+    auto now = std::make_shared<int>(1), late = std::make_shared<int>(2);
+    wheel.schedule(now, 0);   // at least one tick
+    wheel.schedule(late, 100); // at most slots - 1: comes due early and reschedules
+    EXPECT_EQ(live(wheel.advance()), (std::vector<int>{ 1 }));
+    EXPECT_TRUE(wheel.advance().empty());
+    EXPECT_EQ(live(wheel.advance()), (std::vector<int>{ 2 }));
+}
+
+TEST(TimingWheel, DeadOwnersFailToLock) {
+    TimingWheel<int> wheel(4);
+    auto kept = std::make_shared<int>(1);
+    {
+        auto gone = std::make_shared<int>(2);
+        wheel.schedule(gone, 1);
+    }
+    wheel.schedule(kept, 1);
+    const auto due = wheel.advance();
+    EXPECT_EQ(due.size(), 2u);
+    EXPECT_EQ(live(due), (std::vector<int>{ 1 }));
+}
@@ -0,0 +1,67 @@
+// user_store_test.cpp
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include "user_store.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+class UserStoreTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        dir_ = fs::temp_directory_path() / ("chat_users_test_" + std::to_string(::getpid()) + "_" +
+                                            ::testing::UnitTest::GetInstance()->current_test_info()->name());
+        fs::remove_all(dir_);
+    }
+    void TearDown() override { fs::remove_all(dir_); }
+
+    fs::path dir_;
+};
+
+} // namespace
+
+TEST(UserStore, RegistersAndChecksLogins) {
+    UserStore store(10);
+    EXPECT_TRUE(store.register_user("alice", "secret1"));
+    EXPECT_FALSE(store.register_user("alice", "other"));   // taken
+    EXPECT_FALSE(store.register_user("", "secret1"));
+    EXPECT_FALSE(store.register_user("bob", "ab"));        // password too short
+    EXPECT_EQ(store.user_count(), 1u);
+    EXPECT_TRUE(store.check_login("alice", "secret1"));
+    EXPECT_FALSE(store.check_login("alice", "secret2"));
+    EXPECT_FALSE(store.check_login("nobody", "secret1"));
+}
+
+TEST_F(UserStoreTest, AccountsSurviveReopenFromSnapshotAndJournal) {
+    {
+        UserStore store(10);
+        store.open(dir_.string());
+        EXPECT_TRUE(store.register_user("alice", "alice-pw"));
+        EXPECT_TRUE(store.register_user("bob", "bob-pw"));
+    }
+    {
+        // alice and bob come from the journal and are folded into the snapshot; carol goes to the new journal
+        UserStore store(10);
+        store.open(dir_.string());
+        EXPECT_EQ(store.user_count(), 2u);
+        EXPECT_TRUE(store.register_user("carol", "carol-pw"));
+    }
+    // a crash mid-append leaves a torn last line, which is skipped
+    {
+        std::ofstream journal(dir_ / "users.journal", std::ios::app);
+        journal << "{\"u\":\"dave\",\"c\":\"pbk";
+    }
+    UserStore store(10);
+    store.open(dir_.string());
+    EXPECT_EQ(store.user_count(), 3u);
+    EXPECT_TRUE(store.check_login("alice", "alice-pw"));
+    EXPECT_TRUE(store.check_login("bob", "bob-pw"));
+    EXPECT_TRUE(store.check_login("carol", "carol-pw"));
+    EXPECT_FALSE(store.check_login("carol", "alice-pw"));
+    EXPECT_FALSE(store.check_login("dave", "dave-pw"));
+    EXPECT_FALSE(store.register_user("bob", "again"));
+}
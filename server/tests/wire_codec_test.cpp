@@ -0,0 +1,63 @@
+// wire_codec_test.cpp
+#include <gtest/gtest.h>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+#include "wire_codec.hpp"
+
+using json = nlohmann::json;
+
+namespace {
+
+json round_trip(const json& message, WireEncoding encoding) {
+    SharedFrame frame = encode_frame(message, encoding);
+    EXPECT_EQ(parse_length(*frame), frame->size() - 4);
+    return decode_payload(frame->data() + 4, frame->size() - 4);
+}
+
+json sample_message() {
+    return { {"type", "message"}, {"id", 42}, {"from", "alice"}, {"room", "lobby"},
+             {"text", "héllo, 世界"}, {"ts", 1700000000123ull}, {"big", 1ull << 40}, {"neg", -7},
+             {"nested", { {"list", {1, "two", 3.5, nullptr, true}} }} };
+}
+
+} // namespace
+
+TEST(WireCodec, JsonRoundTrip) {
+    const json message = sample_message();
+    EXPECT_EQ(round_trip(message, WireEncoding::Json), message);
+}
+
+TEST(WireCodec, CborRoundTrip) {
+    const json message = sample_message();
+    EXPECT_EQ(round_trip(message, WireEncoding::Cbor), message);
+}
+
+TEST(WireCodec, CborTagsKnownTypes) {
+    SharedFrame frame = encode_frame({ {"type", "message"} }, WireEncoding::Cbor);
+    // a one-entry map, the "type" key, then the tag (below 24, so a single byte) instead of a string
+    const std::vector<uint8_t> payload(frame->begin() + 4, frame->end());
+    ASSERT_EQ(payload.size(), 7u);
+    EXPECT_EQ(payload[0], 0xA1);
+    EXPECT_EQ(payload[6], wire_type_tag("message"));
+    EXPECT_EQ(std::string(wire_type_name(wire_type_tag("search_result"))), "search_result");
+    for (std::size_t tag = 1; tag <= wire_type_count(); ++tag) EXPECT_EQ(wire_type_tag(wire_type_name(tag)), tag);
+}
+
+TEST(WireCodec, CborKeepsUnknownTypeAsString) {
+    const json message = { {"type", "not_a_known_type"}, {"x", 1} };
+    EXPECT_EQ(wire_type_tag("not_a_known_type"), 0u);
+    EXPECT_EQ(round_trip(message, WireEncoding::Cbor), message);
+}
+
+TEST(WireCodec, NonObjectsStayJson) {
+    const json message = json::array({ 1, 2, 3 });
+    SharedFrame frame = encode_frame(message, WireEncoding::Cbor);
+    EXPECT_EQ(std::string(frame->begin() + 4, frame->end()), message.dump());
+}
+
+TEST(WireCodec, MalformedPayloadThrows) {
+    const std::string bad_json = "{\"type\":";
+    EXPECT_THROW(decode_payload(reinterpret_cast<const uint8_t*>(bad_json.data()), bad_json.size()), std::exception);
+    const uint8_t truncated_cbor[] = { 0xA2, 0x64, 't', 'y' };
+    EXPECT_THROW(decode_payload(truncated_cbor, sizeof(truncated_cbor)), std::exception);
+}
@@ -0,0 +1,48 @@
+// timing_wheel.hpp
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Hashed timing wheel of weak references, advanced by one shared timer.
+// An entry scheduled `ticks` ahead lands in slot (cursor + ticks) % slots;
+// advance() moves the cursor one slot and hands back what was there.
+// Entries are never cancelled: an owner re-checks its own deadline when it
+// comes due and reschedules itself if it is not expired yet, so refreshing a
+// deadline on activity costs only a timestamp store. Dead owners simply fail
+// to lock.
+template <typename T>
+class TimingWheel {
+public:
+    explicit TimingWheel(std::size_t slots) : slots_(std::max<std::size_t>(slots, 2)) {}
+
+    // ticks is clamped to [1, slots - 1]; longer delays come due early and reschedule
+    void schedule(std::weak_ptr<T> entry, std::size_t ticks) {
+        std::lock_guard<std::mutex> lk(mutex_);
+        ticks = std::min(std::max<std::size_t>(ticks, 1), slots_.size() - 1);
+        slots_[(cursor_ + ticks) % slots_.size()].push_back(std::move(entry));
+        ++size_;
+    }
+
+    std::vector<std::weak_ptr<T>> advance() {
+        std::vector<std::weak_ptr<T>> due;
+        std::lock_guard<std::mutex> lk(mutex_);
+        cursor_ = (cursor_ + 1) % slots_.size();
+        due.swap(slots_[cursor_]);
+        size_ -= due.size();
+        return due;
+    }
+
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lk(mutex_);
+        return size_;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<std::vector<std::weak_ptr<T>>> slots_;
+    std::size_t cursor_ = 0;
+    std::size_t size_ = 0;
+};
@@ -1,35 +1,166 @@
 // user_store.cpp
 #include "user_store.hpp"
+#include "password_hash.hpp"
 #include "logger.hpp"
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <nlohmann/json.hpp>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+static void sync_file(std::FILE* f) {
+    std::fflush(f);
+#ifdef _WIN32
+    _commit(_fileno(f));
+#else
+    fsync(fileno(f));
+#endif
+}
+
+UserStore::UserStore(uint32_t pbkdf2_iterations)
+    : pbkdf2_iterations_(pbkdf2_iterations ? pbkdf2_iterations : 1),
+      dummy_credential_(hash_password("", pbkdf2_iterations_)) {}
+
+UserStore::~UserStore() {
+    std::lock_guard<std::mutex> lk(persist_mutex_);
+    if (journal_file_) std::fclose(journal_file_);
+}
+
+void UserStore::close() {
+    std::lock_guard<std::mutex> lk(persist_mutex_);
+    if (journal_file_) std::fclose(journal_file_);
+    journal_file_ = nullptr;
+}
+
+UserStore::Shard& UserStore::shard_for(const std::string& username) {
+    return shards_[std::hash<std::string>{}(username) % kShardCount];
+}
+
+void UserStore::open(const std::string& dir) {
+    fs::create_directories(dir);
+    std::lock_guard<std::mutex> lk(persist_mutex_);
+    data_dir_ = dir;
+    load_file((fs::path(dir) / "users.snapshot").string());
+    load_file((fs::path(dir) / "users.journal").string());
+    // start from a fresh snapshot so the journal only holds new registrations
+    write_snapshot_locked();
+    LOG_INFO("User store loaded", { {"dir", dir}, {"users", static_cast<uint64_t>(user_count())} });
+}
+
+// Snapshot and journal share a format: one {"u": username, "c": credential} object per line
+void UserStore::load_file(const std::string& path) {
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty()) continue;
+        try {
+            json j = json::parse(line);
+            std::string username = j.at("u").get<std::string>();
+            Shard& shard = shard_for(username);
+            std::lock_guard<std::mutex> lk(shard.users_mutex);
+            if (shard.user_credential_map.insert_or_assign(username, j.at("c").get<std::string>()).second) ++user_count_;
+        } catch (const std::exception& ex) {
+            // a torn last line after a crash is expected; anything else is worth a warning
+            LOG_WARN("Skipping bad user store line", { {"path", path}, {"what", ex.what()} });
+        }
+    }
+}
+
+void UserStore::write_snapshot_locked() {
+    fs::path snapshot = fs::path(data_dir_) / "users.snapshot";
+    fs::path tmp = fs::path(data_dir_) / "users.snapshot.tmp";
+    std::FILE* out = std::fopen(tmp.string().c_str(), "wb");
+    if (!out) {
+        LOG_ERROR("Cannot write user snapshot", { {"path", tmp.string()} });
+        return;
+    }
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lk(shard.users_mutex);
+        for (const auto& kv : shard.user_credential_map) {
+            std::string line = json{ {"u", kv.first}, {"c", kv.second} }.dump() + "\n";
+            std::fwrite(line.data(), 1, line.size(), out);
+        }
+    }
+    sync_file(out);
+    std::fclose(out);
+    std::error_code ec;
+    fs::rename(tmp, snapshot, ec);
+    if (ec) {
+        LOG_ERROR("Cannot replace user snapshot", { {"what", ec.message()} });
+        return;
+    }
+
+    // everything is in the snapshot now: restart the journal
+    if (journal_file_) std::fclose(journal_file_);
+    journal_file_ = std::fopen((fs::path(data_dir_) / "users.journal").string().c_str(), "wb");
+    journal_entries_ = 0;
+}
+
+void UserStore::append_journal(const std::string& username, const std::string& credential) {
+    std::lock_guard<std::mutex> lk(persist_mutex_);
+    if (!journal_file_) return;
+    std::string line = json{ {"u", username}, {"c", credential} }.dump() + "\n";
+    std::fwrite(line.data(), 1, line.size(), journal_file_);
+    sync_file(journal_file_);
+    if (++journal_entries_ >= kJournalCompactThreshold) write_snapshot_locked();
+}
 
 bool UserStore::register_user(const std::string& username, const std::string& password) {
-    std::lock_guard<std::mutex> lk(users_mutex_);
     if (username.empty()) {
-        Logger::instance().warn("Register failed - empty username");
-        return false;
-    }
-    if (user_password_map_.count(username)) {
-        Logger::instance().warn("Register failed - exists", { {"username", username} });
+        LOG_WARN("Register failed - empty username");
         return false;
     }
     // Basic password check - do NOT log the password
     if (password.size() < 3) {
-        Logger::instance().warn("Register failed - password too short", { {"username", username} });
+        LOG_WARN("Register failed - password too short", { {"username", username} });
         return false;
     }
-    user_password_map_[username] = password;
-    Logger::instance().info("User registered", { {"username", username}, {"total_users", static_cast<uint64_t>(user_password_map_.size())} });
+    Shard& shard = shard_for(username);
+    {
+        std::lock_guard<std::mutex> lk(shard.users_mutex);
+        if (shard.user_credential_map.count(username)) {
+            LOG_WARN("Register failed - exists", { {"username", username} });
+            return false;
+        }
+    }
+
+    // hash without holding the shard lock
+    std::string credential = hash_password(password, pbkdf2_iterations_);
+    {
+        std::lock_guard<std::mutex> lk(shard.users_mutex);
+        if (!shard.user_credential_map.emplace(username, credential).second) {
+            LOG_WARN("Register failed - exists", { {"username", username} });
+            return false;
+        }
+    }
+    ++user_count_;
+    append_journal(username, credential);
+    LOG_INFO("User registered", { {"username", username}, {"total_users", static_cast<uint64_t>(user_count())} });
     return true;
 }
 
 bool UserStore::check_login(const std::string& username, const std::string& password) {
-    std::lock_guard<std::mutex> lk(users_mutex_);
-    auto it = user_password_map_.find(username);
-    if (it == user_password_map_.end()) {
-        Logger::instance().warn("Login failed - no such user", { {"username", username} });
+    std::string credential;
+    {
+        Shard& shard = shard_for(username);
+        std::lock_guard<std::mutex> lk(shard.users_mutex);
+        auto it = shard.user_credential_map.find(username);
+        if (it != shard.user_credential_map.end()) credential = it->second;
+    }
+    if (credential.empty()) {
+        // hash anyway: an early return would tell which usernames exist by how fast it comes back
+        verify_password(password, dummy_credential_);
+        LOG_WARN("Login failed - no such user", { {"username", username} });
         return false;
     }
-    bool ok = it->second == password;
-    Logger::instance().info("Login attempt", { {"username", username}, {"ok", ok} });
+    bool ok = verify_password(password, credential);
+    LOG_INFO("Login attempt", { {"username", username}, {"ok", ok} });
     return ok;
 }
@@ -2,14 +2,56 @@
 #include <string>
 #include <unordered_map>
 #include <mutex>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
 
-// very simple user store (in-memory). Passwords stored as plain text here (demo only).
+// User accounts with salted PBKDF2 credentials (see password_hash.hpp).
+//
+// The map is split into lock-striped shards so concurrent logins for
+// different users do not contend, and hashing is always done outside the
+// shard locks. register_user/check_login are CPU-expensive by design;
+// Session runs them on the server's auth WorkerPool, never on an io thread.
+//
+// With open(dir) accounts survive restarts: every registration is appended
+// (and flushed) to users.journal, and the journal is periodically folded
+// into users.snapshot.
 class UserStore {
 public:
+    explicit UserStore(uint32_t pbkdf2_iterations = 50000);
+    ~UserStore();
+
+    // load users.snapshot + users.journal from dir and journal new accounts there
+    void open(const std::string& dir);
+    // stop journaling (hot restart: the next process takes the files over); accounts stay in memory
+    void close();
+
     bool register_user(const std::string& username, const std::string& password);
     bool check_login(const std::string& username, const std::string& password);
+    std::size_t user_count() const { return user_count_.load(std::memory_order_relaxed); }
 
 private:
-    std::mutex users_mutex_;
-    std::unordered_map<std::string, std::string> user_password_map_;
+    static constexpr std::size_t kShardCount = 16;
+    static constexpr std::size_t kJournalCompactThreshold = 10000;
+
+    struct Shard {
+        std::mutex users_mutex;
+        std::unordered_map<std::string, std::string> user_credential_map; // username -> credential
+    };
+
+    Shard& shard_for(const std::string& username);
+    void load_file(const std::string& path);
+    void append_journal(const std::string& username, const std::string& credential);
+    void write_snapshot_locked();
+
+    std::array<Shard, kShardCount> shards_;
+    std::atomic<std::size_t> user_count_{0};
+    uint32_t pbkdf2_iterations_;
+    std::string dummy_credential_; // verified against for unknown users, so a miss costs as much as a hit
+
+    std::mutex persist_mutex_; // guards the journal file and snapshot rewrites
+    std::string data_dir_;
+    std::FILE* journal_file_ = nullptr;
+    std::size_t journal_entries_ = 0;
 };
@@ -0,0 +1,103 @@
+// wire_codec.cpp
+#include "wire_codec.hpp"
+#include "wire_tables.hpp"
+#include <unordered_map>
+
+using json = nlohmann::json;
+
+namespace {
+
+using wire::kTypeNames;
+using wire::kTypeCount;
+
+uint64_t type_tag(const std::string& name) {
+    static const std::unordered_map<std::string, uint64_t> tags = [] {
+        std::unordered_map<std::string, uint64_t> m;
+        for (std::size_t i = 0; i < kTypeCount; ++i) m.emplace(kTypeNames[i], i + 1);
+        return m;
+    }();
+    auto it = tags.find(name);
+    return it == tags.end() ? 0 : it->second;
+}
+
+// CBOR initial byte + argument (RFC 8949 section 3)
+void cbor_head(std::vector<uint8_t>& out, uint8_t major, uint64_t value) {
+    major = static_cast<uint8_t>(major << 5);
+    if (value < 24) {
+        out.push_back(static_cast<uint8_t>(major | value));
+        return;
+    }
+    int bytes;
+    if (value <= 0xFF) { out.push_back(major | 24); bytes = 1; }
+    else if (value <= 0xFFFF) { out.push_back(major | 25); bytes = 2; }
+    else if (value <= 0xFFFFFFFFull) { out.push_back(major | 26); bytes = 4; }
+    else { out.push_back(major | 27); bytes = 8; }
+    for (int i = bytes - 1; i >= 0; --i) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+void write_length_prefix(std::vector<uint8_t>& frame) {
+    uint32_t len = static_cast<uint32_t>(frame.size() - 4);
+    frame[0] = static_cast<uint8_t>((len >> 24) & 0xFF);
+    frame[1] = static_cast<uint8_t>((len >> 16) & 0xFF);
+    frame[2] = static_cast<uint8_t>((len >> 8) & 0xFF);
+    frame[3] = static_cast<uint8_t>((len) & 0xFF);
+}
+
+} // namespace
+
+const char* wire_encoding_name(WireEncoding encoding) {
+    return encoding == WireEncoding::Cbor ? "cbor" : "json";
+}
+
+std::size_t wire_type_tag(const std::string& type) {
+    return static_cast<std::size_t>(type_tag(type));
+}
+
+const char* wire_type_name(std::size_t tag) {
+    return tag >= 1 && tag <= kTypeCount ? kTypeNames[tag - 1] : "other";
+}
+
+std::size_t wire_type_count() {
+    return kTypeCount;
+}
+
+bool parse_wire_encoding(const std::string& name, WireEncoding& encoding) {
+    if (name == "json") { encoding = WireEncoding::Json; return true; }
+    if (name == "cbor") { encoding = WireEncoding::Cbor; return true; }
+    return false;
+}
+
+SharedFrame encode_frame(const json& message, WireEncoding encoding) {
+    if (encoding == WireEncoding::Json || !message.is_object()) return make_shared_frame(message.dump());
+
+    // Write the top-level map by hand so "type" can become a tag without
+    // copying the message; values are appended by nlohmann's CBOR writer.
+    std::vector<uint8_t> frame = take_frame_buffer(128);
+    frame.resize(4);
+    cbor_head(frame, 5, message.size());
+    for (auto it = message.begin(); it != message.end(); ++it) {
+        const std::string& key = it.key();
+        cbor_head(frame, 3, key.size());
+        frame.insert(frame.end(), key.begin(), key.end());
+        uint64_t tag = 0;
+        if (key == "type" && it->is_string()) tag = type_tag(it->get_ref<const std::string&>());
+        if (tag) cbor_head(frame, 0, tag);
+        else json::to_cbor(*it, frame);
+    }
+    write_length_prefix(frame);
+    return share_frame(std::move(frame));
+}
+
+json decode_payload(const uint8_t* payload, std::size_t len) {
+    // CBOR maps have major type 5 (0xA0..0xBF); no JSON text starts with those bytes
+    if (len > 0 && (payload[0] & 0xE0) == 0xA0) {
+        json j = json::from_cbor(payload, payload + len);
+        auto it = j.find("type");
+        if (it != j.end() && it->is_number_unsigned()) {
+            uint64_t tag = it->get<uint64_t>();
+            *it = (tag >= 1 && tag <= kTypeCount) ? kTypeNames[tag - 1] : "";
+        }
+        return j;
+    }
+    return json::parse(payload, payload + len);
+}
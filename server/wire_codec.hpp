@@ -0,0 +1,30 @@
+// wire_codec.hpp
+#pragma once
+#include <cstdint>
+#include <string>
+#include <nlohmann/json.hpp>
+#include "protocol.hpp"
+
+// Payload encodings a session can speak. Every connection starts with JSON;
+// a client may switch the server->client direction to CBOR with a "hello"
+// handshake.
+//
+// In CBOR payloads the "type" field is a small unsigned tag instead of a
+// string (see the table in common/wire_tables.hpp, shared with the Qt client).
+// Inbound frames are told apart by their first byte: a CBOR map starts
+// with 0xA0..0xBF, which never begins JSON text.
+enum class WireEncoding : uint8_t { Json = 0, Cbor = 1 };
+
+const char* wire_encoding_name(WireEncoding encoding);
+bool parse_wire_encoding(const std::string& name, WireEncoding& encoding);
+
+// message type tags (0 = unknown type); also used to label per-type metrics
+std::size_t wire_type_tag(const std::string& type);
+const char* wire_type_name(std::size_t tag);
+std::size_t wire_type_count(); // highest tag in use
+
+// encode a message into a complete frame (length prefix + payload)
+SharedFrame encode_frame(const nlohmann::json& message, WireEncoding encoding);
+
+// decode a frame payload of either encoding; throws on malformed input
+nlohmann::json decode_payload(const uint8_t* payload, std::size_t len);
@@ -0,0 +1,51 @@
+// worker_pool.hpp
+#pragma once
+#include <boost/asio/thread_pool.hpp>
+#include <boost/asio/post.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+// Fixed-size pool for CPU-heavy work that must stay off the io threads
+// (credential hashing). Bounded: try_submit refuses work once max_pending
+// tasks are queued or running, so a login storm sheds load instead of
+// building an unbounded backlog.
+class WorkerPool {
+public:
+    WorkerPool(std::size_t threads, std::size_t max_pending)
+        : pool_(threads ? threads : 1), max_pending_(max_pending ? max_pending : 1) {}
+
+    ~WorkerPool() { pool_.join(); }
+
+    bool try_submit(std::function<void()> task) {
+        if (pending_.fetch_add(1, std::memory_order_relaxed) >= max_pending_) {
+            pending_.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        boost::asio::post(pool_, [this, task = std::move(task)]() {
+            try { task(); } catch (...) {}
+            if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lk(idle_mutex_);
+                idle_cv_.notify_all();
+            }
+        });
+        return true;
+    }
+
+    std::size_t pending() const { return pending_.load(std::memory_order_relaxed); }
+
+    // block until no task is queued or running, or until deadline; false on timeout
+    bool wait_idle(std::chrono::steady_clock::time_point deadline) {
+        std::unique_lock<std::mutex> lk(idle_mutex_);
+        return idle_cv_.wait_until(lk, deadline, [this]() { return pending_.load(std::memory_order_acquire) == 0; });
+    }
+
+private:
+    boost::asio::thread_pool pool_;
+    std::atomic<std::size_t> pending_{0};
+    std::size_t max_pending_;
+    std::mutex idle_mutex_;
+    std::condition_variable idle_cv_;
+};